@@ -0,0 +1,233 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Common helpers for the benchmark harnesses.
+ */
+
+#include "bench-util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *SYNC_MODE_ENV = "__NV_X11_EGL_SYNC_MODE";
+
+uint64_t benchNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+int benchSetSyncMode(const char *mode)
+{
+    if (strcmp(mode, "default") == 0)
+    {
+        unsetenv(SYNC_MODE_ENV);
+        return 0;
+    }
+    else if (strcmp(mode, "explicit") == 0 || strcmp(mode, "implicit") == 0
+            || strcmp(mode, "none") == 0 || strcmp(mode, "prime") == 0)
+    {
+        setenv(SYNC_MODE_ENV, mode, 1);
+        return 0;
+    }
+    else
+    {
+        fprintf(stderr, "Unknown sync mode: %s\n", mode);
+        return -1;
+    }
+}
+
+int benchOpenDisplay(BenchDisplay *bd)
+{
+    static const EGLint CONFIG_ATTRIBS[] =
+    {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    static const EGLint CONTEXT_ATTRIBS[] =
+    {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+    EGLAttrib platformAttribs[] =
+    {
+        EGL_PLATFORM_XCB_SCREEN_EXT, 0,
+        EGL_NONE
+    };
+    EGLConfig configs[BENCH_MAX_CONFIGS];
+    PFNEGLGETPLATFORMDISPLAYPROC getPlatformDisplay;
+    xcb_screen_iterator_t iter;
+    EGLint numConfigs = 0;
+    int screen = 0;
+    int i;
+
+    memset(bd, 0, sizeof(*bd));
+    bd->dpy = EGL_NO_DISPLAY;
+    bd->ctx = EGL_NO_CONTEXT;
+
+    bd->conn = xcb_connect(NULL, &screen);
+    if (xcb_connection_has_error(bd->conn))
+    {
+        fprintf(stderr, "Can't open X connection\n");
+        goto fail;
+    }
+
+    iter = xcb_setup_roots_iterator(xcb_get_setup(bd->conn));
+    for (i=0; i<screen; i++)
+    {
+        xcb_screen_next(&iter);
+    }
+    bd->screen = iter.data;
+    platformAttribs[1] = screen;
+
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYPROC) eglGetProcAddress("eglGetPlatformDisplay");
+    if (getPlatformDisplay == NULL)
+    {
+        fprintf(stderr, "eglGetPlatformDisplay is not available\n");
+        goto fail;
+    }
+
+    bd->dpy = getPlatformDisplay(EGL_PLATFORM_XCB_EXT, bd->conn, platformAttribs);
+    if (bd->dpy == EGL_NO_DISPLAY)
+    {
+        fprintf(stderr, "Can't create EGLDisplay for EGL_PLATFORM_XCB_EXT\n");
+        goto fail;
+    }
+    if (!eglInitialize(bd->dpy, NULL, NULL))
+    {
+        fprintf(stderr, "eglInitialize failed: 0x%x\n", eglGetError());
+        goto fail;
+    }
+
+    if (!eglChooseConfig(bd->dpy, CONFIG_ATTRIBS, configs, BENCH_MAX_CONFIGS, &numConfigs) || numConfigs == 0)
+    {
+        fprintf(stderr, "No matching EGLConfig\n");
+        goto fail;
+    }
+
+    bd->config = benchFindConfigForVisual(bd->dpy, configs, numConfigs, bd->screen->root_visual);
+
+    if (!eglBindAPI(EGL_OPENGL_ES_API))
+    {
+        fprintf(stderr, "eglBindAPI failed\n");
+        goto fail;
+    }
+    bd->ctx = eglCreateContext(bd->dpy, bd->config, EGL_NO_CONTEXT, CONTEXT_ATTRIBS);
+    if (bd->ctx == EGL_NO_CONTEXT)
+    {
+        fprintf(stderr, "eglCreateContext failed: 0x%x\n", eglGetError());
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    benchCloseDisplay(bd);
+    return -1;
+}
+
+void benchCloseDisplay(BenchDisplay *bd)
+{
+    if (bd->dpy != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(bd->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (bd->ctx != EGL_NO_CONTEXT)
+        {
+            eglDestroyContext(bd->dpy, bd->ctx);
+        }
+        eglTerminate(bd->dpy);
+    }
+    if (bd->conn != NULL)
+    {
+        xcb_disconnect(bd->conn);
+    }
+    memset(bd, 0, sizeof(*bd));
+    bd->dpy = EGL_NO_DISPLAY;
+    bd->ctx = EGL_NO_CONTEXT;
+}
+
+xcb_window_t benchCreateWindow(xcb_connection_t *conn, xcb_screen_t *screen,
+        uint16_t width, uint16_t height)
+{
+    xcb_window_t win = xcb_generate_id(conn);
+
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, screen->root,
+            0, 0, width, height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+            screen->root_visual, 0, NULL);
+    xcb_map_window(conn, win);
+    xcb_flush(conn);
+    return win;
+}
+
+EGLConfig benchFindConfigForVisual(EGLDisplay dpy, const EGLConfig *configs, EGLint count,
+        xcb_visualid_t visual)
+{
+    EGLint i;
+
+    for (i=0; i<count; i++)
+    {
+        EGLint configVisual = 0;
+        if (eglGetConfigAttrib(dpy, configs[i], EGL_NATIVE_VISUAL_ID, &configVisual)
+                && (xcb_visualid_t) configVisual == visual)
+        {
+            return configs[i];
+        }
+    }
+    return configs[0];
+}
+
+/**
+ * A qsort comparison function for uint64_t samples.
+ */
+static int CompareSamples(const void *a, const void *b)
+{
+    uint64_t va = *((const uint64_t *) a);
+    uint64_t vb = *((const uint64_t *) b);
+    return (va > vb) - (va < vb);
+}
+
+void benchSortSamples(uint64_t *samples, size_t count)
+{
+    qsort(samples, count, sizeof(uint64_t), CompareSamples);
+}
+
+uint64_t benchPercentile(const uint64_t *samples, size_t count, unsigned int pct)
+{
+    size_t index;
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    index = (count * pct) / 100;
+    if (index >= count)
+    {
+        index = count - 1;
+    }
+    return samples[index];
+}
@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+/**
+ * \file
+ *
+ * Common helpers for the benchmark harnesses.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <xcb/xcb.h>
+
+#ifndef EGL_PLATFORM_XCB_EXT
+#define EGL_PLATFORM_XCB_EXT 0x31DC
+#endif
+#ifndef EGL_PLATFORM_XCB_SCREEN_EXT
+#define EGL_PLATFORM_XCB_SCREEN_EXT 0x31DE
+#endif
+
+/**
+ * The most configs that a harness asks eglChooseConfig for.
+ */
+#define BENCH_MAX_CONFIGS 256
+
+/**
+ * The connection, display, and context that a harness renders with.
+ */
+typedef struct
+{
+    xcb_connection_t *conn;
+    xcb_screen_t *screen;
+    EGLDisplay dpy;
+    EGLConfig config;
+    EGLContext ctx;
+} BenchDisplay;
+
+/**
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t benchNowNs(void);
+
+/**
+ * Selects a synchronization mode by setting __NV_X11_EGL_SYNC_MODE, which
+ * restricts what the platform library picks:
+ *
+ * - "explicit" turns off supports_implicit_sync, so windows use explicit sync
+ *   (use_explicit_sync) whenever the server supports it.
+ * - "implicit" turns off supports_explicit_sync, so presentation attaches a
+ *   sync FD to each dma-buf instead.
+ * - "none" turns off both, so the library has to wait for rendering to
+ *   finish before each present.
+ * - "prime" sets force_prime, so every frame is copied into a linear PRIME
+ *   pixmap.
+ * - "default" leaves the library's own choice alone.
+ *
+ * This has to be called before the EGLDisplay is initialized.
+ *
+ * \param mode The name of the mode.
+ * \return 0 on success, or -1 if \p mode isn't recognized.
+ */
+int benchSetSyncMode(const char *mode);
+
+/**
+ * Opens an xcb connection, creates an EGLDisplay for it, and picks a window
+ * config and a GLES2 context.
+ *
+ * \param[out] bd Receives the display.
+ * \return 0 on success, or -1 on failure.
+ */
+int benchOpenDisplay(BenchDisplay *bd);
+
+/**
+ * Destroys everything created by benchOpenDisplay.
+ */
+void benchCloseDisplay(BenchDisplay *bd);
+
+/**
+ * Picks a config that uses the given X visual, so that a window with that
+ * visual can be used with it.
+ *
+ * \param dpy The display.
+ * \param configs The configs from eglChooseConfig.
+ * \param count The number of configs, which must be at least one.
+ * \param visual The X visual to look for.
+ * \return The first config that matches, or the first config if none do.
+ */
+EGLConfig benchFindConfigForVisual(EGLDisplay dpy, const EGLConfig *configs, EGLint count,
+        xcb_visualid_t visual);
+
+/**
+ * Creates and maps an X window of the given size, using the root window's
+ * visual.
+ */
+xcb_window_t benchCreateWindow(xcb_connection_t *conn, xcb_screen_t *screen,
+        uint16_t width, uint16_t height);
+
+/**
+ * Sorts an array of samples in ascending order.
+ */
+void benchSortSamples(uint64_t *samples, size_t count);
+
+/**
+ * Returns a percentile from an array of samples.
+ *
+ * \param samples The samples, which must already be sorted.
+ * \param count The number of samples.
+ * \param pct The percentile, from 0 to 100.
+ * \return The sample at that percentile, or 0 if \p count is zero.
+ */
+uint64_t benchPercentile(const uint64_t *samples, size_t count, unsigned int pct);
+
+#endif // BENCH_UTIL_H
@@ -0,0 +1,556 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * A benchmark for display initialization and surface creation.
+ *
+ * This times eglInitialize, eglChooseConfig with and without
+ * EGL_MATCH_NATIVE_PIXMAP, eglCreateWindowSurface, eglCreatePixmapSurface,
+ * and eglDestroySurface, and reports the X protocol round trips and DRM
+ * ioctls that each call makes. It writes one JSON object per line on stdout.
+ *
+ * The counts come from the platform library's trace, so the library has to
+ * be built with the "tracing" meson option. Each iteration runs in a child
+ * process with __NV_X11_EGL_TRACE pointing at a temporary file. Once the
+ * child exits and the trace is written, the parent matches the timestamped
+ * events in the trace against the start and end of each call. Without
+ * tracing, the counts are reported as null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench-util.h"
+
+#define DEFAULT_ITERATIONS 5
+#define PIXMAP_SIZE 64
+
+static const char *TRACE_ENV = "__NV_X11_EGL_TRACE";
+
+/**
+ * The calls that the harness times.
+ */
+typedef enum
+{
+    CALL_GET_PLATFORM_DISPLAY,
+    CALL_INITIALIZE,
+    CALL_CHOOSE_CONFIG,
+    CALL_CHOOSE_CONFIG_MATCH_PIXMAP,
+    CALL_CREATE_WINDOW_SURFACE,
+    CALL_CREATE_PIXMAP_SURFACE,
+    CALL_DESTROY_WINDOW_SURFACE,
+    CALL_DESTROY_PIXMAP_SURFACE,
+    CALL_TERMINATE,
+    CALL_COUNT
+} BenchCall;
+
+static const char *CALL_NAMES[CALL_COUNT] =
+{
+    "eglGetPlatformDisplay",
+    "eglInitialize",
+    "eglChooseConfig",
+    "eglChooseConfig(EGL_MATCH_NATIVE_PIXMAP)",
+    "eglCreateWindowSurface",
+    "eglCreatePixmapSurface",
+    "eglDestroySurface(window)",
+    "eglDestroySurface(pixmap)",
+    "eglTerminate",
+};
+
+/**
+ * The start and end time of each call, which the child process sends back
+ * to the parent.
+ */
+typedef struct
+{
+    uint64_t start[CALL_COUNT];
+    uint64_t end[CALL_COUNT];
+} CallTimes;
+
+/**
+ * The number of round trips and ioctls for each call, from the trace.
+ */
+typedef struct
+{
+    unsigned int roundTrips[CALL_COUNT];
+    unsigned int ioctls[CALL_COUNT];
+} CallCounts;
+
+/**
+ * Evaluates \p expr and records its start and end time for \p call.
+ */
+#define TIME_CALL(times, call, expr) \
+    do { \
+        (times)->start[call] = benchNowNs(); \
+        expr; \
+        (times)->end[call] = benchNowNs(); \
+    } while (0)
+
+/**
+ * Runs every call once and fills in their times.
+ *
+ * This runs in the child process.
+ *
+ * \return 0 on success, or -1 if any call failed.
+ */
+static int RunCalls(CallTimes *times)
+{
+    static const EGLint WINDOW_CONFIG_ATTRIBS[] =
+    {
+        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+    EGLAttrib platformAttribs[] =
+    {
+        EGL_PLATFORM_XCB_SCREEN_EXT, 0,
+        EGL_NONE
+    };
+    EGLint pixmapConfigAttribs[] =
+    {
+        EGL_MATCH_NATIVE_PIXMAP, 0,
+        EGL_SURFACE_TYPE, EGL_PIXMAP_BIT,
+        EGL_NONE
+    };
+    EGLConfig configs[BENCH_MAX_CONFIGS];
+    PFNEGLGETPLATFORMDISPLAYPROC getPlatformDisplay;
+    xcb_connection_t *conn = NULL;
+    xcb_screen_iterator_t iter;
+    xcb_screen_t *screen;
+    xcb_window_t win = 0;
+    xcb_pixmap_t pix = 0;
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    EGLConfig windowConfig = NULL;
+    EGLConfig pixmapConfig = NULL;
+    EGLSurface windowSurf = EGL_NO_SURFACE;
+    EGLSurface pixmapSurf = EGL_NO_SURFACE;
+    EGLint numConfigs = 0;
+    EGLBoolean ok = EGL_FALSE;
+    int screenIndex = 0;
+    int ret = -1;
+    int i;
+
+    conn = xcb_connect(NULL, &screenIndex);
+    if (xcb_connection_has_error(conn))
+    {
+        fprintf(stderr, "Can't open X connection\n");
+        goto done;
+    }
+    iter = xcb_setup_roots_iterator(xcb_get_setup(conn));
+    for (i=0; i<screenIndex; i++)
+    {
+        xcb_screen_next(&iter);
+    }
+    screen = iter.data;
+    platformAttribs[1] = screenIndex;
+
+    // Create the native window and pixmap up front, so that their requests
+    // don't get counted against the EGL calls.
+    win = benchCreateWindow(conn, screen, PIXMAP_SIZE, PIXMAP_SIZE);
+    pix = xcb_generate_id(conn);
+    xcb_create_pixmap(conn, screen->root_depth, pix, screen->root, PIXMAP_SIZE, PIXMAP_SIZE);
+    free(xcb_get_input_focus_reply(conn, xcb_get_input_focus(conn), NULL));
+    pixmapConfigAttribs[1] = (EGLint) pix;
+
+    getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYPROC) eglGetProcAddress("eglGetPlatformDisplay");
+    if (getPlatformDisplay == NULL)
+    {
+        fprintf(stderr, "eglGetPlatformDisplay is not available\n");
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_GET_PLATFORM_DISPLAY,
+            dpy = getPlatformDisplay(EGL_PLATFORM_XCB_EXT, conn, platformAttribs));
+    if (dpy == EGL_NO_DISPLAY)
+    {
+        fprintf(stderr, "Can't create EGLDisplay for EGL_PLATFORM_XCB_EXT\n");
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_INITIALIZE, ok = eglInitialize(dpy, NULL, NULL));
+    if (!ok)
+    {
+        fprintf(stderr, "eglInitialize failed: 0x%x\n", eglGetError());
+        dpy = EGL_NO_DISPLAY;
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_CHOOSE_CONFIG,
+            ok = eglChooseConfig(dpy, WINDOW_CONFIG_ATTRIBS, configs, BENCH_MAX_CONFIGS, &numConfigs));
+    if (!ok || numConfigs <= 0)
+    {
+        fprintf(stderr, "No matching EGLConfig for a window\n");
+        goto done;
+    }
+    windowConfig = benchFindConfigForVisual(dpy, configs, numConfigs, screen->root_visual);
+
+    TIME_CALL(times, CALL_CHOOSE_CONFIG_MATCH_PIXMAP,
+            ok = eglChooseConfig(dpy, pixmapConfigAttribs, &pixmapConfig, 1, &numConfigs));
+    if (!ok || numConfigs <= 0)
+    {
+        fprintf(stderr, "No matching EGLConfig for pixmap 0x%x\n", pix);
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_CREATE_WINDOW_SURFACE,
+            windowSurf = eglCreateWindowSurface(dpy, windowConfig, (EGLNativeWindowType) (uintptr_t) win, NULL));
+    if (windowSurf == EGL_NO_SURFACE)
+    {
+        fprintf(stderr, "eglCreateWindowSurface failed: 0x%x\n", eglGetError());
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_CREATE_PIXMAP_SURFACE,
+            pixmapSurf = eglCreatePixmapSurface(dpy, pixmapConfig, (EGLNativePixmapType) (uintptr_t) pix, NULL));
+    if (pixmapSurf == EGL_NO_SURFACE)
+    {
+        fprintf(stderr, "eglCreatePixmapSurface failed: 0x%x\n", eglGetError());
+        goto done;
+    }
+
+    TIME_CALL(times, CALL_DESTROY_WINDOW_SURFACE, eglDestroySurface(dpy, windowSurf));
+    windowSurf = EGL_NO_SURFACE;
+    TIME_CALL(times, CALL_DESTROY_PIXMAP_SURFACE, eglDestroySurface(dpy, pixmapSurf));
+    pixmapSurf = EGL_NO_SURFACE;
+
+    TIME_CALL(times, CALL_TERMINATE, eglTerminate(dpy));
+    dpy = EGL_NO_DISPLAY;
+
+    ret = 0;
+
+done:
+    if (dpy != EGL_NO_DISPLAY)
+    {
+        if (windowSurf != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(dpy, windowSurf);
+        }
+        if (pixmapSurf != EGL_NO_SURFACE)
+        {
+            eglDestroySurface(dpy, pixmapSurf);
+        }
+        eglTerminate(dpy);
+    }
+    if (conn != NULL)
+    {
+        if (pix != 0)
+        {
+            xcb_free_pixmap(conn, pix);
+        }
+        if (win != 0)
+        {
+            xcb_destroy_window(conn, win);
+        }
+        xcb_disconnect(conn);
+    }
+    return ret;
+}
+
+/**
+ * Reads a trace file and counts the events that fall within each call.
+ *
+ * Round trips show up as instant events named after the xcb request, and
+ * each DRM ioctl wrapper records a scope whose name starts with "drm".
+ *
+ * \return 0 on success, or -1 if the trace file couldn't be read.
+ */
+static int CountTraceEvents(const char *path, const CallTimes *times, CallCounts *counts)
+{
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t lineSize = 0;
+
+    memset(counts, 0, sizeof(*counts));
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (getline(&line, &lineSize, fp) >= 0)
+    {
+        const char *name = strstr(line, "{\"name\":\"");
+        const char *phase = strstr(line, "\"ph\":\"");
+        const char *ts = strstr(line, "\"ts\":");
+        unsigned long long usec = 0;
+        unsigned int nsec = 0;
+        uint64_t timestamp;
+        EGLBoolean isRoundTrip;
+        EGLBoolean isIoctl;
+        int call;
+
+        if (name == NULL || phase == NULL || ts == NULL
+                || sscanf(ts, "\"ts\":%llu.%u", &usec, &nsec) != 2)
+        {
+            continue;
+        }
+        name += strlen("{\"name\":\"");
+        phase += strlen("\"ph\":\"");
+
+        isRoundTrip = (phase[0] == 'i' && strncmp(name, "xcb_", 4) == 0);
+        isIoctl = (phase[0] == 'B' && strncmp(name, "drm", 3) == 0);
+        if (!isRoundTrip && !isIoctl)
+        {
+            continue;
+        }
+
+        timestamp = ((uint64_t) usec) * 1000 + nsec;
+        for (call = 0; call < CALL_COUNT; call++)
+        {
+            if (timestamp >= times->start[call] && timestamp <= times->end[call])
+            {
+                if (isRoundTrip)
+                {
+                    counts->roundTrips[call]++;
+                }
+                else
+                {
+                    counts->ioctls[call]++;
+                }
+                break;
+            }
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+/**
+ * Runs one iteration in a child process, and prints the results.
+ *
+ * \param traceBase The trace path to give to the child.
+ * \param iteration The iteration number, for the output.
+ * \return 0 on success, or -1 on failure.
+ */
+static int RunIteration(const char *traceBase, int iteration)
+{
+    CallTimes times;
+    CallCounts counts;
+    EGLBoolean haveCounts;
+    char *tracePath = NULL;
+    ssize_t size = 0;
+    int fds[2];
+    int status = 0;
+    pid_t pid;
+    int call;
+
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "pipe failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "fork failed: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        // Use exit rather than _exit, so that the platform library's
+        // destructor runs and writes out the trace.
+        close(fds[0]);
+        memset(&times, 0, sizeof(times));
+        if (RunCalls(&times) != 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (write(fds[1], &times, sizeof(times)) != sizeof(times))
+        {
+            exit(EXIT_FAILURE);
+        }
+        close(fds[1]);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    while (size < (ssize_t) sizeof(times))
+    {
+        ssize_t num = read(fds[0], ((char *) &times) + size, sizeof(times) - size);
+        if (num <= 0)
+        {
+            if (num < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        size += num;
+    }
+    close(fds[0]);
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+            || WEXITSTATUS(status) != EXIT_SUCCESS || size != sizeof(times))
+    {
+        fprintf(stderr, "Iteration %d failed\n", iteration);
+        return -1;
+    }
+
+    // The trace is written by the xcb platform library, which appends its
+    // platform name and the process ID to the path.
+    if (asprintf(&tracePath, "%s.xcb.%d", traceBase, (int) pid) < 0)
+    {
+        return -1;
+    }
+    haveCounts = (CountTraceEvents(tracePath, &times, &counts) == 0);
+    free(tracePath);
+
+    for (call = 0; call < CALL_COUNT; call++)
+    {
+        printf("{\"test\": \"startup\", \"iteration\": %d, \"call\": \"%s\", \"time_us\": %.1f, ",
+                iteration, CALL_NAMES[call], (times.end[call] - times.start[call]) / 1000.0);
+        if (haveCounts)
+        {
+            printf("\"round_trips\": %u, \"drm_ioctls\": %u}\n",
+                    counts.roundTrips[call], counts.ioctls[call]);
+        }
+        else
+        {
+            printf("\"round_trips\": null, \"drm_ioctls\": null}\n");
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/**
+ * Removes any trace files left in the temporary directory, and then the
+ * directory itself.
+ *
+ * If the Xlib platform library gets loaded too, then it writes its own trace
+ * file next to the one from the XCB library.
+ */
+static void RemoveTraceDir(const char *dir)
+{
+    DIR *dp = opendir(dir);
+
+    if (dp != NULL)
+    {
+        struct dirent *ent;
+        while ((ent = readdir(dp)) != NULL)
+        {
+            char *path = NULL;
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            {
+                continue;
+            }
+            if (asprintf(&path, "%s/%s", dir, ent->d_name) >= 0)
+            {
+                unlink(path);
+                free(path);
+            }
+        }
+        closedir(dp);
+    }
+    rmdir(dir);
+}
+
+/**
+ * Prints the command line options to stderr.
+ */
+static void PrintUsage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -m, --mode MODE        default, explicit, implicit, none, or prime\n"
+            "  -n, --iterations N     number of times to run (default %d)\n",
+            name, DEFAULT_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option OPTIONS[] =
+    {
+        { "mode", required_argument, NULL, 'm' },
+        { "iterations", required_argument, NULL, 'n' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    char traceDir[] = "/tmp/egl-x11-bench-XXXXXX";
+    char *traceBase = NULL;
+    const char *mode = "default";
+    int iterations = DEFAULT_ITERATIONS;
+    int ret = EXIT_SUCCESS;
+    int opt;
+    int i;
+
+    while ((opt = getopt_long(argc, argv, "m:n:h", OPTIONS, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                mode = optarg;
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (iterations <= 0)
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (benchSetSyncMode(mode) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (mkdtemp(traceDir) == NULL)
+    {
+        fprintf(stderr, "Can't create temporary directory: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (asprintf(&traceBase, "%s/trace.json", traceDir) < 0)
+    {
+        rmdir(traceDir);
+        return EXIT_FAILURE;
+    }
+    setenv(TRACE_ENV, traceBase, 1);
+
+    for (i=0; i<iterations; i++)
+    {
+        if (RunIteration(traceBase, i) != 0)
+        {
+            ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    free(traceBase);
+    RemoveTraceDir(traceDir);
+    return ret;
+}
@@ -0,0 +1,362 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * A benchmark for eglSwapBuffers throughput and latency.
+ *
+ * This renders a trivial frame into one or more windows on a single xcb
+ * connection and reports swaps per second and swap-call latency percentiles,
+ * with one JSON object per line on stdout. It also runs a resize storm, where
+ * the window changes size before every frame.
+ *
+ * The --mode option picks the synchronization path, as described for
+ * benchSetSyncMode. It needs an X server with DRI3 and Present, such as
+ * XWayland or Xvfb with DRI3 enabled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include <GLES2/gl2.h>
+
+#include "bench-util.h"
+
+#define DEFAULT_FRAMES 300
+#define DEFAULT_MAX_WINDOWS 32
+#define WARMUP_FRAMES 10
+#define WINDOW_WIDTH 256
+#define WINDOW_HEIGHT 256
+
+/**
+ * Draws and presents one frame in the current surface.
+ *
+ * \param bd The display.
+ * \param surf The surface to present.
+ * \param frame The frame number, which picks the clear color.
+ * \param[out] ret_ns Receives the time that eglSwapBuffers took.
+ * \return 0 on success, or -1 if eglSwapBuffers failed.
+ */
+static int DrawFrame(BenchDisplay *bd, EGLSurface surf, unsigned int frame, uint64_t *ret_ns)
+{
+    uint64_t start;
+
+    glClearColor((frame & 1) ? 1.0f : 0.0f, (frame & 2) ? 1.0f : 0.0f, (frame & 4) ? 1.0f : 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    start = benchNowNs();
+    if (!eglSwapBuffers(bd->dpy, surf))
+    {
+        fprintf(stderr, "eglSwapBuffers failed: 0x%x\n", eglGetError());
+        return -1;
+    }
+    if (ret_ns != NULL)
+    {
+        *ret_ns = benchNowNs() - start;
+    }
+    return 0;
+}
+
+/**
+ * Sorts the samples and prints one JSON line with the results.
+ */
+static void PrintResults(const char *test, const char *mode, int windows,
+        uint64_t *samples, size_t count, uint64_t elapsedNs)
+{
+    benchSortSamples(samples, count);
+    printf("{\"test\": \"%s\", \"mode\": \"%s\", \"windows\": %d, \"swaps\": %zu, "
+            "\"swaps_per_sec\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+            "\"p99_us\": %.1f, \"max_us\": %.1f}\n",
+            test, mode, windows, count,
+            elapsedNs > 0 ? count * 1e9 / elapsedNs : 0.0,
+            benchPercentile(samples, count, 50) / 1000.0,
+            benchPercentile(samples, count, 90) / 1000.0,
+            benchPercentile(samples, count, 99) / 1000.0,
+            count > 0 ? samples[count - 1] / 1000.0 : 0.0);
+    fflush(stdout);
+}
+
+/**
+ * Renders into \p numWindows windows in turn, using a single context.
+ *
+ * The swap interval is 0, so this measures how fast the library can
+ * present rather than the display's refresh rate.
+ */
+static int RunSwapTest(BenchDisplay *bd, const char *mode, int numWindows, unsigned int frames)
+{
+    xcb_window_t *windows = calloc(numWindows, sizeof(xcb_window_t));
+    EGLSurface *surfaces = calloc(numWindows, sizeof(EGLSurface));
+    uint64_t *samples = calloc((size_t) numWindows * frames, sizeof(uint64_t));
+    size_t count = 0;
+    uint64_t start;
+    unsigned int f;
+    int ret = -1;
+    int i;
+
+    if (windows == NULL || surfaces == NULL || samples == NULL)
+    {
+        goto done;
+    }
+
+    for (i=0; i<numWindows; i++)
+    {
+        surfaces[i] = EGL_NO_SURFACE;
+    }
+    for (i=0; i<numWindows; i++)
+    {
+        windows[i] = benchCreateWindow(bd->conn, bd->screen, WINDOW_WIDTH, WINDOW_HEIGHT);
+        surfaces[i] = eglCreateWindowSurface(bd->dpy, bd->config, (EGLNativeWindowType) (uintptr_t) windows[i], NULL);
+        if (surfaces[i] == EGL_NO_SURFACE)
+        {
+            fprintf(stderr, "eglCreateWindowSurface failed: 0x%x\n", eglGetError());
+            goto done;
+        }
+        if (!eglMakeCurrent(bd->dpy, surfaces[i], surfaces[i], bd->ctx))
+        {
+            fprintf(stderr, "eglMakeCurrent failed: 0x%x\n", eglGetError());
+            goto done;
+        }
+        eglSwapInterval(bd->dpy, 0);
+
+        for (f=0; f<WARMUP_FRAMES; f++)
+        {
+            if (DrawFrame(bd, surfaces[i], f, NULL) != 0)
+            {
+                goto done;
+            }
+        }
+    }
+
+    start = benchNowNs();
+    for (f=0; f<frames; f++)
+    {
+        for (i=0; i<numWindows; i++)
+        {
+            if (numWindows > 1 && !eglMakeCurrent(bd->dpy, surfaces[i], surfaces[i], bd->ctx))
+            {
+                fprintf(stderr, "eglMakeCurrent failed: 0x%x\n", eglGetError());
+                goto done;
+            }
+            if (DrawFrame(bd, surfaces[i], f, &samples[count]) != 0)
+            {
+                goto done;
+            }
+            count++;
+        }
+    }
+    glFinish();
+
+    PrintResults("swap", mode, numWindows, samples, count, benchNowNs() - start);
+    ret = 0;
+
+done:
+    eglMakeCurrent(bd->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surfaces != NULL)
+    {
+        for (i=0; i<numWindows; i++)
+        {
+            if (surfaces[i] != EGL_NO_SURFACE)
+            {
+                eglDestroySurface(bd->dpy, surfaces[i]);
+            }
+        }
+    }
+    if (windows != NULL)
+    {
+        for (i=0; i<numWindows; i++)
+        {
+            if (windows[i] != 0)
+            {
+                xcb_destroy_window(bd->conn, windows[i]);
+            }
+        }
+        xcb_flush(bd->conn);
+    }
+    free(windows);
+    free(surfaces);
+    free(samples);
+    return ret;
+}
+
+/**
+ * Resizes a window before every frame, so that each eglSwapBuffers call has
+ * to pick up a new size and reallocate its buffers.
+ */
+static int RunResizeTest(BenchDisplay *bd, const char *mode, unsigned int frames)
+{
+    uint64_t *samples = calloc(frames, sizeof(uint64_t));
+    xcb_window_t win = 0;
+    EGLSurface surf = EGL_NO_SURFACE;
+    uint64_t start;
+    unsigned int f;
+    int ret = -1;
+
+    if (samples == NULL)
+    {
+        goto done;
+    }
+
+    win = benchCreateWindow(bd->conn, bd->screen, WINDOW_WIDTH, WINDOW_HEIGHT);
+    surf = eglCreateWindowSurface(bd->dpy, bd->config, (EGLNativeWindowType) (uintptr_t) win, NULL);
+    if (surf == EGL_NO_SURFACE)
+    {
+        fprintf(stderr, "eglCreateWindowSurface failed: 0x%x\n", eglGetError());
+        goto done;
+    }
+    if (!eglMakeCurrent(bd->dpy, surf, surf, bd->ctx))
+    {
+        fprintf(stderr, "eglMakeCurrent failed: 0x%x\n", eglGetError());
+        goto done;
+    }
+    eglSwapInterval(bd->dpy, 0);
+
+    start = benchNowNs();
+    for (f=0; f<frames; f++)
+    {
+        uint32_t size[2];
+
+        // Alternate between two sizes, so that every frame is a real change.
+        size[0] = WINDOW_WIDTH + ((f & 1) ? 64 : 0) + (f % 7);
+        size[1] = WINDOW_HEIGHT + ((f & 1) ? 32 : 0) + (f % 5);
+        xcb_configure_window(bd->conn, win, XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, size);
+        xcb_flush(bd->conn);
+
+        glViewport(0, 0, size[0], size[1]);
+        if (DrawFrame(bd, surf, f, &samples[f]) != 0)
+        {
+            goto done;
+        }
+    }
+    glFinish();
+
+    PrintResults("resize", mode, 1, samples, frames, benchNowNs() - start);
+    ret = 0;
+
+done:
+    eglMakeCurrent(bd->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (surf != EGL_NO_SURFACE)
+    {
+        eglDestroySurface(bd->dpy, surf);
+    }
+    if (win != 0)
+    {
+        xcb_destroy_window(bd->conn, win);
+        xcb_flush(bd->conn);
+    }
+    free(samples);
+    return ret;
+}
+
+/**
+ * Prints the command line options to stderr.
+ */
+static void PrintUsage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [options]\n"
+            "  -m, --mode MODE        default, explicit, implicit, none, or prime\n"
+            "  -t, --test TEST        swap, resize, or all (default all)\n"
+            "  -f, --frames N         frames per window (default %d)\n"
+            "  -w, --max-windows N    largest window count to test (default %d)\n",
+            name, DEFAULT_FRAMES, DEFAULT_MAX_WINDOWS);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option OPTIONS[] =
+    {
+        { "mode", required_argument, NULL, 'm' },
+        { "test", required_argument, NULL, 't' },
+        { "frames", required_argument, NULL, 'f' },
+        { "max-windows", required_argument, NULL, 'w' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    BenchDisplay bd;
+    const char *mode = "default";
+    const char *test = "all";
+    int frames = DEFAULT_FRAMES;
+    int maxWindows = DEFAULT_MAX_WINDOWS;
+    int ret = EXIT_SUCCESS;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "m:t:f:w:h", OPTIONS, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                mode = optarg;
+                break;
+            case 't':
+                test = optarg;
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'w':
+                maxWindows = atoi(optarg);
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (frames <= 0 || maxWindows <= 0
+            || (strcmp(test, "all") != 0 && strcmp(test, "swap") != 0 && strcmp(test, "resize") != 0))
+    {
+        PrintUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (benchSetSyncMode(mode) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+    if (benchOpenDisplay(&bd) != 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(test, "all") == 0 || strcmp(test, "swap") == 0)
+    {
+        int numWindows;
+        for (numWindows = 1; numWindows <= maxWindows; numWindows *= 2)
+        {
+            if (RunSwapTest(&bd, mode, numWindows, frames) != 0)
+            {
+                ret = EXIT_FAILURE;
+                goto done;
+            }
+        }
+    }
+
+    if (strcmp(test, "all") == 0 || strcmp(test, "resize") == 0)
+    {
+        if (RunResizeTest(&bd, mode, frames) != 0)
+        {
+            ret = EXIT_FAILURE;
+            goto done;
+        }
+    }
+
+done:
+    benchCloseDisplay(&bd);
+    return ret;
+}
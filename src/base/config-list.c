@@ -26,6 +26,33 @@
 
 #include "platform-utils.h"
 
+/**
+ * The maximum number of results that eplConfigListChooseConfigs will cache.
+ */
+#define CHOOSE_CACHE_SIZE 16
+
+/**
+ * A cached result from eplConfigListChooseConfigs.
+ */
+typedef struct
+{
+    /**
+     * The normalized attribute list, not including EGL_MATCH_NATIVE_PIXMAP.
+     * This is not terminated with EGL_NONE.
+     */
+    EGLint *attribs;
+    EGLint num_attribs;
+    uint32_t hash;
+
+    /**
+     * The matching configs, terminated with NULL.
+     */
+    EplConfig **configs;
+    EGLint num_configs;
+
+    struct glvnd_list entry;
+} EplChooseCacheEntry;
+
 const EplFormatInfo FORMAT_INFO_LIST[] =
 {
     { DRM_FORMAT_ARGB8888, 32, { 8, 8, 8, 8 }, { 16, 8,  0, 24 } },
@@ -145,12 +172,11 @@ static void LookupConfigInfo(EplPlatformData *platform, EGLDisplay edpy, EGLConf
     }
 }
 
-EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
+EGLConfig *eplConfigListGetDriverConfigs(EplPlatformData *platform, EGLDisplay edpy,
+        EGLint *ret_count)
 {
-    EplConfigList *list = NULL;
     EGLConfig *driverConfigs = NULL;
     EGLint numConfigs = 0;
-    EGLint i;
 
     if (!platform->egl.GetConfigs(edpy, NULL, 0, &numConfigs) || numConfigs <= 0)
     {
@@ -170,16 +196,48 @@ EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
     }
     qsort(driverConfigs, numConfigs, sizeof(EGLConfig), CompareConfig);
 
-    list = malloc(sizeof(EplConfigList) + numConfigs * sizeof(EplConfig));
+    *ret_count = numConfigs;
+    return driverConfigs;
+}
+
+static EplConfigList *AllocConfigList(EplPlatformData *platform, EGLint num_configs)
+{
+    EplConfigList *list = malloc(sizeof(EplConfigList) + num_configs * sizeof(EplConfig));
     if (list == NULL)
     {
         eplSetError(platform, EGL_BAD_ALLOC, "Out of memory");
-        free(driverConfigs);
         return NULL;
     }
 
     list->configs = (EplConfig *) (list + 1);
-    list->num_configs = numConfigs;
+    list->num_configs = num_configs;
+    glvnd_list_init(&list->choose_cache);
+    list->num_choose_cache = 0;
+    pthread_mutex_init(&list->choose_cache_mutex, NULL);
+
+    return list;
+}
+
+EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
+{
+    EplConfigList *list = NULL;
+    EGLConfig *driverConfigs = NULL;
+    EGLint numConfigs = 0;
+    EGLint i;
+
+    driverConfigs = eplConfigListGetDriverConfigs(platform, edpy, &numConfigs);
+    if (driverConfigs == NULL)
+    {
+        return NULL;
+    }
+
+    list = AllocConfigList(platform, numConfigs);
+    if (list == NULL)
+    {
+        free(driverConfigs);
+        return NULL;
+    }
+
     for (i=0; i<numConfigs; i++)
     {
         LookupConfigInfo(platform, edpy, driverConfigs[i], &list->configs[i]);
@@ -189,9 +247,41 @@ EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy)
     return list;
 }
 
+EplConfigList *eplConfigListCreateFromArray(EplPlatformData *platform,
+        const EplConfig *configs, EGLint num_configs)
+{
+    EplConfigList *list = AllocConfigList(platform, num_configs);
+    if (list == NULL)
+    {
+        return NULL;
+    }
+
+    memcpy(list->configs, configs, num_configs * sizeof(EplConfig));
+
+    return list;
+}
+
+static void FreeChooseCacheEntry(EplChooseCacheEntry *entry)
+{
+    free(entry->attribs);
+    free(entry->configs);
+    free(entry);
+}
+
 void eplConfigListFree(EplConfigList *list)
 {
-    free(list);
+    if (list != NULL)
+    {
+        while (!glvnd_list_is_empty(&list->choose_cache))
+        {
+            EplChooseCacheEntry *entry = glvnd_list_first_entry(&list->choose_cache,
+                    EplChooseCacheEntry, entry);
+            glvnd_list_del(&entry->entry);
+            FreeChooseCacheEntry(entry);
+        }
+        pthread_mutex_destroy(&list->choose_cache_mutex);
+        free(list);
+    }
 }
 
 EplConfig *eplConfigListFind(EplConfigList *list, EGLConfig config)
@@ -214,6 +304,145 @@ EGLint eplConfigListFindIndex(EplConfigList *list, EGLConfig config)
     }
 }
 
+/**
+ * Sorts an attribute list by attribute, so that the same attributes in a
+ * different order will match the same cache entry.
+ *
+ * If an attribute appears more than once, then the order might matter, so in
+ * that case, this leaves the list unchanged.
+ *
+ * \param attribs The attribute list to sort, with \p count attribute/value
+ *      pairs.
+ */
+static void NormalizeAttribs(EGLint *attribs, EGLint count)
+{
+    EGLint *sorted;
+    EGLint i, j;
+
+    if (count < 2)
+    {
+        return;
+    }
+
+    sorted = malloc(count * 2 * sizeof(EGLint));
+    if (sorted == NULL)
+    {
+        return;
+    }
+
+    // This is an insertion sort, but attribute lists are short.
+    for (i=0; i<count; i++)
+    {
+        for (j=i; j>0 && sorted[(j - 1) * 2] > attribs[i * 2]; j--)
+        {
+            sorted[j * 2] = sorted[(j - 1) * 2];
+            sorted[j * 2 + 1] = sorted[(j - 1) * 2 + 1];
+        }
+        if (j > 0 && sorted[(j - 1) * 2] == attribs[i * 2])
+        {
+            // Duplicate attribute.
+            free(sorted);
+            return;
+        }
+        sorted[j * 2] = attribs[i * 2];
+        sorted[j * 2 + 1] = attribs[i * 2 + 1];
+    }
+
+    memcpy(attribs, sorted, count * 2 * sizeof(EGLint));
+    free(sorted);
+}
+
+static uint32_t HashAttribs(const EGLint *attribs, EGLint num)
+{
+    // 32-bit FNV-1a.
+    uint32_t hash = 2166136261u;
+    EGLint i;
+
+    for (i=0; i<num; i++)
+    {
+        hash ^= (uint32_t) attribs[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Looks up a cached eplConfigListChooseConfigs result.
+ *
+ * \return A new NULL-terminated copy of the cached result, or NULL if there
+ *      isn't a matching entry.
+ */
+static EplConfig **LookupChooseCache(EplConfigList *list,
+        const EGLint *attribs, EGLint num, uint32_t hash, EGLint *ret_count)
+{
+    EplChooseCacheEntry *entry;
+    EplConfig **configs = NULL;
+
+    pthread_mutex_lock(&list->choose_cache_mutex);
+    glvnd_list_for_each_entry(entry, &list->choose_cache, entry)
+    {
+        if (entry->hash == hash && entry->num_attribs == num
+                && memcmp(entry->attribs, attribs, num * sizeof(EGLint)) == 0)
+        {
+            configs = malloc((entry->num_configs + 1) * sizeof(EplConfig *));
+            if (configs != NULL)
+            {
+                memcpy(configs, entry->configs, (entry->num_configs + 1) * sizeof(EplConfig *));
+                *ret_count = entry->num_configs;
+
+                glvnd_list_del(&entry->entry);
+                glvnd_list_add(&entry->entry, &list->choose_cache);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&list->choose_cache_mutex);
+
+    return configs;
+}
+
+/**
+ * Adds a result to the eplConfigListChooseConfigs cache.
+ *
+ * If we run out of memory, then this just leaves the cache unchanged.
+ */
+static void AddChooseCache(EplConfigList *list,
+        const EGLint *attribs, EGLint num, uint32_t hash,
+        EplConfig **configs, EGLint count)
+{
+    EplChooseCacheEntry *entry = calloc(1, sizeof(EplChooseCacheEntry));
+    if (entry == NULL)
+    {
+        return;
+    }
+
+    entry->attribs = malloc(num * sizeof(EGLint));
+    entry->configs = malloc((count + 1) * sizeof(EplConfig *));
+    if (entry->attribs == NULL || entry->configs == NULL)
+    {
+        FreeChooseCacheEntry(entry);
+        return;
+    }
+    memcpy(entry->attribs, attribs, num * sizeof(EGLint));
+    entry->num_attribs = num;
+    entry->hash = hash;
+    memcpy(entry->configs, configs, (count + 1) * sizeof(EplConfig *));
+    entry->num_configs = count;
+
+    pthread_mutex_lock(&list->choose_cache_mutex);
+    if (list->num_choose_cache >= CHOOSE_CACHE_SIZE)
+    {
+        EplChooseCacheEntry *last = glvnd_list_last_entry(&list->choose_cache,
+                EplChooseCacheEntry, entry);
+        glvnd_list_del(&last->entry);
+        FreeChooseCacheEntry(last);
+        list->num_choose_cache--;
+    }
+    glvnd_list_add(&entry->entry, &list->choose_cache);
+    list->num_choose_cache++;
+    pthread_mutex_unlock(&list->choose_cache_mutex);
+}
+
 EplConfig **eplConfigListChooseConfigs(EplPlatformData *platform, EGLDisplay edpy,
         EplConfigList *list, const EGLint *attribs,
         EGLint *ret_count, EGLint *ret_native_pixmap)
@@ -229,8 +458,10 @@ EplConfig **eplConfigListChooseConfigs(EplPlatformData *platform, EGLDisplay edp
     EplConfig **configs = NULL;
     EGLBoolean success = EGL_FALSE;
     EGLint matchCount = 0;
+    uint32_t hash;
     EGLint i;
 
+    // Note that the cache key below also needs 3 extra elements.
     attribsCopy = malloc((numAttribs + 3) * sizeof(EGLint));
     if (attribsCopy == NULL)
     {
@@ -270,6 +501,24 @@ EplConfig **eplConfigListChooseConfigs(EplPlatformData *platform, EGLDisplay edp
             }
         }
     }
+
+    /*
+     * Check if we've already got a result for the same attributes. The key is
+     * the driver's attributes, followed by the attributes that we filter
+     * ourselves.
+     */
+    NormalizeAttribs(attribsCopy, numAttribs / 2);
+    attribsCopy[numAttribs] = surfaceMask;
+    attribsCopy[numAttribs + 1] = nativeRenderable;
+    attribsCopy[numAttribs + 2] = nativeVisualType;
+    hash = HashAttribs(attribsCopy, numAttribs + 3);
+    configs = LookupChooseCache(list, attribsCopy, numAttribs + 3, hash, &matchCount);
+    if (configs != NULL)
+    {
+        success = EGL_TRUE;
+        goto done;
+    }
+
     // Get configs for all surface types. We'll filter those manually below.
     attribsCopy[numAttribs++] = EGL_SURFACE_TYPE;
     attribsCopy[numAttribs++] = EGL_DONT_CARE;
@@ -331,6 +580,13 @@ EplConfig **eplConfigListChooseConfigs(EplPlatformData *platform, EGLDisplay edp
     configs[matchCount] = NULL;
     success = EGL_TRUE;
 
+    // Restore the cache key that we built above.
+    numAttribs -= 2;
+    attribsCopy[numAttribs] = surfaceMask;
+    attribsCopy[numAttribs + 1] = nativeRenderable;
+    attribsCopy[numAttribs + 2] = nativeVisualType;
+    AddChooseCache(list, attribsCopy, numAttribs + 3, hash, configs, matchCount);
+
 done:
     if (success)
     {
@@ -108,6 +108,18 @@ typedef struct
      */
     EplConfig *configs;
     EGLint num_configs;
+
+    /**
+     * Recent results from eplConfigListChooseConfigs, with the most recently
+     * used entry first.
+     *
+     * The driver's eglChooseConfig results won't change for the lifetime of
+     * the list, so callers that keep asking for the same attributes don't need
+     * to go through the driver each time.
+     */
+    struct glvnd_list choose_cache;
+    int num_choose_cache;
+    pthread_mutex_t choose_cache_mutex;
 } EplConfigList;
 
 /**
@@ -118,6 +130,29 @@ typedef struct
  */
 EplConfigList *eplConfigListCreate(EplPlatformData *platform, EGLDisplay edpy);
 
+/**
+ * Returns the driver's EGLConfigs, sorted by handle.
+ *
+ * \param edpy The internal EGLDisplay.
+ * \param[out] ret_count Returns the number of EGLConfigs.
+ * \return An array of EGLConfigs, or NULL on error. The caller must free the
+ *      array using free().
+ */
+EGLConfig *eplConfigListGetDriverConfigs(EplPlatformData *platform, EGLDisplay edpy,
+        EGLint *ret_count);
+
+/**
+ * Creates an EplConfigList from an array of EplConfig structs that the caller
+ * has already filled in, such as from a cache.
+ *
+ * \param configs The EplConfig structs to copy. This must be sorted by the
+ *      EGLConfig handle.
+ * \param num_configs The number of elements in \p configs.
+ * \return A new EplConfigList struct.
+ */
+EplConfigList *eplConfigListCreateFromArray(EplPlatformData *platform,
+        const EplConfig *configs, EGLint num_configs);
+
 void eplConfigListFree(EplConfigList *list);
 
 /**
@@ -141,6 +176,9 @@ EplConfig *eplConfigListFind(EplConfigList *list, EGLConfig config);
  * \p attribs, then the value is returned in \p ret_native_pixmap. Otherwise,
  * \p ret_native_pixmap is left unchanged.
  *
+ * The results are cached, so calling this again with the same attributes
+ * won't call into the driver.
+ *
  * This function returns a NULL-terminated array of EplConfig pointers, so the
  * caller can do any additional filtering as needed. You can use
  * eplConfigListReturnConfigs to copy the results to an EGLConfig array.
@@ -43,11 +43,46 @@ static void TerminateDisplay(EplDisplay *pdpy);
 static void CheckTerminateDisplay(EplDisplay *pdpy);
 static void DestroyDisplay(EplDisplay *pdpy);
 
+/**
+ * The number of buckets in display_hash. This must be a power of two.
+ */
+#define DISPLAY_HASH_SIZE 16
+
 /**
  * A list of all EplDisplay structs.
+ *
+ * Nearly every EGL call has to look up an EplDisplay, but the list only
+ * changes in eglGetPlatformDisplay and at teardown, so this is protected by a
+ * read/write lock instead of a mutex. Lookups only take the read lock, and
+ * they take a reference to the display before dropping it, so that threads
+ * using different displays don't contend with each other.
  */
 static struct glvnd_list display_list = { &display_list, &display_list };
-static pthread_mutex_t display_list_mutex;
+static pthread_rwlock_t display_list_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * The number of times that the current thread has locked display_list_lock
+ * for writing.
+ *
+ * A pthread_rwlock_t isn't recursive, but some paths need to look up or lock
+ * the list again while they hold the write lock. For example,
+ * impl->GetPlatformDisplay runs with the write lock held, and so do the
+ * callers of eplLockDisplayList. So, LockDisplayListWrite only takes the lock
+ * at the outermost level, and eplLockDisplayInternal skips the read lock if
+ * this thread already holds the write lock.
+ *
+ * The read lock is never held across a call out of this file, so a thread
+ * never tries to take the write lock while it holds the read lock.
+ */
+static __thread int display_list_write_depth = 0;
+
+/**
+ * The same displays as display_list, hashed by their external handles, so
+ * that eplLockDisplayInternal doesn't have to walk the whole list.
+ *
+ * This is protected by display_list_lock.
+ */
+static struct glvnd_list display_hash[DISPLAY_HASH_SIZE];
 
 /**
  * A list of all EplPlatformData structs.
@@ -59,12 +94,54 @@ static pthread_mutex_t platform_data_list_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static __attribute__((constructor)) void LibraryInit(void)
 {
-    eplInitRecursiveMutex(&display_list_mutex);
+    int i;
+
+    for (i=0; i<DISPLAY_HASH_SIZE; i++)
+    {
+        glvnd_list_init(&display_hash[i]);
+    }
+}
+
+/**
+ * Returns the hash bucket for an EGLDisplay or EGLSurface handle.
+ *
+ * \param handle The handle.
+ * \param size The number of buckets, which must be a power of two.
+ */
+static inline uint32_t HashHandle(const void *handle, uint32_t size)
+{
+    // Fibonacci hashing, so that the low bits of a pointer, which are usually
+    // zero because of alignment, don't matter.
+    uint64_t value = (uint64_t) (uintptr_t) handle;
+    return (uint32_t) ((value * 0x9e3779b97f4a7c15ull) >> 32) & (size - 1);
 }
 
 static __attribute__((destructor)) void LibraryFini(void)
 {
-    pthread_mutex_destroy(&display_list_mutex);
+    pthread_rwlock_destroy(&display_list_lock);
+}
+
+/**
+ * Locks display_list_lock for writing. This can be called recursively.
+ */
+static void LockDisplayListWrite(void)
+{
+    if (display_list_write_depth++ == 0)
+    {
+        pthread_rwlock_wrlock(&display_list_lock);
+    }
+}
+
+/**
+ * Releases one level of LockDisplayListWrite.
+ */
+static void UnlockDisplayListWrite(void)
+{
+    assert(display_list_write_depth > 0);
+    if (--display_list_write_depth == 0)
+    {
+        pthread_rwlock_unlock(&display_list_lock);
+    }
 }
 
 EPL_REFCOUNT_DEFINE_TYPE_FUNCS(EplPlatformData, eplPlatformData, refcount, free);
@@ -126,6 +203,7 @@ EplPlatformData *eplPlatformBaseAllocate(int major, int minor,
     platform->egl.CreatePbufferSurface = driver->getProcAddress("eglCreatePbufferSurface");
     platform->egl.DestroySurface = driver->getProcAddress("eglDestroySurface");
     platform->egl.SwapBuffers = driver->getProcAddress("eglSwapBuffers");
+    platform->egl.QuerySurface = driver->getProcAddress("eglQuerySurface");
     platform->egl.GetCurrentDisplay = driver->getProcAddress("eglGetCurrentDisplay");
     platform->egl.GetCurrentSurface = driver->getProcAddress("eglGetCurrentSurface");
     platform->egl.GetCurrentContext = driver->getProcAddress("eglGetCurrentContext");
@@ -158,6 +236,7 @@ EplPlatformData *eplPlatformBaseAllocate(int major, int minor,
             || platform->egl.CreatePbufferSurface == NULL
             || platform->egl.DestroySurface == NULL
             || platform->egl.SwapBuffers == NULL
+            || platform->egl.QuerySurface == NULL
             || platform->egl.GetCurrentDisplay == NULL
             || platform->egl.GetCurrentSurface == NULL
             || platform->egl.GetCurrentContext == NULL
@@ -224,7 +303,7 @@ static EGLBoolean eplUnloadExternalPlatformExport(void *platformData)
 
     platform->destroyed = EGL_TRUE;
 
-    pthread_mutex_lock(&display_list_mutex);
+    LockDisplayListWrite();
     glvnd_list_for_each_entry_safe(pdpy, pdpyTmp, &display_list, entry)
     {
         if (pdpy->platform != platform)
@@ -236,6 +315,7 @@ static EGLBoolean eplUnloadExternalPlatformExport(void *platformData)
 
         // Remove the display from the list and decrement its refcount.
         glvnd_list_del(&pdpy->entry);
+        glvnd_list_del(&pdpy->hash_entry);
         pthread_mutex_unlock(&pdpy->mutex);
 
         // Note that if some other thread is still holding a reference to this
@@ -248,7 +328,7 @@ static EGLBoolean eplUnloadExternalPlatformExport(void *platformData)
             DestroyDisplay(pdpy);
         }
     }
-    pthread_mutex_unlock(&display_list_mutex);
+    UnlockDisplayListWrite();
 
     // Free the internal display list. Note that the driver will already have
     // terminated all of the internal eglDisplays.
@@ -276,33 +356,62 @@ static EplDisplay *eplLockDisplayInternal(EGLDisplay edpy)
 {
     EplDisplay *pdpy = NULL;
     EplDisplay *node = NULL;
+    EGLBoolean readLock = (display_list_write_depth == 0);
 
     if (edpy == EGL_NO_DISPLAY)
     {
         return NULL;
     }
 
-    pthread_mutex_lock(&display_list_mutex);
-    glvnd_list_for_each_entry(node, &display_list, entry)
+    // If this thread already holds the write lock, then taking the read lock
+    // would deadlock, and we don't need it anyway.
+    if (readLock)
+    {
+        pthread_rwlock_rdlock(&display_list_lock);
+    }
+    glvnd_list_for_each_entry(node, &display_hash[HashHandle(edpy, DISPLAY_HASH_SIZE)], hash_entry)
     {
         if (node->external_display == edpy)
         {
             pdpy = node;
+            eplRefCountRef(&pdpy->refcount);
             break;
         }
     }
+    if (readLock)
+    {
+        pthread_rwlock_unlock(&display_list_lock);
+    }
 
     if (pdpy == NULL)
     {
-        pthread_mutex_unlock(&display_list_mutex);
         return NULL;
     }
 
+    /*
+     * The reference that we took above keeps the EplDisplay alive, even if
+     * another thread removes it from the list, so we don't need to hold the
+     * list lock while we wait for the display's mutex.
+     */
     pthread_mutex_lock(&pdpy->mutex);
-    eplRefCountRef(&pdpy->refcount);
-    pdpy->use_count++;
 
-    pthread_mutex_unlock(&display_list_mutex);
+    /*
+     * While we were waiting, eplUnloadExternalPlatformExport might have
+     * removed the display from the list and torn down its platform. It does
+     * that while holding the display's mutex, so check again now that we
+     * hold it.
+     */
+    if (pdpy->platform->destroyed || glvnd_list_is_empty(&pdpy->entry))
+    {
+        pthread_mutex_unlock(&pdpy->mutex);
+        if (eplRefCountUnref(&pdpy->refcount))
+        {
+            DestroyDisplay(pdpy);
+        }
+        return NULL;
+    }
+
+    pdpy->use_count++;
 
     return pdpy;
 }
@@ -528,7 +637,7 @@ EplSurface *eplSurfaceAcquire(EplDisplay *pdpy, EGLSurface esurf)
         return NULL;
     }
 
-    glvnd_list_for_each_entry(psurf, &pdpy->surface_list, entry)
+    glvnd_list_for_each_entry(psurf, &pdpy->surface_hash[HashHandle(esurf, EPL_SURFACE_HASH_SIZE)], hash_entry)
     {
         if (psurf->external_surface == esurf)
         {
@@ -614,7 +723,7 @@ static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
     }
     remainingAttribs[attribIndex] = EGL_NONE;
 
-    pthread_mutex_lock(&display_list_mutex);
+    LockDisplayListWrite();
     glvnd_list_for_each_entry(node, &display_list, entry)
     {
         if (node->track_references != track_references)
@@ -668,7 +777,12 @@ static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
     pdpy->track_references = track_references;
     pdpy->native_display = nativeDisplay;
     glvnd_list_init(&pdpy->surface_list);
+    for (i=0; i<EPL_SURFACE_HASH_SIZE; i++)
+    {
+        glvnd_list_init(&pdpy->surface_hash[i]);
+    }
     glvnd_list_init(&pdpy->entry);
+    glvnd_list_init(&pdpy->hash_entry);
 
     if (!plat->impl->GetPlatformDisplay(plat, pdpy, nativeDisplay, remainingAttribs, &display_list))
     {
@@ -681,10 +795,12 @@ static EGLDisplay eplGetPlatformDisplayExport(void *platformData,
 
     eplRefCountInit(&pdpy->refcount);
     glvnd_list_add(&pdpy->entry, &display_list);
+    glvnd_list_add(&pdpy->hash_entry,
+            &display_hash[HashHandle(pdpy->external_display, DISPLAY_HASH_SIZE)]);
     ret = pdpy->external_display;
 
 done:
-    pthread_mutex_unlock(&display_list_mutex);
+    UnlockDisplayListWrite();
     return ret;
 }
 
@@ -878,6 +994,8 @@ static EGLSurface CommonCreateSurface(EplDisplay *pdpy,
         ret = psurf->external_surface;
         eplRefCountRef(&psurf->refcount);
         glvnd_list_add(&psurf->entry, &pdpy->surface_list);
+        glvnd_list_add(&psurf->hash_entry,
+                &pdpy->surface_hash[HashHandle(psurf->external_surface, EPL_SURFACE_HASH_SIZE)]);
     }
     else
     {
@@ -995,6 +1113,7 @@ static void DeleteSurfaceCommon(EplDisplay *pdpy, EplSurface *psurf)
     {
         psurf->deleted = EGL_TRUE;
         glvnd_list_del(&psurf->entry);
+        glvnd_list_del(&psurf->hash_entry);
         pdpy->platform->impl->DestroySurface(pdpy, psurf);
 
         eplRefCountUnref(&psurf->refcount);
@@ -1163,6 +1282,37 @@ static EGLBoolean HookWaitNative(void)
     return ret;
 }
 
+static EGLBoolean HookQuerySurface(EGLDisplay edpy, EGLSurface esurf, EGLint attribute, EGLint *value)
+{
+    EplDisplay *pdpy;
+    EplSurface *psurf;
+    EGLBoolean ret = EGL_FALSE;
+
+    pdpy = eplDisplayAcquire(edpy);
+    if (pdpy == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    assert(pdpy->platform->impl->QuerySurface != NULL);
+
+    psurf = eplSurfaceAcquire(pdpy, esurf);
+    if (psurf != NULL)
+    {
+        ret = pdpy->platform->impl->QuerySurface(pdpy, psurf, attribute, value);
+        eplSurfaceRelease(pdpy, psurf);
+    }
+    else
+    {
+        // This EGLSurface doesn't belong to the platform library, so just pass
+        // it on to the driver.
+        ret = pdpy->platform->egl.QuerySurface(pdpy->internal_display, esurf, attribute, value);
+    }
+
+    eplDisplayRelease(pdpy);
+    return ret;
+}
+
 static const EplHookFunc BASE_HOOK_FUNCTIONS[] =
 {
     { "eglCreatePbufferSurface", HookCreatePbufferSurface },
@@ -1207,6 +1357,10 @@ void *eplGetHookAddressExport(void *platformData, const char *name)
     {
         return HookWaitNative;
     }
+    if (plat->impl->QuerySurface != NULL && strcmp(name, "eglQuerySurface") == 0)
+    {
+        return HookQuerySurface;
+    }
     return NULL;
 }
 
@@ -1385,11 +1539,11 @@ EGLDeviceEXT *eplGetAllDevices(EplPlatformData *platform, EGLint *ret_count)
 
 struct glvnd_list *eplLockDisplayList(void)
 {
-    pthread_mutex_lock(&display_list_mutex);
+    LockDisplayListWrite();
     return &display_list;
 }
 
 void eplUnlockDisplayList(void)
 {
-    pthread_mutex_unlock(&display_list_mutex);
+    UnlockDisplayListWrite();
 }
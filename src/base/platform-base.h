@@ -47,6 +47,12 @@ typedef struct _EplImplSurface EplImplSurface;
 typedef struct _EplImplDisplay EplImplDisplay;
 typedef struct _EplImplPlatform EplImplPlatform;
 
+/**
+ * The number of buckets in EplDisplay::surface_hash. This must be a power of
+ * two.
+ */
+#define EPL_SURFACE_HASH_SIZE 64
+
 typedef enum
 {
     EPL_SURFACE_TYPE_WINDOW,
@@ -93,6 +99,11 @@ typedef struct
     EplImplSurface *priv;
 
     struct glvnd_list entry;
+
+    /**
+     * The entry in EplDisplay::surface_hash.
+     */
+    struct glvnd_list hash_entry;
 } EplSurface;
 
 /**
@@ -184,7 +195,18 @@ typedef struct
     /// True if this display has been initialized.
     EGLBoolean initialized;
 
+    /**
+     * The same surfaces as surface_list, hashed by their external handles,
+     * so that eplSurfaceAcquire doesn't have to walk the whole list.
+     */
+    struct glvnd_list surface_hash[EPL_SURFACE_HASH_SIZE];
+
     struct glvnd_list entry;
+
+    /**
+     * The entry in the display hash table in platform-base.c.
+     */
+    struct glvnd_list hash_entry;
 } EplDisplay;
 
 typedef struct _EplPlatformData
@@ -200,6 +222,7 @@ typedef struct _EplPlatformData
         PFNEGLCREATEPBUFFERSURFACEPROC CreatePbufferSurface;
         PFNEGLDESTROYSURFACEPROC DestroySurface;
         PFNEGLSWAPBUFFERSPROC SwapBuffers;
+        PFNEGLQUERYSURFACEPROC QuerySurface;
         PFNEGLCHOOSECONFIGPROC ChooseConfig;
         PFNEGLGETCONFIGATTRIBPROC GetConfigAttrib;
         PFNEGLGETCONFIGSPROC GetConfigs;
@@ -407,7 +430,9 @@ EGLDeviceEXT *eplGetAllDevices(EplPlatformData *platform, EGLint *ret_count);
  * This can be used to deal with the application closing a native display out
  * from under us.
  *
- * The caller must call eplUnlockDisplayList after it's finished.
+ * The caller must call eplUnlockDisplayList after it's finished. The caller
+ * can still look up and lock displays while it holds the list lock, and it
+ * can call this again recursively.
  */
 struct glvnd_list *eplLockDisplayList(void);
 
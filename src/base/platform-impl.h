@@ -276,6 +276,26 @@ typedef struct _EplImplFuncs
      * \return EGL_TRUE on success, EGL_FALSE on failure.
      */
     EGLBoolean (*WaitNative) (EplDisplay *pdpy, EplSurface *psurf);
+
+    /**
+     * Implements eglQuerySurface for an EGLSurface that the platform library
+     * owns.
+     *
+     * This function is optional. If it's NULL, then the base library will not
+     * provide a hook function for eglQuerySurface, and so the driver will
+     * handle every query.
+     *
+     * If the platform library doesn't do anything special for \p attribute,
+     * then it should pass the query through to the driver using
+     * EplSurface::internal_surface.
+     *
+     * \param pdpy The EplDisplay struct
+     * \param psurf The EplSurface struct
+     * \param attribute The attribute to query.
+     * \param[out] value Returns the value of the attribute.
+     * \return EGL_TRUE on success, EGL_FALSE on failure.
+     */
+    EGLBoolean (*QuerySurface) (EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value);
 } EplImplFuncs;
 
 #ifdef __cplusplus
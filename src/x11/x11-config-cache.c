@@ -0,0 +1,669 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ * \file
+ *
+ * The on-disk cache of driver formats and EGLConfigs.
+ */
+
+#include "x11-config-cache.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include <EGL/eglext.h>
+
+static const char *CONFIG_CACHE_ENV = "__NV_X11_EGL_CONFIG_CACHE";
+static const char *CONFIG_CACHE_DIR_NAME = "nvidia-egl-x11";
+
+static const uint32_t CONFIG_CACHE_MAGIC = 0x4e584343; // "NXCC"
+
+/**
+ * The version of the cache file layout. This must be incremented whenever
+ * the layout changes, or when the way that we build the cached lists
+ * changes.
+ *
+ * Version 2 leaves out modifiers that need more than X11_MAX_IMPORT_PLANES
+ * planes.
+ */
+static const uint32_t CONFIG_CACHE_VERSION = 2;
+
+/**
+ * The header at the start of a cache file.
+ *
+ * The header is followed by these sections, each padded to a multiple of 8
+ * bytes:
+ *
+ * - The key string, including the NUL terminator.
+ * - The formats from eglQueryDmaBufFormatsEXT, as an array of uint32_t.
+ * - An X11ConfigCacheFormat for each X11DriverFormat, in order by fourcc.
+ *   Each one is followed by its modifiers and then its external modifiers.
+ * - An X11ConfigCacheConfig for each EGLConfig, in order by handle.
+ *
+ * Everything is in native byte order, since the file is only ever read on
+ * the same machine.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t key_size;
+    uint32_t num_raw_formats;
+    uint32_t num_formats;
+    uint32_t num_configs;
+} X11ConfigCacheHeader;
+
+typedef struct
+{
+    uint32_t fourcc;
+    uint32_t num_modifiers;
+    uint32_t num_external_modifiers;
+    uint32_t pad;
+} X11ConfigCacheFormat;
+
+typedef struct
+{
+    uint64_t config;
+    uint32_t fourcc;
+    int32_t surface_mask;
+} X11ConfigCacheConfig;
+
+struct _X11ConfigCache
+{
+    /**
+     * The path to the cache file.
+     */
+    char *path;
+
+    /**
+     * A string that identifies the driver and device.
+     *
+     * If the driver is updated, or if the device node now refers to a
+     * different device, then the key will change, and we'll ignore the
+     * existing file.
+     */
+    char *key;
+    size_t key_size;
+
+    /**
+     * The mapped cache file, or NULL if the file is missing or stale.
+     */
+    const uint8_t *data;
+    size_t size;
+
+    /**
+     * Pointers to each section of the mapped file.
+     */
+    const X11ConfigCacheHeader *header;
+    const uint32_t *raw_formats;
+    const uint8_t *formats;
+    const X11ConfigCacheConfig *configs;
+
+    /**
+     * A copy of the formats from eplX11ConfigCacheGetDriverFormats.
+     */
+    uint32_t *current_raw_formats;
+    uint32_t num_current_raw_formats;
+
+    EGLBoolean formats_hit;
+    EGLBoolean configs_hit;
+};
+
+static size_t Align8(size_t size)
+{
+    return (size + 7) & ~((size_t) 7);
+}
+
+static uint32_t HashString(const char *str)
+{
+    // 32-bit FNV-1a.
+    uint32_t hash = 2166136261u;
+    while (*str != '\0')
+    {
+        hash ^= (uint8_t) *str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int FormatCacheKey(char *buf, size_t size, const char *node,
+        const char *lib, const struct stat *st)
+{
+    return snprintf(buf, size, "%s\n%s\n%llu:%llu:%llu:%lld.%09ld\n%zu",
+            node, lib,
+            (unsigned long long) st->st_dev, (unsigned long long) st->st_ino,
+            (unsigned long long) st->st_size, (long long) st->st_mtim.tv_sec,
+            (long) st->st_mtim.tv_nsec, sizeof(void *));
+}
+
+/**
+ * Builds the key string for a display.
+ *
+ * This identifies the driver by the path, inode, size, and modification time
+ * of the library that contains it, which should change with every driver
+ * update.
+ */
+static char *BuildCacheKey(EplPlatformData *plat, const char *node)
+{
+    Dl_info info;
+    struct stat st;
+    char *key;
+    int len;
+
+    if (dladdr((void *) plat->priv->egl.PlatformGetConfigAttribNVX, &info) == 0
+            || info.dli_fname == NULL)
+    {
+        return NULL;
+    }
+    if (stat(info.dli_fname, &st) != 0)
+    {
+        return NULL;
+    }
+
+    len = FormatCacheKey(NULL, 0, node, info.dli_fname, &st);
+    if (len < 0)
+    {
+        return NULL;
+    }
+    key = malloc(len + 1);
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    FormatCacheKey(key, len + 1, node, info.dli_fname, &st);
+
+    return key;
+}
+
+/**
+ * Returns the directory that cache files go in, or NULL if there isn't any
+ * usable directory. The caller must free the string.
+ *
+ * \param[out] ret_parent Returns the parent directory, which might also need
+ *      to be created.
+ */
+static char *GetCacheDir(char **ret_parent)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *suffix = "";
+    char *parent;
+    char *dir;
+
+    if (base == NULL || base[0] != '/')
+    {
+        base = getenv("HOME");
+        suffix = "/.cache";
+        if (base == NULL || base[0] != '/')
+        {
+            return NULL;
+        }
+    }
+
+    parent = malloc(strlen(base) + strlen(suffix) + 1);
+    if (parent == NULL)
+    {
+        return NULL;
+    }
+    strcpy(parent, base);
+    strcat(parent, suffix);
+
+    dir = malloc(strlen(parent) + strlen(CONFIG_CACHE_DIR_NAME) + 2);
+    if (dir == NULL)
+    {
+        free(parent);
+        return NULL;
+    }
+    sprintf(dir, "%s/%s", parent, CONFIG_CACHE_DIR_NAME);
+
+    *ret_parent = parent;
+    return dir;
+}
+
+/**
+ * Checks the header of a mapped cache file, and fills in the pointers to each
+ * section.
+ */
+static EGLBoolean ParseCacheFile(X11ConfigCache *cache)
+{
+    size_t offset;
+    uint32_t i;
+
+    if (cache->size < sizeof(X11ConfigCacheHeader))
+    {
+        return EGL_FALSE;
+    }
+
+    cache->header = (const X11ConfigCacheHeader *) cache->data;
+    if (cache->header->magic != CONFIG_CACHE_MAGIC
+            || cache->header->version != CONFIG_CACHE_VERSION
+            || cache->header->size != cache->size
+            || cache->header->key_size != cache->key_size)
+    {
+        return EGL_FALSE;
+    }
+
+    offset = Align8(sizeof(X11ConfigCacheHeader));
+    if (cache->size - offset < cache->key_size
+            || memcmp(cache->data + offset, cache->key, cache->key_size) != 0)
+    {
+        return EGL_FALSE;
+    }
+    offset += Align8(cache->key_size);
+
+    if (offset > cache->size
+            || (cache->size - offset) / sizeof(uint32_t) < cache->header->num_raw_formats)
+    {
+        return EGL_FALSE;
+    }
+    cache->raw_formats = (const uint32_t *) (cache->data + offset);
+    offset += Align8(cache->header->num_raw_formats * sizeof(uint32_t));
+
+    cache->formats = cache->data + offset;
+    for (i=0; i<cache->header->num_formats; i++)
+    {
+        const X11ConfigCacheFormat *fmt;
+        uint64_t count;
+
+        if (offset > cache->size || cache->size - offset < sizeof(X11ConfigCacheFormat))
+        {
+            return EGL_FALSE;
+        }
+        fmt = (const X11ConfigCacheFormat *) (cache->data + offset);
+        offset += sizeof(X11ConfigCacheFormat);
+
+        count = (uint64_t) fmt->num_modifiers + fmt->num_external_modifiers;
+        if ((cache->size - offset) / sizeof(uint64_t) < count)
+        {
+            return EGL_FALSE;
+        }
+        offset += count * sizeof(uint64_t);
+    }
+
+    if (offset > cache->size
+            || (cache->size - offset) / sizeof(X11ConfigCacheConfig) != cache->header->num_configs)
+    {
+        return EGL_FALSE;
+    }
+    cache->configs = (const X11ConfigCacheConfig *) (cache->data + offset);
+
+    return EGL_TRUE;
+}
+
+X11ConfigCache *eplX11ConfigCacheOpen(EplPlatformData *plat, X11DisplayInstance *inst)
+{
+    X11ConfigCache *cache = NULL;
+    const char *env;
+    const char *node;
+    char *parent = NULL;
+    char *dir = NULL;
+    struct stat st;
+    int fd = -1;
+
+    env = getenv(CONFIG_CACHE_ENV);
+    if (env == NULL || atoi(env) == 0)
+    {
+        return NULL;
+    }
+
+    node = plat->egl.QueryDeviceStringEXT(inst->device, EGL_DRM_DEVICE_FILE_EXT);
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    cache = calloc(1, sizeof(X11ConfigCache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    cache->key = BuildCacheKey(plat, node);
+    if (cache->key == NULL)
+    {
+        goto fail;
+    }
+    cache->key_size = strlen(cache->key) + 1;
+
+    dir = GetCacheDir(&parent);
+    if (dir == NULL)
+    {
+        goto fail;
+    }
+    cache->path = malloc(strlen(dir) + 32);
+    if (cache->path == NULL)
+    {
+        goto fail;
+    }
+    sprintf(cache->path, "%s/config-%08x.bin", dir, HashString(node));
+    free(dir);
+    free(parent);
+    dir = parent = NULL;
+
+    fd = open(cache->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // There's no cache file yet, so return an empty cache.
+        return cache;
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            cache->data = data;
+            cache->size = st.st_size;
+            if (!ParseCacheFile(cache))
+            {
+                munmap((void *) cache->data, cache->size);
+                cache->data = NULL;
+                cache->size = 0;
+            }
+        }
+    }
+    close(fd);
+
+    return cache;
+
+fail:
+    free(dir);
+    free(parent);
+    eplX11ConfigCacheClose(cache);
+    return NULL;
+}
+
+void eplX11ConfigCacheClose(X11ConfigCache *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    if (cache->data != NULL)
+    {
+        munmap((void *) cache->data, cache->size);
+    }
+    free(cache->current_raw_formats);
+    free(cache->key);
+    free(cache->path);
+    free(cache);
+}
+
+EGLBoolean eplX11ConfigCacheGetDriverFormats(X11ConfigCache *cache, X11DisplayInstance *inst,
+        const EGLint *formats, EGLint num_formats)
+{
+    const uint8_t *ptr;
+    uint32_t i;
+
+    if (cache == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    free(cache->current_raw_formats);
+    cache->num_current_raw_formats = 0;
+    cache->current_raw_formats = malloc(num_formats * sizeof(uint32_t));
+    if (cache->current_raw_formats == NULL)
+    {
+        return EGL_FALSE;
+    }
+    for (i=0; i<(uint32_t) num_formats; i++)
+    {
+        cache->current_raw_formats[i] = (uint32_t) formats[i];
+    }
+    cache->num_current_raw_formats = num_formats;
+
+    if (cache->data == NULL || cache->header->num_formats == 0
+            || cache->header->num_raw_formats != (uint32_t) num_formats
+            || memcmp(cache->raw_formats, cache->current_raw_formats, num_formats * sizeof(uint32_t)) != 0)
+    {
+        return EGL_FALSE;
+    }
+
+    inst->driver_formats = calloc(cache->header->num_formats, sizeof(X11DriverFormat));
+    if (inst->driver_formats == NULL)
+    {
+        return EGL_FALSE;
+    }
+    inst->num_driver_formats = 0;
+
+    ptr = cache->formats;
+    for (i=0; i<cache->header->num_formats; i++)
+    {
+        const X11ConfigCacheFormat *src = (const X11ConfigCacheFormat *) ptr;
+        X11DriverFormat *dst = &inst->driver_formats[inst->num_driver_formats];
+        size_t count = src->num_modifiers + src->num_external_modifiers;
+
+        dst->fourcc = src->fourcc;
+        dst->fmt = eplFormatInfoLookup(src->fourcc);
+        dst->modifiers = malloc(count * sizeof(uint64_t));
+        if (dst->fmt == NULL || src->num_modifiers == 0 || dst->modifiers == NULL)
+        {
+            free(dst->modifiers);
+            eplX11CleanupDriverFormats(inst);
+            return EGL_FALSE;
+        }
+        memcpy(dst->modifiers, src + 1, count * sizeof(uint64_t));
+        dst->num_modifiers = src->num_modifiers;
+        dst->external_modifiers = dst->modifiers + dst->num_modifiers;
+        dst->num_external_modifiers = src->num_external_modifiers;
+        inst->num_driver_formats++;
+
+        ptr += sizeof(X11ConfigCacheFormat) + count * sizeof(uint64_t);
+    }
+
+    cache->formats_hit = EGL_TRUE;
+    return EGL_TRUE;
+}
+
+EGLBoolean eplX11ConfigCacheGetConfigs(X11ConfigCache *cache,
+        const EGLConfig *configs, EGLint num_configs, EplConfig *ret_configs)
+{
+    EGLint i;
+
+    if (cache == NULL || cache->data == NULL
+            || cache->header->num_configs != (uint32_t) num_configs)
+    {
+        return EGL_FALSE;
+    }
+
+    for (i=0; i<num_configs; i++)
+    {
+        if (cache->configs[i].config != (uint64_t) (uintptr_t) configs[i])
+        {
+            return EGL_FALSE;
+        }
+    }
+
+    memset(ret_configs, 0, num_configs * sizeof(EplConfig));
+    for (i=0; i<num_configs; i++)
+    {
+        ret_configs[i].config = configs[i];
+        ret_configs[i].fourcc = cache->configs[i].fourcc;
+        ret_configs[i].surfaceMask = cache->configs[i].surface_mask;
+        ret_configs[i].nativeVisualType = EGL_NONE;
+    }
+
+    cache->configs_hit = EGL_TRUE;
+    return EGL_TRUE;
+}
+
+/**
+ * Creates the cache directory if it doesn't already exist.
+ */
+static EGLBoolean CreateCacheDir(void)
+{
+    char *parent = NULL;
+    char *dir = GetCacheDir(&parent);
+    EGLBoolean success = EGL_FALSE;
+
+    if (dir == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    if (mkdir(parent, 0700) != 0 && errno != EEXIST)
+    {
+        goto done;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST)
+    {
+        goto done;
+    }
+    success = EGL_TRUE;
+
+done:
+    free(dir);
+    free(parent);
+    return success;
+}
+
+void eplX11ConfigCacheSave(X11ConfigCache *cache, X11DisplayInstance *inst)
+{
+    X11ConfigCacheHeader *header;
+    X11ConfigCacheConfig *configs;
+    uint8_t *data = NULL;
+    uint8_t *ptr;
+    char *tmpPath = NULL;
+    size_t size;
+    size_t offset;
+    int fd = -1;
+    int i;
+
+    if (cache == NULL || cache->current_raw_formats == NULL || inst->configs == NULL)
+    {
+        return;
+    }
+    if (cache->formats_hit && cache->configs_hit)
+    {
+        // The file is already up to date.
+        return;
+    }
+
+    size = Align8(sizeof(X11ConfigCacheHeader)) + Align8(cache->key_size)
+        + Align8(cache->num_current_raw_formats * sizeof(uint32_t));
+    for (i=0; i<inst->num_driver_formats; i++)
+    {
+        size += sizeof(X11ConfigCacheFormat) + sizeof(uint64_t)
+            * (inst->driver_formats[i].num_modifiers + inst->driver_formats[i].num_external_modifiers);
+    }
+    size += inst->configs->num_configs * sizeof(X11ConfigCacheConfig);
+
+    data = calloc(1, size);
+    if (data == NULL)
+    {
+        return;
+    }
+
+    header = (X11ConfigCacheHeader *) data;
+    header->magic = CONFIG_CACHE_MAGIC;
+    header->version = CONFIG_CACHE_VERSION;
+    header->size = size;
+    header->key_size = cache->key_size;
+    header->num_raw_formats = cache->num_current_raw_formats;
+    header->num_formats = inst->num_driver_formats;
+    header->num_configs = inst->configs->num_configs;
+
+    offset = Align8(sizeof(X11ConfigCacheHeader));
+    memcpy(data + offset, cache->key, cache->key_size);
+    offset += Align8(cache->key_size);
+
+    memcpy(data + offset, cache->current_raw_formats,
+            cache->num_current_raw_formats * sizeof(uint32_t));
+    offset += Align8(cache->num_current_raw_formats * sizeof(uint32_t));
+
+    ptr = data + offset;
+    for (i=0; i<inst->num_driver_formats; i++)
+    {
+        const X11DriverFormat *src = &inst->driver_formats[i];
+        X11ConfigCacheFormat *dst = (X11ConfigCacheFormat *) ptr;
+
+        dst->fourcc = src->fourcc;
+        dst->num_modifiers = src->num_modifiers;
+        dst->num_external_modifiers = src->num_external_modifiers;
+        ptr += sizeof(X11ConfigCacheFormat);
+
+        memcpy(ptr, src->modifiers, src->num_modifiers * sizeof(uint64_t));
+        ptr += src->num_modifiers * sizeof(uint64_t);
+        memcpy(ptr, src->external_modifiers, src->num_external_modifiers * sizeof(uint64_t));
+        ptr += src->num_external_modifiers * sizeof(uint64_t);
+    }
+
+    configs = (X11ConfigCacheConfig *) ptr;
+    for (i=0; i<inst->configs->num_configs; i++)
+    {
+        const EplConfig *src = &inst->configs->configs[i];
+        configs[i].config = (uint64_t) (uintptr_t) src->config;
+        configs[i].fourcc = src->fourcc;
+        configs[i].surface_mask = src->surfaceMask & ~(EGL_WINDOW_BIT | EGL_PIXMAP_BIT);
+    }
+    assert((uint8_t *) (configs + inst->configs->num_configs) == data + size);
+
+    if (!CreateCacheDir())
+    {
+        goto done;
+    }
+
+    // Write to a temporary file and then rename it, so that another process
+    // never sees a partially written file.
+    tmpPath = malloc(strlen(cache->path) + 32);
+    if (tmpPath == NULL)
+    {
+        goto done;
+    }
+    sprintf(tmpPath, "%s.%ld.tmp", cache->path, (long) getpid());
+
+    fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        goto done;
+    }
+
+    offset = 0;
+    while (offset < size)
+    {
+        ssize_t ret = write(fd, data + offset, size - offset);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        offset += ret;
+    }
+    close(fd);
+
+    if (offset != size || rename(tmpPath, cache->path) != 0)
+    {
+        unlink(tmpPath);
+    }
+
+done:
+    free(tmpPath);
+    free(data);
+}
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef X11_CONFIG_CACHE_H
+#define X11_CONFIG_CACHE_H
+
+/**
+ * \file
+ *
+ * An optional on-disk cache of the driver's formats and EGLConfigs.
+ *
+ * Looking up the format modifiers and config attributes from the driver takes
+ * a lot of calls, which can be a noticeable part of the startup time for a
+ * short-lived program. The cache stores the results in a file under
+ * $XDG_CACHE_HOME, so that the next process can just check that the driver
+ * hasn't changed and copy the results.
+ *
+ * The cache only stores data that comes from the driver. Anything that
+ * depends on the X server, like the native visuals, is still looked up each
+ * time, since that doesn't need any calls into the driver.
+ *
+ * The cache is disabled by default. Set __NV_X11_EGL_CONFIG_CACHE=1 to enable
+ * it.
+ */
+
+#include <EGL/egl.h>
+
+#include "x11-platform.h"
+#include "config-list.h"
+
+/**
+ * Opens the cache file for a display.
+ *
+ * This must be called after the internal EGLDisplay is initialized.
+ *
+ * \return An X11ConfigCache, or NULL if the cache is disabled. If the cache
+ *      file is missing or stale, then this returns an empty cache, which can
+ *      still be passed to eplX11ConfigCacheSave.
+ */
+X11ConfigCache *eplX11ConfigCacheOpen(EplPlatformData *plat, X11DisplayInstance *inst);
+
+/**
+ * Closes a cache file. The cache may be NULL.
+ */
+void eplX11ConfigCacheClose(X11ConfigCache *cache);
+
+/**
+ * Fills in X11DisplayInstance::driver_formats from the cache.
+ *
+ * This also saves a copy of \p formats for eplX11ConfigCacheSave, so it must
+ * be called even if the cache file is stale.
+ *
+ * \param cache The cache, which may be NULL.
+ * \param inst The display instance.
+ * \param formats The formats from eglQueryDmaBufFormatsEXT.
+ * \param num_formats The number of elements in \p formats.
+ * \return EGL_TRUE if the cache had a matching format list.
+ */
+EGLBoolean eplX11ConfigCacheGetDriverFormats(X11ConfigCache *cache, X11DisplayInstance *inst,
+        const EGLint *formats, EGLint num_formats);
+
+/**
+ * Looks up the driver's attributes for every EGLConfig from the cache.
+ *
+ * On success, the config, fourcc, and surfaceMask fields of each element of
+ * \p ret_configs will be filled in, and everything else will be zero. The
+ * fourcc is the driver's EGL_LINUX_DRM_FOURCC_EXT value, and the surfaceMask
+ * does not include EGL_WINDOW_BIT or EGL_PIXMAP_BIT.
+ *
+ * \param cache The cache, which may be NULL.
+ * \param configs The EGLConfigs from eglGetConfigs, sorted by handle.
+ * \param num_configs The number of elements in \p configs.
+ * \param[out] ret_configs An array of \p num_configs elements to fill in.
+ * \return EGL_TRUE if the cache had a matching config list.
+ */
+EGLBoolean eplX11ConfigCacheGetConfigs(X11ConfigCache *cache,
+        const EGLConfig *configs, EGLint num_configs, EplConfig *ret_configs);
+
+/**
+ * Writes the display's format and config lists to the cache file, unless
+ * they both came from the cache in the first place.
+ *
+ * \param cache The cache, which may be NULL.
+ * \param inst The display instance. The driver_formats and configs fields
+ *      must be filled in.
+ */
+void eplX11ConfigCacheSave(X11ConfigCache *cache, X11DisplayInstance *inst);
+
+#endif // X11_CONFIG_CACHE_H
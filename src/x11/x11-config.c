@@ -29,7 +29,9 @@
 #include <xcb/dri3.h>
 
 #include "x11-platform.h"
+#include "x11-config-cache.h"
 #include "config-list.h"
+#include "x11-trace.h"
 
 static int CompareFormatSupportInfo(const void *p1, const void *p2)
 {
@@ -49,8 +51,22 @@ static int CompareFormatSupportInfo(const void *p1, const void *p2)
     }
 }
 
+/**
+ * Returns true if a modifier needs few enough planes that we can import a
+ * buffer with it.
+ */
+static EGLBoolean IsModifierImportable(struct gbm_device *gbmdev, uint32_t fourcc, uint64_t modifier)
+{
+    int planes = gbm_device_get_format_modifier_plane_count(gbmdev, fourcc, modifier);
+
+    // If GBM doesn't know the plane count, then assume that the modifier only
+    // has one plane, since the driver advertised it.
+    return (planes <= X11_MAX_IMPORT_PLANES);
+}
+
 static EGLBoolean InitDriverFormatModifiers(EplPlatformData *plat,
-        EGLDisplay internal_display, uint32_t fourcc, X11DriverFormat *support)
+        EGLDisplay internal_display, struct gbm_device *gbmdev,
+        uint32_t fourcc, X11DriverFormat *support)
 {
     const EplFormatInfo *fmt = eplFormatInfoLookup(fourcc);
     EGLuint64KHR *modifiers = NULL;
@@ -93,9 +109,14 @@ static EGLBoolean InitDriverFormatModifiers(EplPlatformData *plat,
         return EGL_FALSE;
     }
 
-    // Split the modifiers into renderable and external-only.
+    // Split the modifiers into renderable and external-only, and leave out
+    // any modifiers that need more planes than we can import.
     for (i=0; i<num; i++)
     {
+        if (!IsModifierImportable(gbmdev, fmt->fourcc, modifiers[i]))
+        {
+            continue;
+        }
         if (!external[i])
         {
             support->modifiers[support->num_modifiers++] = modifiers[i];
@@ -105,6 +126,10 @@ static EGLBoolean InitDriverFormatModifiers(EplPlatformData *plat,
     support->external_modifiers = support->modifiers + support->num_modifiers;
     for (i=0; i<num; i++)
     {
+        if (!IsModifierImportable(gbmdev, fmt->fourcc, modifiers[i]))
+        {
+            continue;
+        }
         if (external[i])
         {
             support->external_modifiers[support->num_external_modifiers++] = modifiers[i];
@@ -123,11 +148,13 @@ static EGLBoolean InitDriverFormatModifiers(EplPlatformData *plat,
     return EGL_TRUE;
 }
 
-EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *inst)
+EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *inst,
+        X11ConfigCache *cache)
 {
     EGLint *formats = NULL;
     EGLint num = 0;
     EGLint i;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     if (!plat->priv->egl.QueryDmaBufFormatsEXT(inst->internal_display->edpy,
                 0, NULL, &num) || num <= 0)
@@ -148,6 +175,12 @@ EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *in
         return EGL_FALSE;
     }
 
+    if (eplX11ConfigCacheGetDriverFormats(cache, inst, formats, num))
+    {
+        free(formats);
+        return EGL_TRUE;
+    }
+
     inst->driver_formats = calloc(1, num * sizeof(X11DriverFormat));
     if (inst->driver_formats == NULL)
     {
@@ -158,7 +191,7 @@ EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *in
     inst->num_driver_formats = 0;
     for (i=0; i<num; i++)
     {
-        if (InitDriverFormatModifiers(plat, inst->internal_display->edpy, formats[i],
+        if (InitDriverFormatModifiers(plat, inst->internal_display->edpy, inst->gbmdev, formats[i],
                     &inst->driver_formats[inst->num_driver_formats]))
         {
             inst->num_driver_formats++;
@@ -234,32 +267,25 @@ static xcb_visualid_t FindVisualForFormat(EplPlatformData *plat, xcb_connection_
 
     return 0;
 }
-static void SetupConfig(EplPlatformData *plat, X11DisplayInstance *inst, EplConfig *config)
+/**
+ * Sets the surface mask and native visual for a config, based on the fourcc
+ * code from the driver.
+ *
+ * This doesn't make any calls into the driver, so it's also used for configs
+ * that come from the cache.
+ */
+static void SetupConfigFormat(X11DisplayInstance *inst, EplConfig *config)
 {
     X11DriverFormat *support = NULL;
-    EGLint fourcc = DRM_FORMAT_INVALID;
     xcb_visualid_t visual;
 
-    config->surfaceMask &= ~(EGL_WINDOW_BIT | EGL_PIXMAP_BIT);
-
-    // Query the fourcc code from the driver.
-    if (plat->priv->egl.PlatformGetConfigAttribNVX(inst->internal_display->edpy,
-                config->config, EGL_LINUX_DRM_FOURCC_EXT, &fourcc))
-    {
-        config->fourcc = (uint32_t) fourcc;
-    }
-    else
-    {
-        config->fourcc = DRM_FORMAT_INVALID;
-    }
-
     if (config->fourcc == DRM_FORMAT_INVALID)
     {
         // Without a format, we can't do anything with this config.
         return;
     }
 
-    support = eplX11FindDriverFormat(inst, fourcc);
+    support = eplX11FindDriverFormat(inst, config->fourcc);
     if (support == NULL)
     {
         // The driver doesn't support importing a dma-buf with this format.
@@ -283,9 +309,74 @@ static void SetupConfig(EplPlatformData *plat, X11DisplayInstance *inst, EplConf
     }
 }
 
-EGLBoolean eplX11InitConfigList(EplPlatformData *plat, X11DisplayInstance *inst)
+static void SetupConfig(EplPlatformData *plat, X11DisplayInstance *inst, EplConfig *config)
+{
+    EGLint fourcc = DRM_FORMAT_INVALID;
+
+    config->surfaceMask &= ~(EGL_WINDOW_BIT | EGL_PIXMAP_BIT);
+
+    // Query the fourcc code from the driver.
+    if (plat->priv->egl.PlatformGetConfigAttribNVX(inst->internal_display->edpy,
+                config->config, EGL_LINUX_DRM_FOURCC_EXT, &fourcc))
+    {
+        config->fourcc = (uint32_t) fourcc;
+    }
+    else
+    {
+        config->fourcc = DRM_FORMAT_INVALID;
+    }
+
+    SetupConfigFormat(inst, config);
+}
+
+/**
+ * Tries to create the config list using the cached attributes.
+ */
+static EplConfigList *LoadCachedConfigList(EplPlatformData *plat,
+        X11DisplayInstance *inst, X11ConfigCache *cache)
+{
+    EplConfigList *list = NULL;
+    EGLConfig *driverConfigs = NULL;
+    EplConfig *configs = NULL;
+    EGLint num = 0;
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    driverConfigs = eplConfigListGetDriverConfigs(plat, inst->internal_display->edpy, &num);
+    if (driverConfigs == NULL)
+    {
+        return NULL;
+    }
+
+    configs = malloc(num * sizeof(EplConfig));
+    if (configs != NULL && eplX11ConfigCacheGetConfigs(cache, driverConfigs, num, configs))
+    {
+        list = eplConfigListCreateFromArray(plat, configs, num);
+    }
+
+    free(configs);
+    free(driverConfigs);
+    return list;
+}
+
+EGLBoolean eplX11InitConfigList(EplPlatformData *plat, X11DisplayInstance *inst,
+        X11ConfigCache *cache)
 {
     int i;
+    X11_TRACE_SCOPE(0, 0, 0);
+
+    inst->configs = LoadCachedConfigList(plat, inst, cache);
+    if (inst->configs != NULL)
+    {
+        for (i=0; i<inst->configs->num_configs; i++)
+        {
+            SetupConfigFormat(inst, &inst->configs->configs[i]);
+        }
+        return EGL_TRUE;
+    }
 
     inst->configs = eplConfigListCreate(plat, inst->internal_display->edpy);
     if (inst->configs == NULL)
@@ -304,15 +395,19 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
 {
     xcb_generic_error_t *error = NULL;
     xcb_get_geometry_cookie_t geomCookie = xcb_get_geometry(pdpy->priv->inst->conn, xpix);
-    xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(pdpy->priv->inst->conn, geomCookie, &error);
+    xcb_get_geometry_reply_t *geom = NULL;
 
     xcb_dri3_buffers_from_pixmap_cookie_t buffersCookie;
     xcb_dri3_buffers_from_pixmap_reply_t *buffers = NULL;
     int32_t *fds = NULL;
+    int numPlanes = 0;
+    EGLBoolean directPlanes = EGL_FALSE;
 
     EGLint match = 0;
     EGLint i;
 
+    X11_TRACE_ROUND_TRIP("xcb_get_geometry");
+    geom = xcb_get_geometry_reply(pdpy->priv->inst->conn, geomCookie, &error);
     if (geom == NULL)
     {
         eplSetError(pdpy->platform, EGL_BAD_NATIVE_PIXMAP, "Invalid native pixmap 0x%x", xpix);
@@ -370,6 +465,7 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
     // DRI3BuffersFromPixmap request.
 
     buffersCookie = xcb_dri3_buffers_from_pixmap(pdpy->priv->inst->conn, xpix);
+    X11_TRACE_ROUND_TRIP("xcb_dri3_buffers_from_pixmap");
     buffers = xcb_dri3_buffers_from_pixmap_reply(pdpy->priv->inst->conn, buffersCookie, &error);
     if (buffers == NULL)
     {
@@ -386,13 +482,10 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
         close(fds[i]);
     }
 
-    if (xcb_dri3_buffers_from_pixmap_buffers_length(buffers) != 1)
-    {
-        // We don't support pixmaps with more than one dma-buf.
-        *count = 0;
-        free(buffers);
-        return EGL_TRUE;
-    }
+    // We can only render directly to a pixmap if the driver can import all
+    // of its planes. Otherwise, we have to go through the PRIME path.
+    numPlanes = xcb_dri3_buffers_from_pixmap_buffers_length(buffers);
+    directPlanes = (numPlanes >= 1 && numPlanes <= X11_MAX_IMPORT_PLANES);
 
     match = 0;
     for (i=0; i<*count; i++)
@@ -413,6 +506,11 @@ static EGLBoolean FilterNativePixmap(EplDisplay *pdpy, EplConfig **configs, EGLi
             EGLint j;
             EGLBoolean supported = EGL_FALSE;
 
+            if (!directPlanes)
+            {
+                continue;
+            }
+
             for (j=0; j<fmt->num_modifiers; j++)
             {
                 if (fmt->modifiers[j] == buffers->modifier)
@@ -444,6 +542,7 @@ EGLBoolean eplX11HookChooseConfig(EGLDisplay edpy, EGLint const *attribs,
     EGLBoolean success = EGL_FALSE;
     EplConfig **found = NULL;
     EGLint count = 0;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     pdpy = eplDisplayAcquire(edpy);
     if (pdpy == NULL)
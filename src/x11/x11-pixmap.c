@@ -25,6 +25,7 @@
  */
 
 #include "x11-platform.h"
+#include "x11-trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -42,6 +44,24 @@
 #include <xcb/xproto.h>
 #include <drm_fourcc.h>
 
+/**
+ * The maximum number of GCs to keep in an X11GCCache.
+ *
+ * In practice, we'll only see one or two depths.
+ */
+#define GC_CACHE_SIZE 4
+
+struct _X11GCCache
+{
+    pthread_mutex_t mutex;
+    struct
+    {
+        uint8_t depth;
+        xcb_gcontext_t gc;
+    } entries[GC_CACHE_SIZE];
+    int count;
+};
+
 /**
  * Data for an X11 pixmap.
  *
@@ -56,18 +76,132 @@ typedef struct
     xcb_pixmap_t xpix;
     uint32_t width;
     uint32_t height;
+    uint8_t depth;
     EGLPlatformColorBufferNVX buffer;
     EGLPlatformColorBufferNVX blit_target;
     int prime_dmabuf;
     xcb_pixmap_t prime_pixmap;
+
+    /**
+     * The PixmapFromBuffers request for \c prime_pixmap, if we haven't
+     * checked for the reply yet.
+     */
+    EGLBoolean prime_pixmap_pending;
+    xcb_void_cookie_t prime_pixmap_cookie;
 } X11Pixmap;
 
+X11GCCache *eplX11GCCacheCreate(void)
+{
+    X11GCCache *cache = calloc(1, sizeof(X11GCCache));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    return cache;
+}
+
+void eplX11GCCacheDestroy(X11DisplayInstance *inst, X11GCCache *cache)
+{
+    int i;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    if (inst->conn != NULL)
+    {
+        for (i=0; i<cache->count; i++)
+        {
+            xcb_free_gc(inst->conn, cache->entries[i].gc);
+        }
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+/**
+ * Creates a GC for copying to a drawable.
+ *
+ * The GC has graphics exposures disabled, so that the CopyArea requests that
+ * we send don't generate NoExpose events for the application.
+ */
+static xcb_gcontext_t CreateCopyGC(X11DisplayInstance *inst, xcb_drawable_t drawable)
+{
+    uint32_t value = 0;
+    xcb_gcontext_t gc = xcb_generate_id(inst->conn);
+    xcb_create_gc(inst->conn, gc, drawable, XCB_GC_GRAPHICS_EXPOSURES, &value);
+    return gc;
+}
+
+/**
+ * Returns a GC that can be used with a drawable.
+ *
+ * A GC can be used with any drawable with the same root and depth, so we keep
+ * one GC for each depth in X11DisplayInstance::gc_cache.
+ *
+ * \param inst The X11DisplayInstance.
+ * \param drawable The drawable that the GC will be used with.
+ * \param depth The depth of \p drawable.
+ * \param[out] ret_temporary Returns EGL_TRUE if the GC isn't in the cache, in
+ *      which case the caller must free it.
+ * \return The GC.
+ */
+static xcb_gcontext_t GetCopyGC(X11DisplayInstance *inst, xcb_drawable_t drawable,
+        uint8_t depth, EGLBoolean *ret_temporary)
+{
+    X11GCCache *cache = inst->gc_cache;
+    xcb_gcontext_t gc = 0;
+    int i;
+
+    *ret_temporary = EGL_FALSE;
+
+    if (cache == NULL)
+    {
+        *ret_temporary = EGL_TRUE;
+        return CreateCopyGC(inst, drawable);
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    for (i=0; i<cache->count; i++)
+    {
+        if (cache->entries[i].depth == depth)
+        {
+            gc = cache->entries[i].gc;
+            break;
+        }
+    }
+
+    if (gc == 0)
+    {
+        gc = CreateCopyGC(inst, drawable);
+        if (cache->count < GC_CACHE_SIZE)
+        {
+            cache->entries[cache->count].depth = depth;
+            cache->entries[cache->count].gc = gc;
+            cache->count++;
+        }
+        else
+        {
+            *ret_temporary = EGL_TRUE;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return gc;
+}
+
 static EGLBoolean CheckDirectSupported(X11DisplayInstance *inst, const X11DriverFormat *fmt,
         const xcb_dri3_buffers_from_pixmap_reply_t *reply)
 {
+    int numPlanes = xcb_dri3_buffers_from_pixmap_buffers_length(reply);
     int i;
 
-    if (xcb_dri3_buffers_from_pixmap_buffers_length(reply) != 1)
+    // The driver can only import a pixmap directly if it can describe all of
+    // the pixmap's planes. Anything else has to go through the PRIME path.
+    if (numPlanes < 1 || numPlanes > X11_MAX_IMPORT_PLANES)
     {
         return EGL_FALSE;
     }
@@ -135,8 +269,6 @@ static EGLBoolean AllocLinearPixmap(X11DisplayInstance *inst, EplSurface *surf,
     int stride = 0;
     int offset = 0;
     int fd = -1;
-    xcb_void_cookie_t cookie;
-    xcb_generic_error_t *error = NULL;
     EGLBoolean success = EGL_FALSE;
 
     assert(ppix->prime_dmabuf < 0);
@@ -173,26 +305,19 @@ static EGLBoolean AllocLinearPixmap(X11DisplayInstance *inst, EplSurface *surf,
         goto done;
     }
 
+    // Don't wait for the reply here. eplX11CreatePixmapSurface will check
+    // for it after it creates the EGLSurface, so that the round trip
+    // overlaps with the driver's work.
     ppix->prime_pixmap = xcb_generate_id(inst->conn);
-    cookie = xcb_dri3_pixmap_from_buffers_checked(inst->conn,
+    ppix->prime_pixmap_pending = EGL_TRUE;
+    ppix->prime_pixmap_cookie = xcb_dri3_pixmap_from_buffers_checked(inst->conn,
             ppix->prime_pixmap, inst->xscreen->root, 1, width, height, stride, offset,
             0, 0, 0, 0, 0, 0, eplFormatInfoDepth(fmt->fmt), fmt->fmt->bpp,
             DRM_FORMAT_MOD_LINEAR, &fd);
 
-    error = xcb_request_check(inst->conn, cookie);
-    if (error != NULL)
-    {
-        eplSetError(inst->platform, EGL_BAD_ALLOC, "DRI3PixmapFromBuffers request failed with error %d\n",
-                (int) error->error_code);
-        ppix->prime_pixmap = 0;
-        goto done;
-    }
-
     success = EGL_TRUE;
 
 done:
-    free(error);
-
     return success;
 }
 
@@ -222,6 +347,7 @@ static EGLBoolean ImportPixmap(X11DisplayInstance *inst, EplSurface *surf,
     }
 
     cookie = xcb_dri3_buffers_from_pixmap(inst->conn, xpix);
+    X11_TRACE_ROUND_TRIP("xcb_dri3_buffers_from_pixmap");
     reply = xcb_dri3_buffers_from_pixmap_reply(inst->conn, cookie, &error);
     if (reply == NULL)
     {
@@ -244,6 +370,7 @@ static EGLBoolean ImportPixmap(X11DisplayInstance *inst, EplSurface *surf,
                 xpix, reply->bpp, fmt->bpp);
         goto done;
     }
+    ppix->depth = reply->depth;
 
     if (inst->force_prime || !CheckDirectSupported(inst, driverFmt, reply))
     {
@@ -321,6 +448,36 @@ done:
     return success;
 }
 
+/**
+ * Copies the linear intermediate pixmap to the application's pixmap.
+ */
+static void CopyPrimePixmap(X11Pixmap *ppix)
+{
+    EGLBoolean temporary;
+    xcb_gcontext_t gc = GetCopyGC(ppix->inst, ppix->xpix, ppix->depth, &temporary);
+
+    xcb_copy_area(ppix->inst->conn, ppix->prime_pixmap, ppix->xpix, gc,
+            0, 0, 0, 0, ppix->width, ppix->height);
+    if (temporary)
+    {
+        xcb_free_gc(ppix->inst->conn, gc);
+    }
+}
+
+/**
+ * The X11PresenterJobFunc for a deferred copy.
+ *
+ * Nothing else is going to flush the connection for us on the presentation
+ * thread, so flush it here.
+ */
+static void DeferredCopyPrimePixmap(void *param)
+{
+    X11Pixmap *ppix = param;
+
+    CopyPrimePixmap(ppix);
+    xcb_flush(ppix->inst->conn);
+}
+
 static void PixmapDamageCallback(void *param, int syncfd, unsigned int flags)
 {
     EplSurface *surf = param;
@@ -343,28 +500,42 @@ static void PixmapDamageCallback(void *param, int syncfd, unsigned int flags)
          * rendering, because we're not using PresentPixmap.
          *
          * If the server (and the kernel) both support it, then try to use
-         * implicit sync. Otherwise, do a CPU wait so that we can at least get
-         * a consistent functional result in all cases.
+         * implicit sync.
+         *
+         * Otherwise, if we have to send a CopyArea request anyway, then let
+         * the presentation thread wait for the fence and send the request,
+         * so that we don't stall the driver here.
+         *
+         * Failing both, do a CPU wait so that we can at least get a
+         * consistent functional result in all cases.
          */
         if (ppix->prime_dmabuf < 0 || !eplX11ImportDmaBufSyncFile(ppix->inst, ppix->prime_dmabuf, syncfd))
         {
+            if (ppix->prime_pixmap != 0 && ppix->inst->presenter != NULL
+                    && eplX11PresenterQueueJob(ppix->inst->presenter, syncfd,
+                        DeferredCopyPrimePixmap, ppix))
+            {
+                return;
+            }
             eplX11WaitForFD(syncfd);
         }
     }
 
     if (ppix->prime_pixmap != 0)
     {
-        // TODO: Should we hold on to the GC that we create here? We should be
-        // able to reuse it for any drawable that has the same depth.
+        CopyPrimePixmap(ppix);
+    }
+}
 
-        xcb_create_gc_value_list_t gcvalues;
-        xcb_gcontext_t gc = xcb_generate_id(ppix->inst->conn);
-        xcb_create_gc_aux(ppix->inst->conn, gc, ppix->xpix, 0, &gcvalues);
+EGLBoolean eplX11WaitGLPixmap(EplDisplay *pdpy, EplSurface *surf)
+{
+    X11Pixmap *ppix = (X11Pixmap *) surf->priv;
 
-        xcb_copy_area(ppix->inst->conn, ppix->prime_pixmap, ppix->xpix, gc,
-                0, 0, 0, 0, ppix->width, ppix->height);
-        xcb_free_gc(ppix->inst->conn, gc);
+    if (ppix->inst->presenter != NULL)
+    {
+        eplX11PresenterWaitJobs(ppix->inst->presenter, ppix);
     }
+    return EGL_TRUE;
 }
 
 void eplX11DestroyPixmap(EplSurface *surf)
@@ -379,6 +550,12 @@ void eplX11DestroyPixmap(EplSurface *surf)
             {
                 ppix->inst->platform->egl.DestroySurface(ppix->inst->internal_display->edpy, surf->internal_surface);
             }
+            if (ppix->inst->presenter != NULL)
+            {
+                // Let any deferred copies finish, so that the pixmap still
+                // ends up with the last frame.
+                eplX11PresenterWaitJobs(ppix->inst->presenter, ppix);
+            }
             if (ppix->buffer != NULL)
             {
                 ppix->inst->platform->priv->egl.PlatformFreeColorBufferNVX(ppix->inst->internal_display->edpy, ppix->buffer);
@@ -389,7 +566,18 @@ void eplX11DestroyPixmap(EplSurface *surf)
             }
             if (ppix->prime_pixmap != 0 && ppix->inst->conn != NULL)
             {
-                xcb_free_pixmap(ppix->inst->conn, ppix->prime_pixmap);
+                if (ppix->prime_pixmap_pending)
+                {
+                    // We never found out whether the pixmap was valid, so
+                    // don't let an error go to the application.
+                    xcb_discard_reply(ppix->inst->conn, ppix->prime_pixmap_cookie.sequence);
+                    xcb_discard_reply(ppix->inst->conn,
+                            xcb_free_pixmap_checked(ppix->inst->conn, ppix->prime_pixmap).sequence);
+                }
+                else
+                {
+                    xcb_free_pixmap(ppix->inst->conn, ppix->prime_pixmap);
+                }
             }
             eplX11DisplayInstanceUnref(ppix->inst);
         }
@@ -443,6 +631,7 @@ EGLSurface eplX11CreatePixmapSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         EGL_NONE
     };
     EGLAttrib *internalAttribs = NULL;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     if (xpix == 0)
     {
@@ -468,13 +657,14 @@ EGLSurface eplX11CreatePixmapSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     fmt = eplFormatInfoLookup(configInfo->fourcc);
     assert(fmt != NULL);
 
-    internalAttribs = eplX11GetInternalSurfaceAttribs(plat, pdpy, internalAttribs);
+    internalAttribs = eplX11GetInternalSurfaceAttribs(plat, pdpy, attribs);
     if (internalAttribs == NULL)
     {
         goto done;
     }
 
     geomCookie = xcb_get_geometry(inst->conn, xpix);
+    X11_TRACE_ROUND_TRIP("xcb_get_geometry");
     geomReply = xcb_get_geometry_reply(inst->conn, geomCookie, &error);
     if (geomReply == NULL)
     {
@@ -528,6 +718,22 @@ EGLSurface eplX11CreatePixmapSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         goto done;
     }
 
+    if (ppix->prime_pixmap_pending)
+    {
+        X11_TRACE_ROUND_TRIP("xcb_dri3_pixmap_from_buffers");
+        error = xcb_request_check(inst->conn, ppix->prime_pixmap_cookie);
+        ppix->prime_pixmap_pending = EGL_FALSE;
+        if (error != NULL)
+        {
+            eplSetError(plat, EGL_BAD_ALLOC, "DRI3PixmapFromBuffers request failed with error %d\n",
+                    (int) error->error_code);
+            ppix->prime_pixmap = 0;
+            inst->platform->egl.DestroySurface(inst->internal_display->edpy, esurf);
+            esurf = EGL_NO_SURFACE;
+            goto done;
+        }
+    }
+
 done:
     if (esurf == EGL_NO_SURFACE)
     {
@@ -37,6 +37,13 @@ X11XlibDisplayClosedData *eplX11AddXlibDisplayClosedCallback(void *xlib_native_d
     return NULL;
 }
 
+X11XlibDisplayClosedData *eplX11XlibDisplayClosedDataRef(X11XlibDisplayClosedData *data)
+{
+    // As with eplX11XlibDisplayClosedDataUnref, this only ever gets NULL.
+    assert(data == NULL);
+    return data;
+}
+
 void eplX11XlibDisplayClosedDataUnref(X11XlibDisplayClosedData *data)
 {
     // This should never be called with a non-NULL value, because we never
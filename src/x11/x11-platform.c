@@ -23,6 +23,7 @@
 
 #include "x11-platform.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
@@ -44,14 +45,21 @@
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/xfixes.h>
 
 #include "platform-utils.h"
 #include "dma-buf.h"
+#include "x11-timeline.h"
+#include "x11-config-cache.h"
+#include "x11-trace.h"
 
 static const char *FORCE_ENABLE_ENV = "__NV_FORCE_ENABLE_X11_EGL_PLATFORM";
+static const char *ASYNC_PRESENT_ENV = "__NV_X11_EGL_ASYNC_PRESENT";
+static const char *SYNC_MODE_ENV = "__NV_X11_EGL_SYNC_MODE";
 
 #define CLIENT_EXTENSIONS_XLIB "EGL_KHR_platform_x11 EGL_EXT_platform_x11"
 #define CLIENT_EXTENSIONS_XCB "EGL_EXT_platform_xcb"
+#define DISPLAY_EXTENSIONS "EGL_ANDROID_presentation_time EGL_EXT_buffer_age EGL_KHR_partial_update"
 
 static const EGLint NEED_PLATFORM_SURFACE_MAJOR = 0;
 static const EGLint NEED_PLATFORM_SURFACE_MINOR = 1;
@@ -61,10 +69,10 @@ static const uint32_t REQUEST_DRI3_MINOR = 4;
 static const uint32_t NEED_PRESENT_MAJOR = 1;
 static const uint32_t NEED_PRESENT_MINOR = 2;
 static const uint32_t REQUEST_PRESENT_MINOR = 4;
+static const uint32_t NEED_XFIXES_MAJOR = 2;
 
 static X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean from_init);
 static void eplX11DisplayInstanceFree(X11DisplayInstance *inst);
-EPL_REFCOUNT_DEFINE_TYPE_FUNCS(X11DisplayInstance, eplX11DisplayInstance, refcount, eplX11DisplayInstanceFree);
 
 static void eplX11CleanupPlatform(EplPlatformData *plat);
 static void eplX11CleanupDisplay(EplDisplay *pdpy);
@@ -80,11 +88,14 @@ static void eplX11TerminateDisplay(EplPlatformData *plat, EplDisplay *pdpy);
 static void eplX11DestroySurface(EplDisplay *pdpy, EplSurface *surf);
 static void eplX11FreeSurface(EplDisplay *pdpy, EplSurface *surf);
 static EGLBoolean eplX11WaitGL(EplDisplay *pdpy, EplSurface *psurf);
+static EGLBoolean eplX11QuerySurface(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value);
 
 static const EplHookFunc X11_HOOK_FUNCTIONS[] =
 {
     { "eglChooseConfig", eplX11HookChooseConfig },
     { "eglGetConfigAttrib", eplX11HookGetConfigAttrib },
+    { "eglPresentationTimeANDROID", eplX11PresentationTime },
+    { "eglSetDamageRegionKHR", eplX11SetDamageRegion },
     { "eglSwapInterval", eplX11SwapInterval },
 };
 static const int NUM_X11_HOOK_FUNCTIONS = sizeof(X11_HOOK_FUNCTIONS) / sizeof(X11_HOOK_FUNCTIONS[0]);
@@ -105,6 +116,7 @@ static const EplImplFuncs X11_IMPL_FUNCS =
     .FreeSurface = eplX11FreeSurface,
     .SwapBuffers = eplX11SwapBuffers,
     .WaitGL = eplX11WaitGL,
+    .QuerySurface = eplX11QuerySurface,
 };
 
 /**
@@ -117,6 +129,119 @@ static const EplImplFuncs X11_IMPL_FUNCS =
 static EGLBoolean import_sync_file_supported = EGL_TRUE;
 static pthread_mutex_t import_sync_file_supported_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * The list of initialized X11DisplayInstance structs that another EGLDisplay
+ * can share.
+ *
+ * The list doesn't hold a reference to the instances. Instead,
+ * eplX11DisplayInstanceUnref removes an instance from the list while holding
+ * \c shared_instances_mutex, so a lookup will never find an instance whose
+ * refcount has already dropped to zero.
+ */
+static struct glvnd_list shared_instances = { &shared_instances, &shared_instances };
+static pthread_mutex_t shared_instances_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+X11DisplayInstance *eplX11DisplayInstanceRef(X11DisplayInstance *inst)
+{
+    if (inst != NULL)
+    {
+        eplRefCountRef(&inst->refcount);
+    }
+    return inst;
+}
+
+void eplX11DisplayInstanceUnref(X11DisplayInstance *inst)
+{
+    if (inst == NULL)
+    {
+        return;
+    }
+
+    if (inst->shared)
+    {
+        pthread_mutex_lock(&shared_instances_mutex);
+        if (eplRefCountUnref(&inst->refcount))
+        {
+            glvnd_list_del(&inst->entry);
+            pthread_mutex_unlock(&shared_instances_mutex);
+            eplX11DisplayInstanceFree(inst);
+        }
+        else
+        {
+            pthread_mutex_unlock(&shared_instances_mutex);
+        }
+    }
+    else if (eplRefCountUnref(&inst->refcount))
+    {
+        eplX11DisplayInstanceFree(inst);
+    }
+}
+
+/**
+ * Looks for an existing X11DisplayInstance that an EGLDisplay can share.
+ *
+ * \param pdpy The display that's being initialized.
+ * \param conn The display connection.
+ * \param screen The screen number.
+ * \return A new reference to an X11DisplayInstance, or NULL if there isn't
+ *      one that matches.
+ */
+static X11DisplayInstance *FindSharedDisplayInstance(EplDisplay *pdpy,
+        xcb_connection_t *conn, int screen)
+{
+    X11DisplayInstance *inst;
+    X11DisplayInstance *ret = NULL;
+
+    pthread_mutex_lock(&shared_instances_mutex);
+    glvnd_list_for_each_entry(inst, &shared_instances, entry)
+    {
+        if (inst->platform != pdpy->platform || inst->conn != conn || inst->screen != screen)
+        {
+            continue;
+        }
+
+        // The device and the force_prime flag only depend on the connection
+        // and on which device the display asked for, so if those match, then
+        // we'd end up with the same instance anyway.
+        if (pdpy->priv->requested_device != inst->device
+                && (pdpy->priv->requested_device != inst->requested_device
+                    || pdpy->priv->enable_alt_device != inst->enable_alt_device))
+        {
+            continue;
+        }
+
+        // If the application closed the connection that this instance was
+        // using, then this is a different connection that happens to have
+        // the same address.
+        if (eplX11IsNativeClosed(inst->closed_callback))
+        {
+            continue;
+        }
+
+        ret = eplX11DisplayInstanceRef(inst);
+        break;
+    }
+    pthread_mutex_unlock(&shared_instances_mutex);
+
+    return ret;
+}
+
+/**
+ * Adds a newly initialized X11DisplayInstance to the list of shared
+ * instances.
+ */
+static void AddSharedDisplayInstance(EplDisplay *pdpy, X11DisplayInstance *inst)
+{
+    inst->requested_device = pdpy->priv->requested_device;
+    inst->enable_alt_device = pdpy->priv->enable_alt_device;
+    inst->closed_callback = eplX11XlibDisplayClosedDataRef(pdpy->priv->closed_callback);
+    inst->shared = EGL_TRUE;
+
+    pthread_mutex_lock(&shared_instances_mutex);
+    glvnd_list_add(&inst->entry, &shared_instances);
+    pthread_mutex_unlock(&shared_instances_mutex);
+}
+
 static EGLBoolean LoadProcHelper(EplPlatformData *plat, void *handle, void **ptr, const char *name)
 {
     *ptr = dlsym(handle, name);
@@ -223,9 +348,24 @@ EGLBoolean eplX11LoadEGLExternalPlatformCommon(int major, int minor,
     LOAD_PROC(timelineSupported, "drm", drm, SyncobjTransfer);
 
     plat->priv->timeline_funcs_supported = timelineSupported;
+    if (timelineSupported)
+    {
+        // These are optional. Without drmSyncobjEventfd, we'll just wait
+        // for buffer releases with drmSyncobjTimelineWait instead. Without
+        // xcb_present_pixmap_synced_checked, we'll check for errors from
+        // PixmapFromBuffers before the first PresentPixmapSynced request.
+        LoadProcHelper(plat, RTLD_DEFAULT, (void **) &plat->priv->drm.SyncobjEventfd, "drmSyncobjEventfd");
+        LoadProcHelper(plat, RTLD_DEFAULT, (void **) &plat->priv->xcb.present_pixmap_synced_checked,
+                "xcb_present_pixmap_synced_checked");
+    }
 
 #undef LOAD_PROC
 
+#ifdef ENABLE_TRACING
+    eplX11TraceSetPlatform(plat);
+    eplX11TraceWrapDrmFunctions(plat->priv);
+#endif
+
     eplPlatformBaseInitFinish(plat);
     return EGL_TRUE;
 }
@@ -256,7 +396,7 @@ static const char *eplX11QueryString(EplPlatformData *plat, EplDisplay *pdpy, EG
                 return "";
             }
         case EGL_EXT_PLATFORM_DISPLAY_EXTENSIONS:
-            return "";
+            return DISPLAY_EXTENSIONS;
         default:
             return NULL;
     }
@@ -515,30 +655,6 @@ static xcb_screen_t *GetXCBScreen(xcb_connection_t *conn, int screen)
     return iter.data;
 }
 
-/**
- * Sends a DRI3Open request, and returns the file descriptor that the server
- * sends back.
- */
-static int GetDRI3DeviceFD(xcb_connection_t *conn, xcb_screen_t *xscr)
-{
-    xcb_generic_error_t *error = NULL;
-    xcb_dri3_open_cookie_t cookie = xcb_dri3_open(conn, xscr->root, 0);
-    xcb_dri3_open_reply_t *reply = xcb_dri3_open_reply(conn, cookie, &error);
-    int fd;
-
-    if (reply == NULL)
-    {
-        free(error);
-        return -1;
-    }
-    assert(reply->nfd == 1);
-
-    fd = xcb_dri3_open_reply_fds(conn, reply)[0];
-    free(reply);
-
-    return fd;
-}
-
 static EGLBoolean eplX11GetPlatformDisplay(EplPlatformData *plat, EplDisplay *pdpy,
         void *native_display, const EGLAttrib *attribs,
         struct glvnd_list *existing_displays)
@@ -681,22 +797,53 @@ static void eplX11CleanupDisplay(EplDisplay *pdpy)
  *
  * This checks that we're using a domain socket, and checks the versions of the
  * DRI3 and Present extensions.
+ *
+ * This also sends the DRI3Open and DRI3GetSupportedModifiers requests that
+ * eplX11DisplayInstanceCreate needs. Every request is sent before we wait for
+ * any replies, so that we only have to wait for a couple of round trips
+ * instead of one for each request.
+ *
+ * \param inst The display instance.
+ * \param[out] ret_fd Returns the file descriptor from the DRI3Open request,
+ *      or -1 if the request failed.
+ * \param[out] ret_modifiers Returns the reply to the DRI3GetSupportedModifiers
+ *      request, or NULL if the request failed. The caller must free this.
+ * \return EGL_TRUE if the server has the extensions that we need. Note that
+ *      this can return EGL_TRUE even if the DRI3Open or
+ *      DRI3GetSupportedModifiers requests fail.
  */
-static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
+static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst, int *ret_fd,
+        xcb_dri3_get_supported_modifiers_reply_t **ret_modifiers)
 {
+    const char NVGLX_EXTENSION_NAME[] = "NV-GLX";
     const char *env;
     struct sockaddr addr;
     socklen_t addrlen = sizeof(addr);
     const xcb_query_extension_reply_t *extReply;
+    const EplFormatInfo *fmt;
     xcb_generic_error_t *error = NULL;
+    EGLBoolean checkNvglx = EGL_FALSE;
+    EGLBoolean nvglxPending = EGL_FALSE;
+    EGLBoolean hasXfixes = EGL_FALSE;
 
+    xcb_query_extension_cookie_t nvglxCookie;
+    xcb_query_extension_reply_t *nvglxReply = NULL;
     xcb_dri3_query_version_cookie_t dri3Cookie;
     xcb_dri3_query_version_reply_t *dri3Reply = NULL;
     xcb_present_query_version_cookie_t presentCookie;
     xcb_present_query_version_reply_t *presentReply = NULL;
-    xcb_query_extension_reply_t *nvglxReply = NULL;
+    xcb_xfixes_query_version_cookie_t xfixesCookie;
+    xcb_xfixes_query_version_reply_t *xfixesReply = NULL;
+    xcb_dri3_open_cookie_t openCookie;
+    xcb_dri3_open_reply_t *openReply = NULL;
+    xcb_dri3_get_supported_modifiers_cookie_t modCookie;
+    xcb_dri3_get_supported_modifiers_reply_t *modReply = NULL;
+    int fd = -1;
     EGLBoolean success = EGL_FALSE;
 
+    *ret_fd = -1;
+    *ret_modifiers = NULL;
+
     // Check to make sure that we're using a domain socket, since we need to be
     // able to push file descriptors through it.
     if (getsockname(xcb_get_file_descriptor(inst->conn), &addr, &addrlen) != 0)
@@ -708,16 +855,11 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
         return EGL_FALSE;
     }
 
-    extReply = xcb_get_extension_data(inst->conn, &xcb_dri3_id);
-    if (extReply == NULL || !extReply->present)
-    {
-        return EGL_FALSE;
-    }
-    extReply = xcb_get_extension_data(inst->conn, &xcb_present_id);
-    if (extReply == NULL || !extReply->present)
-    {
-        return EGL_FALSE;
-    }
+    // Send the QueryExtension requests for every extension that we need, so
+    // that xcb_get_extension_data only has to wait for one round trip.
+    xcb_prefetch_extension_data(inst->conn, &xcb_dri3_id);
+    xcb_prefetch_extension_data(inst->conn, &xcb_present_id);
+    xcb_prefetch_extension_data(inst->conn, &xcb_xfixes_id);
 
     env = getenv(FORCE_ENABLE_ENV);
     if (env == NULL || atoi(env) == 0)
@@ -732,10 +874,100 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
          * we could add some requests to NV-GLX to support older (pre DRI3 1.2)
          * servers or non-Linux systems.
          */
-        const char NVGLX_EXTENSION_NAME[] = "NV-GLX";
-        xcb_query_extension_cookie_t extCookie = xcb_query_extension(inst->conn,
+        nvglxCookie = xcb_query_extension(inst->conn,
                 sizeof(NVGLX_EXTENSION_NAME) - 1, NVGLX_EXTENSION_NAME);
-        nvglxReply = xcb_query_extension_reply(inst->conn, extCookie, &error);
+        checkNvglx = EGL_TRUE;
+        nvglxPending = EGL_TRUE;
+    }
+
+    // The prefetched QueryExtension replies all come back in one round trip.
+    X11_TRACE_ROUND_TRIP("xcb_query_extension");
+    extReply = xcb_get_extension_data(inst->conn, &xcb_dri3_id);
+    if (extReply == NULL || !extReply->present)
+    {
+        goto done;
+    }
+    extReply = xcb_get_extension_data(inst->conn, &xcb_present_id);
+    if (extReply == NULL || !extReply->present)
+    {
+        goto done;
+    }
+
+    /*
+     * XFixes is only needed so that we can send an update region with
+     * eglSwapBuffersWithDamage, so it's not an error if it's missing. We do
+     * have to send an XFixesQueryVersion request before we can use any other
+     * XFixes requests, though.
+     */
+    extReply = xcb_get_extension_data(inst->conn, &xcb_xfixes_id);
+    hasXfixes = (extReply != NULL && extReply->present);
+
+    // Now that we know which extensions are available, send the rest of the
+    // requests before we check any of the replies.
+    dri3Cookie = xcb_dri3_query_version(inst->conn, NEED_DRI3_MAJOR, REQUEST_DRI3_MINOR);
+    presentCookie = xcb_present_query_version(inst->conn, NEED_PRESENT_MAJOR, REQUEST_PRESENT_MINOR);
+    if (hasXfixes)
+    {
+        xfixesCookie = xcb_xfixes_query_version(inst->conn, NEED_XFIXES_MAJOR, 0);
+    }
+
+    /*
+     * These requests need DRI3 1.2, but the server handles requests in order,
+     * so they'll still come after the DRI3QueryVersion request. If the server
+     * doesn't support DRI3 1.2, then we'll fail based on the DRI3QueryVersion
+     * reply anyway.
+     *
+     * Use XRGB8 to check for server support. With our driver, every format
+     * should have the same set of modifiers, so we just need to pick something
+     * that we'll always support.
+     */
+    fmt = eplFormatInfoLookup(DRM_FORMAT_XRGB8888);
+    assert(fmt != NULL);
+    openCookie = xcb_dri3_open(inst->conn, inst->xscreen->root, 0);
+    modCookie = xcb_dri3_get_supported_modifiers(inst->conn, inst->xscreen->root,
+            eplFormatInfoDepth(fmt), fmt->bpp);
+
+    // Collect all of the replies, even if one of them fails, so that we don't
+    // leave any replies or errors in XCB's queue.
+    if (checkNvglx)
+    {
+        X11_TRACE_ROUND_TRIP("xcb_query_extension");
+        nvglxReply = xcb_query_extension_reply(inst->conn, nvglxCookie, &error);
+        nvglxPending = EGL_FALSE;
+        free(error);
+        error = NULL;
+    }
+    X11_TRACE_ROUND_TRIP("xcb_dri3_query_version");
+    dri3Reply = xcb_dri3_query_version_reply(inst->conn, dri3Cookie, &error);
+    free(error);
+    error = NULL;
+    X11_TRACE_ROUND_TRIP("xcb_present_query_version");
+    presentReply = xcb_present_query_version_reply(inst->conn, presentCookie, &error);
+    free(error);
+    error = NULL;
+    if (hasXfixes)
+    {
+        X11_TRACE_ROUND_TRIP("xcb_xfixes_query_version");
+        xfixesReply = xcb_xfixes_query_version_reply(inst->conn, xfixesCookie, &error);
+        free(error);
+        error = NULL;
+    }
+    X11_TRACE_ROUND_TRIP("xcb_dri3_open");
+    openReply = xcb_dri3_open_reply(inst->conn, openCookie, &error);
+    free(error);
+    error = NULL;
+    if (openReply != NULL)
+    {
+        assert(openReply->nfd == 1);
+        fd = xcb_dri3_open_reply_fds(inst->conn, openReply)[0];
+    }
+    X11_TRACE_ROUND_TRIP("xcb_dri3_get_supported_modifiers");
+    modReply = xcb_dri3_get_supported_modifiers_reply(inst->conn, modCookie, &error);
+    free(error);
+    error = NULL;
+
+    if (checkNvglx)
+    {
         if (nvglxReply == NULL)
         {
             // XQueryExtension isn't supposed to generate any errors.
@@ -748,9 +980,6 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
         }
     }
 
-    // TODO: Send these requests in parallel, not in sequence
-    dri3Cookie = xcb_dri3_query_version(inst->conn, NEED_DRI3_MAJOR, REQUEST_DRI3_MINOR);
-    dri3Reply = xcb_dri3_query_version_reply(inst->conn, dri3Cookie, &error);
     if (dri3Reply == NULL)
     {
         goto done;
@@ -760,8 +989,6 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
         goto done;
     }
 
-    presentCookie = xcb_present_query_version(inst->conn, NEED_PRESENT_MAJOR, REQUEST_PRESENT_MINOR);
-    presentReply = xcb_present_query_version_reply(inst->conn, presentCookie, &error);
     if (presentReply == NULL)
     {
         goto done;
@@ -785,43 +1012,60 @@ static EGLBoolean CheckServerExtensions(X11DisplayInstance *inst)
         inst->supports_explicit_sync = EGL_TRUE;
     }
 
+    if (xfixesReply != NULL && xfixesReply->major_version >= NEED_XFIXES_MAJOR)
+    {
+        inst->supports_update_regions = EGL_TRUE;
+    }
+
+    *ret_fd = fd;
+    fd = -1;
+    *ret_modifiers = modReply;
+    modReply = NULL;
     success = EGL_TRUE;
 
 done:
+    if (nvglxPending)
+    {
+        // If DRI3 or Present is missing, then we bail out before collecting
+        // the NV-GLX reply, so tell XCB to throw it away when it arrives.
+        xcb_discard_reply(inst->conn, nvglxCookie.sequence);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(modReply);
+    free(openReply);
+    free(xfixesReply);
     free(nvglxReply);
     free(presentReply);
     free(dri3Reply);
-    free(error);
 
     return success;
 }
 
+/**
+ * Checks the DRI3GetSupportedModifiers reply from CheckServerExtensions
+ * against the modifiers that the driver supports.
+ */
 static EGLBoolean CheckServerFormatSupport(X11DisplayInstance *inst,
+        const xcb_dri3_get_supported_modifiers_reply_t *reply,
         EGLBoolean *ret_supports_direct, EGLBoolean *ret_supports_linear)
 {
     const X11DriverFormat *fmt = NULL;
-    xcb_dri3_get_supported_modifiers_cookie_t cookie;
-    xcb_dri3_get_supported_modifiers_reply_t *reply = NULL;
-    xcb_generic_error_t *error = NULL;
     int numScreenMods;
     const uint64_t *screenMods = NULL;
     int i, j;
     EGLBoolean found = EGL_FALSE;
 
-    // Use XRGB8 to check for server support. With our driver, every format
-    // should have the same set of modifiers, so we just need to pick something
-    // that we'll always support.
-    fmt = eplX11FindDriverFormat(inst, DRM_FORMAT_XRGB8888);
-
-    cookie = xcb_dri3_get_supported_modifiers(inst->conn, inst->xscreen->root,
-            eplFormatInfoDepth(fmt->fmt), fmt->fmt->bpp);
-    reply = xcb_dri3_get_supported_modifiers_reply(inst->conn, cookie, &error);
     if (reply == NULL)
     {
-        free(error);
         return EGL_FALSE;
     }
 
+    // This has to match the format that CheckServerExtensions used.
+    fmt = eplX11FindDriverFormat(inst, DRM_FORMAT_XRGB8888);
+
     numScreenMods = xcb_dri3_get_supported_modifiers_screen_modifiers_length(reply);
     screenMods = xcb_dri3_get_supported_modifiers_screen_modifiers(reply);
 
@@ -847,19 +1091,67 @@ static EGLBoolean CheckServerFormatSupport(X11DisplayInstance *inst,
     }
     *ret_supports_direct = found;
 
-    free(reply);
     return EGL_TRUE;
 }
 
+/**
+ * Applies the __NV_X11_EGL_SYNC_MODE override, which restricts the
+ * synchronization path that a display instance uses.
+ *
+ * This is meant for benchmarking and debugging. It can only turn off features
+ * that the server and driver support, never turn on missing ones.
+ *
+ * "explicit" disables implicit sync, "implicit" disables explicit sync, "none"
+ * disables both, and "prime" forces the PRIME copy path.
+ */
+static void ApplySyncModeOverride(X11DisplayInstance *inst)
+{
+    const char *env = getenv(SYNC_MODE_ENV);
+
+    if (env == NULL)
+    {
+        return;
+    }
+
+    if (strcmp(env, "explicit") == 0)
+    {
+        inst->supports_implicit_sync = EGL_FALSE;
+    }
+    else if (strcmp(env, "implicit") == 0)
+    {
+        inst->supports_explicit_sync = EGL_FALSE;
+    }
+    else if (strcmp(env, "none") == 0)
+    {
+        inst->supports_explicit_sync = EGL_FALSE;
+        inst->supports_implicit_sync = EGL_FALSE;
+    }
+    else if (strcmp(env, "prime") == 0)
+    {
+        inst->force_prime = EGL_TRUE;
+    }
+    else
+    {
+        fprintf(stderr, "nvidia-egl-x11: Ignoring unknown %s value \"%s\". "
+                "Expected \"explicit\", \"implicit\", \"none\", or \"prime\".\n",
+                SYNC_MODE_ENV, env);
+    }
+}
+
 X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean from_init)
 {
     X11DisplayInstance *inst = NULL;
+    X11DisplayInstance *ret = NULL;
     int fd = -1;
     const char *gbmName = NULL;
+    const char *env;
     EGLDeviceEXT serverDevice = EGL_NO_DEVICE_EXT;
     EplInternalDisplay *internalDpy = NULL;
+    xcb_dri3_get_supported_modifiers_reply_t *serverMods = NULL;
+    X11ConfigCache *configCache = NULL;
     EGLBoolean supportsDirect = EGL_FALSE;
     EGLBoolean supportsLinear = EGL_FALSE;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     inst = calloc(1, sizeof(X11DisplayInstance));
     if (inst == NULL)
@@ -879,8 +1171,7 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         if (inst->conn == NULL)
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "Can't open display connection");
-            eplX11DisplayInstanceUnref(inst);
-            return NULL;
+            goto done;
         }
         if (inst->screen < 0)
         {
@@ -924,30 +1215,37 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         free(host);
     }
 
+    if (!inst->own_display)
+    {
+        // If another EGLDisplay already initialized the same connection,
+        // screen, and device, then just use its instance.
+        ret = FindSharedDisplayInstance(pdpy, inst->conn, inst->screen);
+        if (ret != NULL)
+        {
+            goto done;
+        }
+    }
+
     inst->xscreen = GetXCBScreen(inst->conn, inst->screen);
     if (inst->xscreen == NULL)
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Invalid screen number");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
-    if (!CheckServerExtensions(inst))
+    if (!CheckServerExtensions(inst, &fd, &serverMods))
     {
         if (from_init)
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "X server is missing required extensions");
         }
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
-    fd = GetDRI3DeviceFD(inst->conn, inst->xscreen);
     if (fd < 0)
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't open DRI3 device");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
     serverDevice = FindDeviceForFD(pdpy->platform, fd);
@@ -975,9 +1273,7 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
             {
                 eplSetError(pdpy->platform, EGL_BAD_MATCH, "NV -> NV offloading is not supported");
             }
-            close(fd);
-            eplX11DisplayInstanceUnref(inst);
-            return NULL;
+            goto done;
         }
 
         inst->supports_implicit_sync = EGL_FALSE;
@@ -1020,9 +1316,7 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "X server is not running on an NVIDIA device");
         }
-        close(fd);
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
     if (inst->device != serverDevice)
@@ -1032,21 +1326,20 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         const char *node;
 
         close(fd);
+        fd = -1;
 
         node = pdpy->platform->egl.QueryDeviceStringEXT(inst->device, EGL_DRM_DEVICE_FILE_EXT);
         if (node == NULL)
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "Can't find device node.");
-            eplX11DisplayInstanceUnref(inst);
-            return NULL;
+            goto done;
         }
 
         fd = open(node, O_RDWR);
         if (fd < 0)
         {
             eplSetError(pdpy->platform, EGL_BAD_ACCESS, "Can't open device node %s", node);
-            eplX11DisplayInstanceUnref(inst);
-            return NULL;
+            goto done;
         }
 
         inst->force_prime = EGL_TRUE;
@@ -1056,31 +1349,28 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
     if (inst->gbmdev == NULL)
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't open GBM device");
-        close(fd);
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
+    // The GBM device owns the file descriptor now.
+    fd = -1;
 
     gbmName = gbm_device_get_backend_name(inst->gbmdev);
     if (gbmName == NULL || (strcmp(gbmName, "nvidia") != 0 && strcmp(gbmName, "nvidia_rm") != 0))
     {
         // This should never happen.
         eplSetError(pdpy->platform, EGL_BAD_ACCESS, "Internal error: GBM device is not an NVIDIA device");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
     internalDpy = eplGetDeviceInternalDisplay(pdpy->platform, inst->device);
     if (internalDpy == NULL)
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't create internal EGLDisplay");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
     if (!eplInitializeInternalDisplay(pdpy->platform, internalDpy, NULL, NULL))
     {
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
     inst->internal_display = eplInternalDisplayRef(internalDpy);
 
@@ -1108,20 +1398,20 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
         }
     }
 
-    if (!eplX11InitDriverFormats(pdpy->platform, inst))
+    configCache = eplX11ConfigCacheOpen(pdpy->platform, inst);
+
+    if (!eplX11InitDriverFormats(pdpy->platform, inst, configCache))
     {
         // This should never happen. If it does, then we've got a problem in
         // the driver.
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "No supported image formats from driver");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
-    if (!CheckServerFormatSupport(inst, &supportsDirect, &supportsLinear))
+    if (!CheckServerFormatSupport(inst, serverMods, &supportsDirect, &supportsLinear))
     {
         eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Can't get a format modifier list from the X server");
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
     if (!supportsLinear)
     {
@@ -1152,42 +1442,106 @@ X11DisplayInstance *eplX11DisplayInstanceCreate(EplDisplay *pdpy, EGLBoolean fro
     {
         // Check if the DRM device supports timeline objects.
         uint64_t cap = 0;
-        if (pdpy->platform->priv->drm.GetCap(fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap) != 0
+        if (pdpy->platform->priv->drm.GetCap(gbm_device_get_fd(inst->gbmdev), DRM_CAP_SYNCOBJ_TIMELINE, &cap) != 0
                 || cap == 0)
         {
             inst->supports_explicit_sync = EGL_FALSE;
         }
     }
 
+    ApplySyncModeOverride(inst);
+
+    if (inst->supports_explicit_sync)
+    {
+        // If we can't allocate the pool, then we'll just create a new
+        // timeline for every buffer.
+        inst->timeline_pool = eplX11TimelinePoolCreate();
+    }
+
+    if (!inst->force_prime)
+    {
+        // If we can't allocate the cache, then we'll just query the
+        // modifiers for every window.
+        inst->modifier_cache = eplX11ModifierCacheCreate();
+    }
+
+    // If we can't allocate the cache, then we'll just create a new GC each
+    // time we copy to a PRIME pixmap.
+    inst->gc_cache = eplX11GCCacheCreate();
+
     if (inst->force_prime && !inst->supports_prime)
     {
         if (from_init)
         {
             eplSetError(pdpy->platform, EGL_BAD_ALLOC, "No supported image formats from server");
         }
-        eplX11DisplayInstanceUnref(inst);
-        return NULL;
+        goto done;
     }
 
     if (from_init)
     {
-        if (!eplX11InitConfigList(pdpy->platform, inst))
+        if (!eplX11InitConfigList(pdpy->platform, inst, configCache))
         {
-            eplX11DisplayInstanceUnref(inst);
-            return NULL;
+            goto done;
+        }
+        eplX11ConfigCacheSave(configCache, inst);
+
+        env = getenv(ASYNC_PRESENT_ENV);
+        if (env != NULL && atoi(env) != 0)
+        {
+            // If we can't start the thread, then just fall back to
+            // presenting from eglSwapBuffers.
+            inst->presenter = eplX11PresenterCreate();
+        }
+
+        if (!inst->own_display)
+        {
+            AddSharedDisplayInstance(pdpy, inst);
         }
     }
 
-    return inst;
+    ret = inst;
+    inst = NULL;
+
+done:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    free(serverMods);
+    eplX11ConfigCacheClose(configCache);
+    if (inst != NULL)
+    {
+        eplX11DisplayInstanceUnref(inst);
+    }
+    return ret;
 }
 
 static void eplX11DisplayInstanceFree(X11DisplayInstance *inst)
 {
+    if (inst->presenter != NULL)
+    {
+        eplX11PresenterDestroy(inst->presenter);
+        inst->presenter = NULL;
+    }
+
     eplConfigListFree(inst->configs);
     inst->configs = NULL;
 
     eplX11CleanupDriverFormats(inst);
 
+    eplX11ModifierCacheDestroy(inst->modifier_cache);
+    inst->modifier_cache = NULL;
+
+    eplX11GCCacheDestroy(inst, inst->gc_cache);
+    inst->gc_cache = NULL;
+
+    if (inst->timeline_pool != NULL)
+    {
+        eplX11TimelinePoolDestroy(inst, inst->timeline_pool);
+        inst->timeline_pool = NULL;
+    }
+
     if (inst->conn != NULL && inst->own_display)
     {
         xcb_disconnect(inst->conn);
@@ -1214,12 +1568,15 @@ static void eplX11DisplayInstanceFree(X11DisplayInstance *inst)
         eplPlatformDataUnref(inst->platform);
     }
     eplInternalDisplayUnref(inst->internal_display);
+    eplX11XlibDisplayClosedDataUnref(inst->closed_callback);
 
     free(inst);
 }
 
 static EGLBoolean eplX11InitializeDisplay(EplPlatformData *plat, EplDisplay *pdpy, EGLint *major, EGLint *minor)
 {
+    X11_TRACE_SCOPE(0, 0, 0);
+
     assert(pdpy->priv->inst == NULL);
 
     if (eplX11IsNativeClosed(pdpy->priv->closed_callback))
@@ -1247,6 +1604,8 @@ static void eplX11TerminateDisplay(EplPlatformData *plat, EplDisplay *pdpy)
 
 static void eplX11DestroySurface(EplDisplay *pdpy, EplSurface *surf)
 {
+    X11_TRACE_SCOPE(0, 0, 0);
+
     if (surf->type == EPL_SURFACE_TYPE_WINDOW)
     {
         eplX11DestroyWindow(surf);
@@ -1278,24 +1637,79 @@ static EGLBoolean eplX11WaitGL(EplDisplay *pdpy, EplSurface *psurf)
     {
         ret = eplX11WaitGLWindow(pdpy, psurf);
     }
+    else if (psurf != NULL && psurf->type == EPL_SURFACE_TYPE_PIXMAP)
+    {
+        ret = eplX11WaitGLPixmap(pdpy, psurf);
+    }
 
     return ret;
 }
 
+static EGLBoolean eplX11QuerySurface(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value)
+{
+    if (psurf->type == EPL_SURFACE_TYPE_WINDOW && attribute == EGL_BUFFER_AGE_EXT)
+    {
+        // The driver doesn't know which color buffers we've presented, so we
+        // have to keep track of the buffer age ourselves.
+        if (value == NULL)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid value pointer");
+            return EGL_FALSE;
+        }
+        return eplX11QueryBufferAge(pdpy, psurf, value);
+    }
+    if (psurf->type == EPL_SURFACE_TYPE_WINDOW && attribute == EGL_RENDER_BUFFER)
+    {
+        if (value == NULL)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid value pointer");
+            return EGL_FALSE;
+        }
+        return eplX11QueryRenderBuffer(pdpy, psurf, value);
+    }
+    if (psurf->type == EPL_SURFACE_TYPE_WINDOW
+            && attribute >= EGL_X11_STATS_FRAMES_NVX
+            && attribute <= EGL_X11_STATS_BUFFERS_TRIMMED_NVX)
+    {
+        if (value == NULL)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid value pointer");
+            return EGL_FALSE;
+        }
+        return eplX11QueryFrameStats(pdpy, psurf, attribute, value);
+    }
+    if (psurf->type == EPL_SURFACE_TYPE_WINDOW
+            && attribute >= EGL_X11_PRESENT_SERIAL_NVX
+            && attribute <= EGL_X11_FEEDBACK_MODE_NVX)
+    {
+        if (value == NULL)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid value pointer");
+            return EGL_FALSE;
+        }
+        return eplX11QueryPresentFeedback(pdpy, psurf, attribute, value);
+    }
+
+    return pdpy->platform->egl.QuerySurface(pdpy->internal_display,
+            psurf->internal_surface, attribute, value);
+}
+
 EGLAttrib *eplX11GetInternalSurfaceAttribs(EplPlatformData *plat, EplDisplay *pdpy, const EGLAttrib *attribs)
 {
     EGLAttrib *internalAttribs = NULL;
     int count = 0;
+    int i;
 
     if (attribs != NULL)
     {
-        for (count = 0; attribs[count] != EGL_NONE; count += 2)
+        for (i = 0; attribs[i] != EGL_NONE; i += 2)
         {
-            if (attribs[count] == EGL_SURFACE_Y_INVERTED_NVX)
+            if (attribs[i] == EGL_SURFACE_Y_INVERTED_NVX)
             {
-                eplSetError(plat, EGL_BAD_ATTRIBUTE, "Invalid attribute 0x%04x\n", attribs[count]);
+                eplSetError(plat, EGL_BAD_ATTRIBUTE, "Invalid attribute 0x%04x\n", attribs[i]);
                 return NULL;
             }
+            count += 2;
         }
     }
 
@@ -1306,7 +1720,23 @@ EGLAttrib *eplX11GetInternalSurfaceAttribs(EplPlatformData *plat, EplDisplay *pd
         return NULL;
     }
 
-    memcpy(internalAttribs, attribs, count * sizeof(EGLAttrib));
+    count = 0;
+    if (attribs != NULL)
+    {
+        for (i = 0; attribs[i] != EGL_NONE; i += 2)
+        {
+            // The driver doesn't know about EGL_X11_QUEUE_MODE_NVX, since
+            // that's handled entirely in the platform library. Likewise, we
+            // pick single or double buffering by which color buffers we
+            // attach, so don't pass EGL_RENDER_BUFFER along either.
+            if (attribs[i] != EGL_X11_QUEUE_MODE_NVX && attribs[i] != EGL_RENDER_BUFFER)
+            {
+                internalAttribs[count] = attribs[i];
+                internalAttribs[count + 1] = attribs[i + 1];
+                count += 2;
+            }
+        }
+    }
     internalAttribs[count] = EGL_SURFACE_Y_INVERTED_NVX;
     internalAttribs[count + 1] = EGL_TRUE;
     internalAttribs[count + 2] = EGL_NONE;
@@ -34,6 +34,7 @@
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/xfixes.h>
 #include <gbm.h>
 #include <xf86drm.h>
 
@@ -53,6 +54,104 @@
 #define XCB_PRESENT_CAPABILITY_SYNCOBJ 16
 #endif
 
+/**
+ * A window surface attribute that selects how many color buffers we allocate,
+ * and how many frames eglSwapBuffers can queue up in the server.
+ *
+ * EGL_X11_QUEUE_MODE_LOW_LATENCY_NVX uses two color buffers and waits for
+ * each frame to complete before sending the next one.
+ *
+ * EGL_X11_QUEUE_MODE_THROUGHPUT_NVX allows up to four pending frames, with
+ * enough color buffers to keep rendering while they're queued.
+ *
+ * The __NV_X11_EGL_QUEUE_MODE environment variable overrides the attribute.
+ * It can be set to "default", "low-latency", or "throughput".
+ *
+ * These values come from the block of enums that's reserved for NVIDIA
+ * (0x3380 through 0x339F), so that they can't collide with a registered
+ * attribute. They're only meaningful to this library, which removes the
+ * attribute before calling into the driver.
+ */
+#define EGL_X11_QUEUE_MODE_NVX                  0x3380
+#define EGL_X11_QUEUE_MODE_DEFAULT_NVX          0x3381
+#define EGL_X11_QUEUE_MODE_LOW_LATENCY_NVX      0x3382
+#define EGL_X11_QUEUE_MODE_THROUGHPUT_NVX       0x3383
+
+/**
+ * Surface attributes for querying a window's frame statistics with
+ * eglQuerySurface. These are only valid for window surfaces.
+ *
+ * EGL_X11_STATS_FRAMES_NVX is the number of frames presented so far.
+ *
+ * The *_WAIT_US_NVX and EGL_X11_STATS_SYNC_US_NVX attributes are the total
+ * time, in microseconds, that eglSwapBuffers has spent waiting for a free
+ * buffer, waiting for Present events, and synchronizing rendering.
+ *
+ * EGL_X11_STATS_BUFFERS_ALLOCATED_NVX is the number of buffers allocated, and
+ * the *_REALLOCS_NVX attributes count the times that the window's buffers were
+ * reallocated because of a resize or a format modifier change.
+ * EGL_X11_STATS_BUFFERS_TRIMMED_NVX is the number of idle buffers that were
+ * freed to save memory.
+ *
+ * The EGL_X11_STATS_PRESENTS_*_NVX attributes count each mode reported in
+ * PresentCompleteNotify events.
+ *
+ * EGL_X11_STATS_LAST_MSC_DELTA_NVX and EGL_X11_STATS_LAST_UST_DELTA_US_NVX are
+ * the MSC and UST differences between sending the most recent completed frame
+ * and its PresentCompleteNotify event.
+ *
+ * Values that don't fit in an EGLint are clamped.
+ *
+ * Setting the __NV_X11_EGL_FRAME_STATS environment variable to a number N will
+ * also write the statistics for each window to stderr every N frames.
+ *
+ * As with EGL_X11_QUEUE_MODE_NVX, these values come from the block that's
+ * reserved for NVIDIA. eplX11QuerySurface relies on them being contiguous.
+ */
+#define EGL_X11_STATS_FRAMES_NVX                    0x3384
+#define EGL_X11_STATS_BUFFER_WAIT_US_NVX            0x3385
+#define EGL_X11_STATS_EVENT_WAIT_US_NVX             0x3386
+#define EGL_X11_STATS_SYNC_US_NVX                   0x3387
+#define EGL_X11_STATS_BUFFERS_ALLOCATED_NVX         0x3388
+#define EGL_X11_STATS_RESIZE_REALLOCS_NVX           0x3389
+#define EGL_X11_STATS_MODIFIER_REALLOCS_NVX         0x338A
+#define EGL_X11_STATS_PRESENTS_FLIP_NVX             0x338B
+#define EGL_X11_STATS_PRESENTS_COPY_NVX             0x338C
+#define EGL_X11_STATS_PRESENTS_SUBOPTIMAL_COPY_NVX  0x338D
+#define EGL_X11_STATS_LAST_MSC_DELTA_NVX            0x338E
+#define EGL_X11_STATS_LAST_UST_DELTA_US_NVX         0x338F
+#define EGL_X11_STATS_BUFFERS_TRIMMED_NVX           0x3390
+
+/**
+ * Surface attributes for presentation feedback, queried with eglQuerySurface
+ * on a window surface.
+ *
+ * EGL_X11_PRESENT_SERIAL_NVX is the serial number of the most recent
+ * PresentPixmap request. With asynchronous presentation, a frame only gets a
+ * serial number once the presentation thread sends it.
+ *
+ * Querying EGL_X11_FEEDBACK_SERIAL_NVX returns the serial number of the oldest
+ * completed frame that it hasn't already returned, or zero if there isn't
+ * one. After that, the other EGL_X11_FEEDBACK_*_NVX attributes return the
+ * values from that frame's PresentCompleteNotify event: the UST in
+ * microseconds, the MSC, and the completion mode, which is one of the
+ * XCB_PRESENT_COMPLETE_MODE_* values. The 64-bit UST and MSC values are split
+ * into their low and high 32 bits.
+ *
+ * Only the most recent 64 frames are kept, so an app has to check for feedback
+ * at least that often to see every frame.
+ *
+ * As with EGL_X11_QUEUE_MODE_NVX, these values come from the block that's
+ * reserved for NVIDIA.
+ */
+#define EGL_X11_PRESENT_SERIAL_NVX                  0x3391
+#define EGL_X11_FEEDBACK_SERIAL_NVX                 0x3392
+#define EGL_X11_FEEDBACK_UST_LO_NVX                 0x3393
+#define EGL_X11_FEEDBACK_UST_HI_NVX                 0x3394
+#define EGL_X11_FEEDBACK_MSC_LO_NVX                 0x3395
+#define EGL_X11_FEEDBACK_MSC_HI_NVX                 0x3396
+#define EGL_X11_FEEDBACK_MODE_NVX                   0x3397
+
 /**
  * Keeps track of a callback that we've registered with XESetCloseDisplay.
  *
@@ -62,6 +161,43 @@ typedef struct _X11XlibDisplayClosedData X11XlibDisplayClosedData;
 
 EPL_REFCOUNT_DECLARE_TYPE_FUNCS(X11XlibDisplayClosedData, eplX11XlibDisplayClosedData);
 
+/**
+ * A thread that sends PresentPixmap requests on behalf of eglSwapBuffers.
+ *
+ * This is only used if asynchronous presentation is enabled.
+ */
+typedef struct _X11Presenter X11Presenter;
+
+/**
+ * A deferred X request for the presentation thread to send once a fence has
+ * signaled.
+ */
+typedef void (* X11PresenterJobFunc) (void *param);
+
+/**
+ * A cache of timeline sync objects that have already been shared with the
+ * server, so that we can reuse them for new buffers.
+ */
+typedef struct _X11TimelinePool X11TimelinePool;
+
+/**
+ * A cache of the format modifiers that we picked for each window, so that
+ * creating a new surface for a window doesn't need a round trip.
+ */
+typedef struct _X11ModifierCache X11ModifierCache;
+
+/**
+ * A cache of GCs for copying to pixmaps, one for each depth.
+ */
+typedef struct _X11GCCache X11GCCache;
+
+/**
+ * An on-disk cache of the driver's formats and EGLConfigs.
+ *
+ * See x11-config-cache.h for details.
+ */
+typedef struct _X11ConfigCache X11ConfigCache;
+
 /**
  * Platform-specific stuff for X11.
  *
@@ -105,6 +241,18 @@ struct _EplImplPlatform
                 uint64_t acquire_point, uint64_t release_point,
                 uint32_t options, uint64_t target_msc, uint64_t divisor, uint64_t remainder,
                 uint32_t notifies_len, const xcb_present_notify_t *notifies);
+
+        /**
+         * The checked version of present_pixmap_synced. This is optional.
+         */
+        xcb_void_cookie_t (* present_pixmap_synced_checked) (xcb_connection_t *c, xcb_window_t window,
+                xcb_pixmap_t pixmap, uint32_t serial,
+                xcb_xfixes_region_t valid, xcb_xfixes_region_t update, int16_t x_off, int16_t y_off,
+                xcb_randr_crtc_t target_crtc,
+                uint32_t acquire_syncobj, uint32_t release_syncobj,
+                uint64_t acquire_point, uint64_t release_point,
+                uint32_t options, uint64_t target_msc, uint64_t divisor, uint64_t remainder,
+                uint32_t notifies_len, const xcb_present_notify_t *notifies);
     } xcb;
 
     struct
@@ -127,11 +275,28 @@ struct _EplImplPlatform
                           uint32_t dst_handle, uint64_t dst_point,
                           uint32_t src_handle, uint64_t src_point,
                           uint32_t flags);
+
+        /**
+         * drmSyncobjEventfd is only available in newer versions of libdrm,
+         * so this is optional even if the other functions are available.
+         */
+        int (* SyncobjEventfd) (int fd, uint32_t handle, uint64_t point,
+                          int ev_fd, uint32_t flags);
     } drm;
 
     EGLBoolean timeline_funcs_supported;
 };
 
+/**
+ * The most planes that the driver's color buffer import can describe.
+ *
+ * Everything on the X11 side handles up to GBM_MAX_PLANES planes, but
+ * eglPlatformImportColorBufferNVX only takes a single dma-buf, stride, and
+ * offset. eplX11InitDriverFormats leaves out any modifier that needs more
+ * planes than this, so that we never pick a modifier that we can't import.
+ */
+#define X11_MAX_IMPORT_PLANES 1
+
 /**
  * Keeps track of format and format modifier support in the driver.
  *
@@ -172,11 +337,45 @@ typedef struct
  * app calls XCloseDisplay while another thread is trying to send or receive X
  * protocol, then it'll crash. But, if that happens, then that's very
  * definitely an app bug.
+ *
+ * Since none of this data depends on the EGLDisplay itself, an initialized
+ * X11DisplayInstance is also shared between every EGLDisplay that uses the
+ * same connection, screen, and device. eplX11DisplayInstanceCreate keeps a
+ * list of the instances that it can hand out again.
  */
 typedef struct
 {
     EplRefCount refcount;
 
+    /**
+     * True if this instance is in the list of shared instances.
+     *
+     * This is set before the instance is added to the list, and it
+     * doesn't change after that.
+     */
+    EGLBoolean shared;
+
+    /**
+     * The entry in the list of shared instances.
+     */
+    struct glvnd_list entry;
+
+    /**
+     * The values of EplImplDisplay::requested_device and
+     * EplImplDisplay::enable_alt_device that we used to pick \c device.
+     *
+     * Another EGLDisplay can share this instance if it has the same values,
+     * or if it requested \c device itself.
+     */
+    EGLDeviceEXT requested_device;
+    EGLBoolean enable_alt_device;
+
+    /**
+     * The callback for the Xlib display that this instance was created for,
+     * so that we don't share an instance after its connection is closed.
+     */
+    X11XlibDisplayClosedData *closed_callback;
+
     /**
      * A reference to the \c EplPlatformData that this display came from.
      *
@@ -262,6 +461,40 @@ typedef struct
      */
     EGLBoolean supports_explicit_sync;
 
+    /**
+     * If true, then the server supports XFixes regions, so we can pass the
+     * damage rectangles from eglSwapBuffersWithDamage to the server as the
+     * update region in a PresentPixmap request.
+     */
+    EGLBoolean supports_update_regions;
+
+    /**
+     * The presentation thread for this display, or NULL if asynchronous
+     * presentation is disabled.
+     *
+     * This is enabled with the __NV_X11_EGL_ASYNC_PRESENT environment
+     * variable.
+     */
+    X11Presenter *presenter;
+
+    /**
+     * Unused timeline objects from freed color buffers, or NULL if explicit
+     * sync isn't supported.
+     */
+    X11TimelinePool *timeline_pool;
+
+    /**
+     * The supported modifiers for each window, or NULL if we couldn't
+     * allocate the cache.
+     */
+    X11ModifierCache *modifier_cache;
+
+    /**
+     * GCs for the CopyArea requests for PRIME pixmaps, or NULL if we couldn't
+     * allocate the cache.
+     */
+    X11GCCache *gc_cache;
+
     /**
      * The list of EGLConfigs.
      */
@@ -392,9 +625,11 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
  *
  * \param plat The platform data.
  * \param inst The X11DisplayInstance to fill in.
+ * \param cache The config cache, or NULL if the cache is disabled.
  * \return EGL_TRUE on success, or EGL_FALSE on failure.
  */
-EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *inst);
+EGLBoolean eplX11InitDriverFormats(EplPlatformData *plat, X11DisplayInstance *inst,
+        X11ConfigCache *cache);
 
 /**
  * Cleans up the format list that was initialized in eplX11InitDriverFormats.
@@ -406,14 +641,16 @@ void eplX11CleanupDriverFormats(X11DisplayInstance *inst);
  */
 X11DriverFormat *eplX11FindDriverFormat(X11DisplayInstance *inst, uint32_t fourcc);
 
-EGLBoolean eplX11InitConfigList(EplPlatformData *plat, X11DisplayInstance *inst);
+EGLBoolean eplX11InitConfigList(EplPlatformData *plat, X11DisplayInstance *inst,
+        X11ConfigCache *cache);
 
 /**
  * Returns the list of EGL attributes (not the buffers/internal attributes)
  * that should be passed to eglPlatformCreateSurfaceNVX.
  *
- * Currently, this just sets the EGL_WAYLAND_Y_INVERTED_WL flag to true, and
- * passes any other attributes through.
+ * Currently, this just sets the EGL_WAYLAND_Y_INVERTED_WL flag to true,
+ * removes any attributes that the platform library handles itself (such as
+ * EGL_X11_QUEUE_MODE_NVX), and passes any other attributes through.
  *
  * \param plat The platform data
  * \param pdpy The display data
@@ -441,6 +678,106 @@ void eplX11FreeWindow(EplSurface *surf);
 
 EGLBoolean eplX11WaitGLWindow(EplDisplay *pdpy, EplSurface *psurf);
 
+/**
+ * Waits for any deferred copies for a pixmap surface to finish.
+ */
+EGLBoolean eplX11WaitGLPixmap(EplDisplay *pdpy, EplSurface *surf);
+
+/**
+ * Creates and starts a presentation thread.
+ *
+ * \return The new X11Presenter, or NULL on failure.
+ */
+X11Presenter *eplX11PresenterCreate(void);
+
+/**
+ * Stops and frees a presentation thread.
+ *
+ * Every window that used the presenter must already be destroyed.
+ */
+void eplX11PresenterDestroy(X11Presenter *presenter);
+
+/**
+ * Has the presentation thread call a function after a fence signals, so that
+ * the caller doesn't have to do a CPU wait.
+ *
+ * If the same function and parameter are already waiting, then this replaces
+ * the fence instead of adding a second job.
+ *
+ * \param presenter The presentation thread.
+ * \param syncfd The fence. This function will duplicate it.
+ * \param func The function to call. It's called without any locks held.
+ * \param param The parameter to pass to \p func.
+ * \return EGL_TRUE on success, or EGL_FALSE if the caller should wait for
+ *      the fence itself.
+ */
+EGLBoolean eplX11PresenterQueueJob(X11Presenter *presenter, int syncfd,
+        X11PresenterJobFunc func, void *param);
+
+/**
+ * Waits for the presentation thread to finish any jobs for \p param.
+ */
+void eplX11PresenterWaitJobs(X11Presenter *presenter, void *param);
+
+/**
+ * Creates an empty modifier cache.
+ *
+ * \return The new X11ModifierCache, or NULL on failure.
+ */
+X11ModifierCache *eplX11ModifierCacheCreate(void);
+
+/**
+ * Frees a modifier cache.
+ */
+void eplX11ModifierCacheDestroy(X11ModifierCache *cache);
+
+/**
+ * Creates an empty GC cache.
+ *
+ * \return The new X11GCCache, or NULL on failure.
+ */
+X11GCCache *eplX11GCCacheCreate(void);
+
+/**
+ * Frees a GC cache, along with any GCs in it.
+ */
+void eplX11GCCacheDestroy(X11DisplayInstance *inst, X11GCCache *cache);
+
+/**
+ * Returns the buffer age of a window's current back buffer, for
+ * EGL_EXT_buffer_age and EGL_KHR_partial_update.
+ */
+EGLBoolean eplX11QueryBufferAge(EplDisplay *pdpy, EplSurface *psurf, EGLint *value);
+
+/**
+ * Returns EGL_SINGLE_BUFFER or EGL_BACK_BUFFER for a window's
+ * EGL_RENDER_BUFFER attribute.
+ */
+EGLBoolean eplX11QueryRenderBuffer(EplDisplay *pdpy, EplSurface *psurf, EGLint *value);
+
+/**
+ * Returns one of a window's frame statistics, for the EGL_X11_STATS_*_NVX
+ * attributes.
+ */
+EGLBoolean eplX11QueryFrameStats(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value);
+
+/**
+ * Returns presentation feedback for a window, for EGL_X11_PRESENT_SERIAL_NVX
+ * and the EGL_X11_FEEDBACK_*_NVX attributes.
+ */
+EGLBoolean eplX11QueryPresentFeedback(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value);
+
+/**
+ * The hook function for eglSetDamageRegionKHR.
+ */
+EGLBoolean eplX11SetDamageRegion(EGLDisplay edpy, EGLSurface esurf,
+        EGLint *rects, EGLint n_rects);
+
+/**
+ * The hook function for eglPresentationTimeANDROID.
+ */
+EGLBoolean eplX11PresentationTime(EGLDisplay edpy, EGLSurface esurf, EGLnsecsANDROID time);
+
 /**
  * A wrapper around the DMA_BUF_IOCTL_IMPORT_SYNC_FILE ioctl.
  *
@@ -16,11 +16,169 @@
  */
 
 #include "x11-timeline.h"
+#include "x11-trace.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <assert.h>
 
+/**
+ * The maximum number of unused timelines to keep around for each display.
+ */
+#define TIMELINE_POOL_SIZE 16
+
+/**
+ * The maximum number of temporary binary syncobjs to keep around for each
+ * display.
+ */
+#define SCRATCH_SYNCOBJ_POOL_SIZE 4
+
+struct _X11TimelinePool
+{
+    pthread_mutex_t mutex;
+    X11Timeline entries[TIMELINE_POOL_SIZE];
+    int count;
+
+    /**
+     * Binary syncobjs for eplX11TimelineAttachSyncFD and
+     * eplX11TimelinePointToSyncFD, so that we don't have to create and
+     * destroy one for every frame.
+     *
+     * These don't need to be reset before they're reused, because importing
+     * a sync file or transferring a point into one replaces its fence.
+     */
+    uint32_t scratch[SCRATCH_SYNCOBJ_POOL_SIZE];
+    int num_scratch;
+};
+
+X11TimelinePool *eplX11TimelinePoolCreate(void)
+{
+    X11TimelinePool *pool = calloc(1, sizeof(X11TimelinePool));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+}
+
+static void DestroyTimelineObjects(X11DisplayInstance *inst, X11Timeline *timeline)
+{
+    inst->platform->priv->xcb.dri3_free_syncobj(inst->conn, timeline->xid);
+    timeline->xid = 0;
+
+    inst->platform->priv->drm.SyncobjDestroy(
+            gbm_device_get_fd(inst->gbmdev),
+            timeline->handle);
+    timeline->handle = 0;
+}
+
+void eplX11TimelinePoolDestroy(X11DisplayInstance *inst, X11TimelinePool *pool)
+{
+    int i;
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    for (i=0; i<pool->count; i++)
+    {
+        DestroyTimelineObjects(inst, &pool->entries[i]);
+    }
+    for (i=0; i<pool->num_scratch; i++)
+    {
+        inst->platform->priv->drm.SyncobjDestroy(
+                gbm_device_get_fd(inst->gbmdev),
+                pool->scratch[i]);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/**
+ * Returns a binary syncobj to use for a single transfer, either from the
+ * display's pool or a newly created one.
+ *
+ * \return The syncobj handle, or 0 on failure.
+ */
+static uint32_t GetScratchSyncobj(X11DisplayInstance *inst)
+{
+    uint32_t handle = 0;
+
+    if (inst->timeline_pool != NULL)
+    {
+        pthread_mutex_lock(&inst->timeline_pool->mutex);
+        if (inst->timeline_pool->num_scratch > 0)
+        {
+            inst->timeline_pool->num_scratch--;
+            handle = inst->timeline_pool->scratch[inst->timeline_pool->num_scratch];
+        }
+        pthread_mutex_unlock(&inst->timeline_pool->mutex);
+
+        if (handle != 0)
+        {
+            return handle;
+        }
+    }
+
+    if (inst->platform->priv->drm.SyncobjCreate(
+                gbm_device_get_fd(inst->gbmdev),
+                0, &handle) != 0)
+    {
+        return 0;
+    }
+    return handle;
+}
+
+/**
+ * Returns a syncobj from GetScratchSyncobj to the display's pool, or
+ * destroys it if the pool is full.
+ */
+static void PutScratchSyncobj(X11DisplayInstance *inst, uint32_t handle)
+{
+    if (inst->timeline_pool != NULL)
+    {
+        EGLBoolean pooled = EGL_FALSE;
+
+        pthread_mutex_lock(&inst->timeline_pool->mutex);
+        if (inst->timeline_pool->num_scratch < SCRATCH_SYNCOBJ_POOL_SIZE)
+        {
+            inst->timeline_pool->scratch[inst->timeline_pool->num_scratch++] = handle;
+            pooled = EGL_TRUE;
+        }
+        pthread_mutex_unlock(&inst->timeline_pool->mutex);
+
+        if (pooled)
+        {
+            return;
+        }
+    }
+
+    inst->platform->priv->drm.SyncobjDestroy(
+            gbm_device_get_fd(inst->gbmdev),
+            handle);
+}
+
+EGLBoolean eplX11TimelineIsSignaled(X11DisplayInstance *inst, X11Timeline *timeline)
+{
+    uint32_t first;
+
+    if (timeline->point == 0)
+    {
+        return EGL_TRUE;
+    }
+
+    // Note that if the point hasn't been submitted yet (for example, if the
+    // server still has the buffer), then this will fail.
+    return (inst->platform->priv->drm.SyncobjTimelineWait(
+                gbm_device_get_fd(inst->gbmdev),
+                &timeline->handle, &timeline->point, 1, 0, 0, &first) == 0);
+}
+
 EGLBoolean eplX11TimelineInit(X11DisplayInstance *inst, X11Timeline *timeline)
 {
     int fd = -1;
@@ -34,6 +192,30 @@ EGLBoolean eplX11TimelineInit(X11DisplayInstance *inst, X11Timeline *timeline)
         return EGL_FALSE;
     }
 
+    if (inst->timeline_pool != NULL)
+    {
+        EGLBoolean found = EGL_FALSE;
+
+        pthread_mutex_lock(&inst->timeline_pool->mutex);
+        if (inst->timeline_pool->count > 0)
+        {
+            /*
+             * The new buffer just continues from the timeline's last point,
+             * which is already signaled. The server doesn't care which points
+             * we use, as long as they keep increasing.
+             */
+            inst->timeline_pool->count--;
+            *timeline = inst->timeline_pool->entries[inst->timeline_pool->count];
+            found = EGL_TRUE;
+        }
+        pthread_mutex_unlock(&inst->timeline_pool->mutex);
+
+        if (found)
+        {
+            return EGL_TRUE;
+        }
+    }
+
     ret = inst->platform->priv->drm.SyncobjCreate(
             gbm_device_get_fd(inst->gbmdev),
             0, &timeline->handle);
@@ -68,26 +250,37 @@ void eplX11TimelineDestroy(X11DisplayInstance *inst, X11Timeline *timeline)
     // called.
     if (timeline->xid != 0)
     {
-        inst->platform->priv->xcb.dri3_free_syncobj(inst->conn, timeline->xid);
-        timeline->xid = 0;
+        if (inst->timeline_pool != NULL && eplX11TimelineIsSignaled(inst, timeline))
+        {
+            EGLBoolean pooled = EGL_FALSE;
 
-        inst->platform->priv->drm.SyncobjDestroy(
-                gbm_device_get_fd(inst->gbmdev),
-                timeline->handle);
-        timeline->handle = 0;
+            pthread_mutex_lock(&inst->timeline_pool->mutex);
+            if (inst->timeline_pool->count < TIMELINE_POOL_SIZE)
+            {
+                inst->timeline_pool->entries[inst->timeline_pool->count++] = *timeline;
+                pooled = EGL_TRUE;
+            }
+            pthread_mutex_unlock(&inst->timeline_pool->mutex);
+
+            if (pooled)
+            {
+                memset(timeline, 0, sizeof(*timeline));
+                return;
+            }
+        }
+
+        DestroyTimelineObjects(inst, timeline);
     }
 }
 
 int eplX11TimelinePointToSyncFD(X11DisplayInstance *inst, X11Timeline *timeline)
 {
-    uint32_t tempobj = 0;
+    uint32_t tempobj = GetScratchSyncobj(inst);
     int syncfd = -1;
 
-    if (inst->platform->priv->drm.SyncobjCreate(
-                gbm_device_get_fd(inst->gbmdev),
-                0, &tempobj) != 0)
+    if (tempobj == 0)
     {
-        return EGL_FALSE;
+        return -1;
     }
 
     if (inst->platform->priv->drm.SyncobjTransfer(gbm_device_get_fd(inst->gbmdev),
@@ -103,9 +296,7 @@ int eplX11TimelinePointToSyncFD(X11DisplayInstance *inst, X11Timeline *timeline)
     }
 
 done:
-    inst->platform->priv->drm.SyncobjDestroy(
-            gbm_device_get_fd(inst->gbmdev),
-            tempobj);
+    PutScratchSyncobj(inst, tempobj);
     return syncfd;
 }
 
@@ -113,12 +304,12 @@ EGLBoolean eplX11TimelineAttachSyncFD(X11DisplayInstance *inst, X11Timeline *tim
 {
     uint32_t tempobj = 0;
     EGLBoolean success = EGL_FALSE;
+    X11_TRACE_SCOPE(0, timeline->xid, timeline->point);
 
     assert(syncfd >= 0);
 
-    if (inst->platform->priv->drm.SyncobjCreate(
-                gbm_device_get_fd(inst->gbmdev),
-                0, &tempobj) != 0)
+    tempobj = GetScratchSyncobj(inst);
+    if (tempobj == 0)
     {
         // TODO: Issue an EGL error here?
         return EGL_FALSE;
@@ -143,8 +334,6 @@ EGLBoolean eplX11TimelineAttachSyncFD(X11DisplayInstance *inst, X11Timeline *tim
     success = EGL_TRUE;
 
 done:
-    inst->platform->priv->drm.SyncobjDestroy(
-            gbm_device_get_fd(inst->gbmdev),
-            tempobj);
+    PutScratchSyncobj(inst, tempobj);
     return success;
 }
@@ -39,11 +39,34 @@ typedef struct
 /**
  * Creates and initializes a timeline sync object.
  *
- * This will create a timeline object, and share it with the server using DRI3.
+ * This will reuse a timeline from the display's pool if there is one.
+ * Otherwise, it will create a new timeline object, and share it with the
+ * server using DRI3.
  */
 EGLBoolean eplX11TimelineInit(X11DisplayInstance *inst, X11Timeline *timeline);
+
+/**
+ * Releases a timeline sync object.
+ *
+ * If the timeline's last point has already signaled, then this returns it to
+ * the display's pool so that eplX11TimelineInit can reuse it. Otherwise, it
+ * destroys the timeline.
+ */
 void eplX11TimelineDestroy(X11DisplayInstance *inst, X11Timeline *timeline);
 
+/**
+ * Creates an empty timeline pool.
+ */
+X11TimelinePool *eplX11TimelinePoolCreate(void);
+
+/**
+ * Destroys every timeline in a pool, and then frees the pool.
+ *
+ * This must be called before the display's connection and GBM device are
+ * closed.
+ */
+void eplX11TimelinePoolDestroy(X11DisplayInstance *inst, X11TimelinePool *pool);
+
 /**
  * Attaches a sync FD to the next timeline point.
  *
@@ -57,4 +80,12 @@ EGLBoolean eplX11TimelineAttachSyncFD(X11DisplayInstance *inst, X11Timeline *tim
  */
 int eplX11TimelinePointToSyncFD(X11DisplayInstance *inst, X11Timeline *timeline);
 
+/**
+ * Returns true if the current timeline point has already signaled.
+ *
+ * This only checks the point without waiting, so it's a cheap way to skip
+ * creating a sync FD or an EGLSync for a fence that's already done.
+ */
+EGLBoolean eplX11TimelineIsSignaled(X11DisplayInstance *inst, X11Timeline *timeline);
+
 #endif // X11_TIMELINE_H
@@ -0,0 +1,388 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * \file
+ *
+ * Per-thread event recording for the optional trace points.
+ */
+
+#include "x11-trace.h"
+#include "x11-platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/**
+ * The number of events that each thread's ring buffer holds. Once a ring is
+ * full, new events overwrite the oldest ones.
+ */
+#define TRACE_RING_SIZE 16384
+
+static const char *TRACE_ENV = "__NV_X11_EGL_TRACE";
+
+typedef struct
+{
+    const char *name;
+    uint64_t timestamp;
+    uint64_t point;
+    uint32_t serial;
+    uint32_t xid;
+    char phase;
+} X11TraceRecord;
+
+typedef struct _X11TraceRing
+{
+    pid_t tid;
+
+    /**
+     * The total number of events that this thread has recorded. Only the
+     * owning thread writes to this.
+     */
+    uint64_t count;
+
+    X11TraceRecord records[TRACE_RING_SIZE];
+
+    struct _X11TraceRing *next;
+} X11TraceRing;
+
+EGLBoolean eplX11TraceEnabled = EGL_FALSE;
+
+static char *trace_path = NULL;
+
+/**
+ * The platform name for the trace file name, from eplX11TraceSetPlatform.
+ */
+static const char *trace_platform_name = "x11";
+
+/**
+ * A list of every thread's ring buffer.
+ *
+ * Rings are only ever added to the front of the list, so adding one is a
+ * single compare-and-swap. The rings are kept after a thread exits so that
+ * its events still end up in the output.
+ */
+static X11TraceRing *trace_rings = NULL;
+
+static __thread X11TraceRing *thread_ring = NULL;
+
+/**
+ * A list of every counter that's been used. Like the rings, counters are only
+ * added to the front.
+ */
+static X11TraceCounter *trace_counters = NULL;
+
+static uint64_t GetTraceTimestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static X11TraceRing *GetThreadRing(void)
+{
+    X11TraceRing *ring = thread_ring;
+
+    if (ring == NULL)
+    {
+        ring = calloc(1, sizeof(X11TraceRing));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        ring->tid = (pid_t) syscall(SYS_gettid);
+
+        do
+        {
+            ring->next = trace_rings;
+        } while (!__sync_bool_compare_and_swap(&trace_rings, ring->next, ring));
+
+        thread_ring = ring;
+    }
+    return ring;
+}
+
+void eplX11TraceEvent(const char *name, char phase,
+        uint32_t serial, uint32_t xid, uint64_t point)
+{
+    X11TraceRing *ring = GetThreadRing();
+    X11TraceRecord *rec;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    rec = &ring->records[ring->count % TRACE_RING_SIZE];
+    rec->name = name;
+    rec->timestamp = GetTraceTimestamp();
+    rec->phase = phase;
+    rec->serial = serial;
+    rec->xid = xid;
+    rec->point = point;
+
+    // Publish the record before bumping the count, so that the dump at
+    // shutdown doesn't see a half-written record from another thread.
+    __sync_synchronize();
+    ring->count++;
+}
+
+void eplX11TraceScopeEnd(X11TraceScope *scope)
+{
+    if (eplX11TraceEnabled)
+    {
+        // This runs after the traced function has returned, so don't let it
+        // clobber the errno value that the caller is about to check.
+        int err = errno;
+        eplX11TraceEvent(scope->name, 'E', scope->serial, scope->xid, scope->point);
+        errno = err;
+    }
+}
+
+void eplX11TraceCount(X11TraceCounter *counter)
+{
+    if (!counter->registered && __sync_bool_compare_and_swap(&counter->registered, 0, 1))
+    {
+        do
+        {
+            counter->next = trace_counters;
+        } while (!__sync_bool_compare_and_swap(&trace_counters, counter->next, counter));
+    }
+    __sync_fetch_and_add(&counter->count, 1);
+}
+
+/**
+ * Defines a wrapper for one of the functions in EplImplPlatform::drm. The
+ * original function pointer is saved in Real<name>, and the number of calls
+ * is kept in Count<name>.
+ */
+#define DEFINE_DRM_WRAPPER(name, params, args) \
+    static int (* Real##name) params = NULL; \
+    static X11TraceCounter Count##name = { "drm" #name, 0, 0, NULL }; \
+    static int Trace##name params \
+    { \
+        X11_TRACE_NAMED_SCOPE("drm" #name, 0, 0, 0); \
+        eplX11TraceCount(&Count##name); \
+        return Real##name args; \
+    }
+
+DEFINE_DRM_WRAPPER(GetCap, (int fd, uint64_t capability, uint64_t *value),
+        (fd, capability, value))
+DEFINE_DRM_WRAPPER(SyncobjCreate, (int fd, uint32_t flags, uint32_t *handle),
+        (fd, flags, handle))
+DEFINE_DRM_WRAPPER(SyncobjDestroy, (int fd, uint32_t handle),
+        (fd, handle))
+DEFINE_DRM_WRAPPER(SyncobjHandleToFD, (int fd, uint32_t handle, int *obj_fd),
+        (fd, handle, obj_fd))
+DEFINE_DRM_WRAPPER(SyncobjFDToHandle, (int fd, int obj_fd, uint32_t *handle),
+        (fd, obj_fd, handle))
+DEFINE_DRM_WRAPPER(SyncobjImportSyncFile, (int fd, uint32_t handle, int sync_file_fd),
+        (fd, handle, sync_file_fd))
+DEFINE_DRM_WRAPPER(SyncobjExportSyncFile, (int fd, uint32_t handle, int *sync_file_fd),
+        (fd, handle, sync_file_fd))
+DEFINE_DRM_WRAPPER(SyncobjTimelineSignal,
+        (int fd, const uint32_t *handles, uint64_t *points, uint32_t handle_count),
+        (fd, handles, points, handle_count))
+DEFINE_DRM_WRAPPER(SyncobjTimelineWait,
+        (int fd, uint32_t *handles, uint64_t *points, unsigned num_handles,
+         int64_t timeout_nsec, unsigned flags, uint32_t *first_signaled),
+        (fd, handles, points, num_handles, timeout_nsec, flags, first_signaled))
+DEFINE_DRM_WRAPPER(SyncobjTransfer,
+        (int fd, uint32_t dst_handle, uint64_t dst_point,
+         uint32_t src_handle, uint64_t src_point, uint32_t flags),
+        (fd, dst_handle, dst_point, src_handle, src_point, flags))
+DEFINE_DRM_WRAPPER(SyncobjEventfd,
+        (int fd, uint32_t handle, uint64_t point, int ev_fd, uint32_t flags),
+        (fd, handle, point, ev_fd, flags))
+
+#undef DEFINE_DRM_WRAPPER
+
+void eplX11TraceSetPlatform(EplPlatformData *plat)
+{
+    if (plat->platform_enum == EGL_PLATFORM_XCB_EXT)
+    {
+        trace_platform_name = "xcb";
+    }
+    else if (plat->platform_enum == EGL_PLATFORM_X11_KHR)
+    {
+        trace_platform_name = "xlib";
+    }
+}
+
+void eplX11TraceWrapDrmFunctions(EplImplPlatform *priv)
+{
+    if (!eplX11TraceEnabled)
+    {
+        return;
+    }
+
+#define WRAP_DRM(name) \
+    if (priv->drm.name != NULL && priv->drm.name != Trace##name) \
+    { \
+        Real##name = priv->drm.name; \
+        priv->drm.name = Trace##name; \
+    }
+
+    WRAP_DRM(GetCap);
+    WRAP_DRM(SyncobjCreate);
+    WRAP_DRM(SyncobjDestroy);
+    WRAP_DRM(SyncobjHandleToFD);
+    WRAP_DRM(SyncobjFDToHandle);
+    WRAP_DRM(SyncobjImportSyncFile);
+    WRAP_DRM(SyncobjExportSyncFile);
+    WRAP_DRM(SyncobjTimelineSignal);
+    WRAP_DRM(SyncobjTimelineWait);
+    WRAP_DRM(SyncobjTransfer);
+    WRAP_DRM(SyncobjEventfd);
+
+#undef WRAP_DRM
+}
+
+/**
+ * Writes the totals for every counter as a JSON object, adding together the
+ * counters that share a name.
+ */
+static void WriteTraceCounts(FILE *fp)
+{
+    X11TraceCounter *counter;
+    EGLBoolean first = EGL_TRUE;
+
+    __sync_synchronize();
+    fprintf(fp, "{");
+    for (counter = trace_counters; counter != NULL; counter = counter->next)
+    {
+        X11TraceCounter *other;
+        uint64_t total = 0;
+
+        // Skip any name that an earlier counter in the list already covered.
+        for (other = trace_counters; other != counter; other = other->next)
+        {
+            if (strcmp(other->name, counter->name) == 0)
+            {
+                break;
+            }
+        }
+        if (other != counter)
+        {
+            continue;
+        }
+
+        for (other = counter; other != NULL; other = other->next)
+        {
+            if (strcmp(other->name, counter->name) == 0)
+            {
+                total += other->count;
+            }
+        }
+
+        fprintf(fp, "%s\"%s\":%" PRIu64, (first ? "" : ","), counter->name, total);
+        first = EGL_FALSE;
+    }
+    fprintf(fp, "}");
+}
+
+static void WriteTraceFile(void)
+{
+    X11TraceRing *ring;
+    EGLBoolean first = EGL_TRUE;
+    pid_t pid = getpid();
+    char *path = NULL;
+    FILE *fp;
+
+    if (asprintf(&path, "%s.%s.%d", trace_path, trace_platform_name, (int) pid) < 0)
+    {
+        return;
+    }
+
+    fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "nvidia-egl-x11: Can't open trace file %s\n", path);
+        free(path);
+        return;
+    }
+    free(path);
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (ring = trace_rings; ring != NULL; ring = ring->next)
+    {
+        uint64_t count = ring->count;
+        uint64_t start = 0;
+        uint64_t i;
+
+        __sync_synchronize();
+        if (count > TRACE_RING_SIZE)
+        {
+            start = count - TRACE_RING_SIZE;
+        }
+
+        for (i = start; i < count; i++)
+        {
+            const X11TraceRecord *rec = &ring->records[i % TRACE_RING_SIZE];
+
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"egl-x11\",\"ph\":\"%c\","
+                    "\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"serial\":%u,\"xid\":%u,\"point\":%" PRIu64 "}}",
+                    (first ? "" : ",\n"), rec->name, rec->phase,
+                    rec->timestamp / 1000, (unsigned int) (rec->timestamp % 1000),
+                    (int) pid, (int) ring->tid,
+                    rec->serial, rec->xid, rec->point);
+            first = EGL_FALSE;
+        }
+    }
+    fprintf(fp, "\n],\"eglX11Counts\":");
+    WriteTraceCounts(fp);
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
+
+static __attribute__((constructor)) void TraceInit(void)
+{
+    const char *env = getenv(TRACE_ENV);
+
+    if (env != NULL && env[0] != '\x00')
+    {
+        trace_path = strdup(env);
+        if (trace_path != NULL)
+        {
+            eplX11TraceEnabled = EGL_TRUE;
+        }
+    }
+}
+
+static __attribute__((destructor)) void TraceFini(void)
+{
+    if (!eplX11TraceEnabled)
+    {
+        return;
+    }
+
+    eplX11TraceEnabled = EGL_FALSE;
+    WriteTraceFile();
+
+    // Another thread could still be in the middle of recording an event, so
+    // the rings themselves are left alone.
+
+    free(trace_path);
+    trace_path = NULL;
+}
@@ -0,0 +1,183 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef X11_TRACE_H
+#define X11_TRACE_H
+
+/**
+ * \file
+ *
+ * Optional trace points for timing swaps, buffer allocation, and fence
+ * handling.
+ *
+ * The trace points are only compiled in if the library is built with the
+ * "tracing" meson option. Otherwise, all of the macros here expand to
+ * nothing.
+ *
+ * Even when compiled in, tracing is off until __NV_X11_EGL_TRACE is set to
+ * the path of an output file. Each thread records events into its own ring
+ * buffer, so recording an event doesn't take any locks. When the library is
+ * unloaded, the events are written to the file in the Chrome trace event
+ * format, which can be loaded in chrome://tracing or Perfetto.
+ *
+ * The XCB and Xlib platform libraries each keep their own trace, and a
+ * process can load both, so the platform name and the process ID are
+ * appended to the path. For example, __NV_X11_EGL_TRACE=/tmp/egl.json
+ * writes /tmp/egl.json.xcb.1234 and /tmp/egl.json.xlib.1234.
+ *
+ * The library also counts DRM ioctls and X protocol round trips. Each one
+ * shows up as an event in the trace, and the totals are written to the
+ * "eglX11Counts" object in the same file.
+ */
+
+#include <stdint.h>
+
+#ifdef ENABLE_TRACING
+
+#include <EGL/egl.h>
+
+#include "platform-base.h"
+
+/**
+ * The state for a single traced scope.
+ *
+ * The arguments are recorded with both the begin and the end event, so that
+ * a scope can fill in values like the present serial once it knows them.
+ */
+typedef struct
+{
+    const char *name;
+    uint32_t serial;
+    uint32_t xid;
+    uint64_t point;
+} X11TraceScope;
+
+/**
+ * A running count of calls to one function, such as a DRM ioctl or an xcb
+ * request that waits for a reply.
+ *
+ * Each counter registers itself the first time it's used, and the totals are
+ * written to the trace file along with the events. Counters with the same
+ * name are added together.
+ */
+typedef struct _X11TraceCounter
+{
+    const char *name;
+    uint64_t count;
+    int registered;
+    struct _X11TraceCounter *next;
+} X11TraceCounter;
+
+/**
+ * True if __NV_X11_EGL_TRACE is set and tracing is active.
+ */
+extern EGLBoolean eplX11TraceEnabled;
+
+/**
+ * Records a single event in the current thread's ring buffer.
+ *
+ * \param name The name of the event. This must be a static string.
+ * \param phase 'B' for the start of a scope or 'E' for the end.
+ */
+void eplX11TraceEvent(const char *name, char phase,
+        uint32_t serial, uint32_t xid, uint64_t point);
+
+/**
+ * Records the end event for a scope. This is used as the cleanup function
+ * for X11_TRACE_SCOPE.
+ */
+void eplX11TraceScopeEnd(X11TraceScope *scope);
+
+/**
+ * Increments a counter, registering it first if needed.
+ */
+void eplX11TraceCount(X11TraceCounter *counter);
+
+/**
+ * Records which platform this library is for, so that the XCB and Xlib
+ * libraries write their traces to different files.
+ */
+void eplX11TraceSetPlatform(EplPlatformData *plat);
+
+/**
+ * Replaces the functions in EplImplPlatform::drm with wrappers that count
+ * each call and record a trace scope for it, so that a trace shows how many
+ * DRM ioctls each call into the library makes.
+ *
+ * This does nothing if tracing isn't enabled at runtime.
+ */
+void eplX11TraceWrapDrmFunctions(EplImplPlatform *priv);
+
+/**
+ * Starts a traced scope with the given name.
+ *
+ * The end event is recorded automatically when the scope goes out of scope,
+ * so this works with any number of return statements. This declares a
+ * variable, so it should go after the other declarations in a function, and
+ * it can only be used once per block.
+ */
+#define X11_TRACE_NAMED_SCOPE(name, serial, xid, point) \
+    X11TraceScope x11TraceScope __attribute__((cleanup(eplX11TraceScopeEnd))) = \
+        { (name), (serial), (xid), (point) }; \
+    if (eplX11TraceEnabled) \
+        eplX11TraceEvent((name), 'B', (serial), (xid), (point))
+
+/**
+ * Starts a traced scope named after the current function.
+ */
+#define X11_TRACE_SCOPE(serial, xid, point) \
+    X11_TRACE_NAMED_SCOPE(__func__, serial, xid, point)
+
+/**
+ * Updates the arguments that get recorded with the end event of the current
+ * scope.
+ */
+#define X11_TRACE_ARGS(serial_, xid_, point_) \
+    do { \
+        x11TraceScope.serial = (serial_); \
+        x11TraceScope.xid = (xid_); \
+        x11TraceScope.point = (point_); \
+    } while (0)
+
+/**
+ * Counts an X protocol round trip, and records an instant event for it.
+ *
+ * This should go right before each call that waits for a reply from the
+ * server, such as an xcb_*_reply function or xcb_request_check.
+ *
+ * \param name The name of the request. This must be a static string.
+ */
+#define X11_TRACE_ROUND_TRIP(name) \
+    do { \
+        static X11TraceCounter x11TraceCounter = { (name), 0, 0, NULL }; \
+        if (eplX11TraceEnabled) \
+        { \
+            eplX11TraceCount(&x11TraceCounter); \
+            eplX11TraceEvent((name), 'i', 0, 0, 0); \
+        } \
+    } while (0)
+
+#else // ENABLE_TRACING
+
+#define X11_TRACE_NAMED_SCOPE(name, serial, xid, point) do { } while (0)
+#define X11_TRACE_SCOPE(serial, xid, point) do { } while (0)
+#define X11_TRACE_ARGS(serial, xid, point) do { } while (0)
+#define X11_TRACE_ROUND_TRIP(name) do { } while (0)
+
+#endif // ENABLE_TRACING
+
+#endif // X11_TRACE_H
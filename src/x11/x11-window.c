@@ -21,10 +21,12 @@
  * Window handling for X11.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <poll.h>
+#include <sys/eventfd.h>
 #include <time.h>
 #include <errno.h>
 #include <assert.h>
@@ -32,14 +34,17 @@
 #include <GL/gl.h>
 
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/dri3.h>
 #include <xcb/xproto.h>
 #include <xcb/present.h>
+#include <xcb/xfixes.h>
 
 #include <xf86drm.h>
 
 #include "x11-platform.h"
 #include "x11-timeline.h"
+#include "x11-trace.h"
 #include "glvnd_list.h"
 #include "dma-buf.h"
 
@@ -51,27 +56,129 @@
 #define PRESENT_WINDOW_DESTROYED_FLAG (1 << 0)
 
 /**
- * The maximum number of color buffers to allocate for a window.
+ * The number of entries in X11Window::present_ring.
+ *
+ * This should be more than the maximum number of buffers that can be in use
+ * at once, so that we can usually find a buffer with a single lookup.
+ */
+#define PRESENT_RING_SIZE 16
+
+/**
+ * Once a window has been resized, we round the size of new color buffers up
+ * to a multiple of this, so that a small resize can reuse the existing
+ * buffers instead of allocating new ones.
+ */
+#define RESIZE_BUCKET_SIZE 128
+
+/**
+ * The maximum number of entries in an X11ModifierCache.
+ */
+#define MODIFIER_CACHE_SIZE 32
+
+/**
+ * The number of recent frames to keep in X11FrameStats::frames. This must be
+ * a power of two.
+ */
+#define FRAME_STATS_RING_SIZE 64
+
+/**
+ * The environment variable to override the EGL_X11_QUEUE_MODE_NVX attribute.
+ */
+static const char *QUEUE_MODE_ENV = "__NV_X11_EGL_QUEUE_MODE";
+
+/**
+ * The environment variable to set the most linear buffers that a PRIME window
+ * can grow to.
+ */
+static const char *MAX_PRIME_BUFFERS_ENV = "__NV_X11_EGL_MAX_PRIME_BUFFERS";
+
+/**
+ * The environment variable to periodically write each window's frame
+ * statistics to stderr. If this is set to N, then we'll log the stats every
+ * N frames.
+ */
+static const char *FRAME_STATS_ENV = "__NV_X11_EGL_FRAME_STATS";
+
+/**
+ * The default for __NV_X11_EGL_MAX_PRIME_BUFFERS.
+ */
+static const int DEFAULT_PRIME_BUFFER_CAP = 4;
+
+/**
+ * If eglSwapBuffers has to wait for a linear buffer this many frames in a
+ * row, then we'll allocate another one, up to the cap.
+ */
+static const int PRIME_BUFFER_GROW_WAITS = 3;
+
+/**
+ * If a color buffer or PRIME buffer hasn't been presented in this many
+ * frames, then eglSwapBuffers will free it.
+ */
+static const uint64_t BUFFER_IDLE_FRAMES = 300;
+
+/**
+ * If a color buffer or PRIME buffer hasn't been presented in this long, then
+ * eglSwapBuffers will free it, even if the window hasn't gone through
+ * BUFFER_IDLE_FRAMES frames since then.
+ */
+static const uint64_t BUFFER_IDLE_NS = 5000000000ULL;
+
+/**
+ * Limits on the swapchain for a window, as selected by the
+ * EGL_X11_QUEUE_MODE_NVX attribute.
  */
-static const int MAX_COLOR_BUFFERS = 4;
+typedef struct
+{
+    /**
+     * The maximum number of color buffers to allocate for a window.
+     */
+    int max_color_buffers;
+
+    /**
+     * The maximum number of linear buffers for PRIME presentation.
+     */
+    int max_prime_buffers;
+
+    /**
+     * The maximum number of outstanding PresentPixmap requests that we can
+     * have before we wait for one to complete in eglSwapBuffers.
+     */
+    uint32_t max_pending_frames;
+} X11QueueParams;
+
+static const X11QueueParams QUEUE_PARAMS_DEFAULT = { 4, 2, 1 };
 
 /**
- * The maximum number of linear buffers for PRIME presentation.
+ * With zero pending frames, eglSwapBuffers waits for the previous frame to
+ * complete before it sends the next one, so we only ever need two buffers.
  */
-static const int MAX_PRIME_BUFFERS = 2;
+static const X11QueueParams QUEUE_PARAMS_LOW_LATENCY = { 2, 2, 0 };
 
 /**
- * The maximum number of outstanding PresentPixmap requests that we can have
- * before we wait for one to complete in eglSwapBuffers.
+ * With four pending frames, we need enough buffers to cover the queued
+ * frames, plus the one that's currently displayed and the one that we're
+ * rendering to.
  */
-static const uint32_t MAX_PENDING_FRAMES = 1;
+static const X11QueueParams QUEUE_PARAMS_THROUGHPUT = { 6, 6, 4 };
 
 /**
  * How long to wait for a buffer release before we stop to check for window
- * events.
+ * events, if we can't wait for the buffer and the X connection at the same
+ * time.
  */
 static const int RELEASE_WAIT_TIMEOUT = 100;
 
+/**
+ * How long to wait for a buffer release when we're also watching the X
+ * connection.
+ *
+ * Normally, we'll wake up as soon as a buffer frees up or a Present event
+ * arrives. But, if another thread reads from the socket first, then XCB will
+ * queue our event without waking us up, so we still need a timeout to catch
+ * that case.
+ */
+static const int CONNECTION_WAIT_TIMEOUT = 1000;
+
 /**
  * An enum to keep track of whether it's safe to reuse a buffer.
  */
@@ -93,8 +200,125 @@ typedef enum
      * waited for it to actually be free yet.
      */
     BUFFER_STATUS_IDLE_NOTIFIED,
+
+    /**
+     * The buffer has been handed off to the presentation thread, but the
+     * PresentPixmap request hasn't been sent yet.
+     */
+    BUFFER_STATUS_QUEUED,
 } X11BufferStatus;
 
+/**
+ * Timing data for one PresentPixmap request.
+ */
+typedef struct
+{
+    /**
+     * The serial number of the PresentPixmap request, or zero if this entry
+     * is unused.
+     */
+    uint32_t serial;
+
+    /**
+     * The value of X11Window::last_complete_msc when we sent the request.
+     */
+    uint64_t send_msc;
+
+    /**
+     * The CLOCK_MONOTONIC time, in microseconds, when we sent the request.
+     */
+    uint64_t send_ust;
+
+    /**
+     * The target MSC that we sent with the request, or zero if it was an
+     * asynchronous present.
+     */
+    uint64_t target_msc;
+
+    /**
+     * The MSC and UST values from the PresentCompleteNotify event.
+     */
+    uint64_t complete_msc;
+    uint64_t complete_ust;
+
+    /**
+     * The mode from the PresentCompleteNotify event.
+     */
+    uint8_t mode;
+
+    EGLBoolean completed;
+} X11FrameRecord;
+
+/**
+ * Per-window counters for diagnosing where eglSwapBuffers spends its time.
+ *
+ * These are protected by X11Window::mutex, and can be queried with
+ * eglQuerySurface using the EGL_X11_STATS_*_NVX attributes.
+ */
+typedef struct
+{
+    /**
+     * Time spent in GetFreeBuffer, waiting for Present events, and in
+     * SyncRendering, in nanoseconds.
+     *
+     * Note that GetFreeBuffer can also wait for Present events, so the
+     * first two overlap.
+     */
+    uint64_t buffer_wait_ns;
+    uint64_t event_wait_ns;
+    uint64_t sync_ns;
+
+    /**
+     * The number of color buffers and PRIME buffers that we've allocated.
+     */
+    uint32_t buffers_allocated;
+
+    /**
+     * The number of idle buffers that TrimIdleBuffers has freed.
+     */
+    uint32_t buffers_trimmed;
+
+    /**
+     * The number of times that we reallocated the window's buffers because
+     * of a resize or because of a format modifier change.
+     */
+    uint32_t resize_reallocs;
+    uint32_t modifier_reallocs;
+
+    /**
+     * Counts of each mode in the PresentCompleteNotify events.
+     */
+    uint32_t presents_flip;
+    uint32_t presents_copy;
+    uint32_t presents_suboptimal_copy;
+    uint32_t presents_skip;
+
+    /**
+     * The MSC and UST deltas between SendPresentPixmap and
+     * PresentCompleteNotify for the most recent frame to complete.
+     */
+    uint64_t last_msc_delta;
+    uint64_t last_ust_delta;
+
+    /**
+     * Recent frames, indexed by serial number modulo FRAME_STATS_RING_SIZE.
+     */
+    X11FrameRecord frames[FRAME_STATS_RING_SIZE];
+
+    /**
+     * The total time spent in each recent eglSwapBuffers call, in
+     * microseconds, indexed by X11Window::frame_count modulo
+     * FRAME_STATS_RING_SIZE.
+     */
+    uint32_t swap_us[FRAME_STATS_RING_SIZE];
+
+    /**
+     * How often to log the stats, from __NV_X11_EGL_FRAME_STATS, or zero to
+     * disable logging.
+     */
+    unsigned int log_interval;
+} X11FrameStats;
+
 /**
  * Data for each color buffer that we allocate for a window.
  *
@@ -113,6 +337,15 @@ typedef struct
      */
     EGLPlatformColorBufferNVX buffer;
 
+    /**
+     * The size of the color buffer.
+     *
+     * The GBM buffer object might be larger than this, in which case we only
+     * use the top-left corner of it.
+     */
+    uint32_t width;
+    uint32_t height;
+
     /**
      * Whether this buffer is still in use by the server.
      */
@@ -123,12 +356,42 @@ typedef struct
      */
     xcb_pixmap_t xpix;
 
+    /**
+     * True if we haven't found out yet whether the PixmapFromBuffers request
+     * for \c xpix succeeded.
+     *
+     * We don't wait for the reply when we create the pixmap. Instead, we
+     * check for it without blocking whenever we look for window events. Until
+     * we know that the pixmap is valid, we send any requests that use it as
+     * checked requests and discard the replies, so that an error doesn't get
+     * reported to the application.
+     */
+    EGLBoolean pixmap_pending;
+    xcb_void_cookie_t pixmap_cookie;
+
     /**
      * The serial number of the last PresentPixmap request that used this
      * buffer.
      */
     uint32_t last_present_serial;
 
+    /**
+     * The value of X11Window::frame_count from the last eglSwapBuffers call
+     * that rendered to this buffer, or zero if the buffer's contents are
+     * undefined.
+     *
+     * This is used to calculate the buffer age for EGL_EXT_buffer_age.
+     */
+    uint64_t last_frame;
+
+    /**
+     * The value of X11Window::frame_count and the CLOCK_MONOTONIC time when
+     * we last presented this buffer. TrimIdleBuffers uses these to find
+     * buffers that we don't need anymore.
+     */
+    uint64_t last_used_frame;
+    uint64_t last_used_ns;
+
     /**
      * A file descriptor for the dma-buf.
      *
@@ -148,9 +411,76 @@ typedef struct
      */
     X11Timeline timeline;
 
+    /**
+     * An eventfd for waiting on the timeline's release point with
+     * drmSyncobjEventfd, or -1 if we haven't needed one yet.
+     *
+     * The eventfd stays registered with the kernel until the point that it
+     * was armed for becomes available, so we keep it for the life of the
+     * buffer and only re-arm it once we're waiting for a different point.
+     */
+    int release_eventfd;
+    EGLBoolean release_armed;
+    uint32_t release_armed_handle;
+    uint64_t release_armed_point;
+
+    /**
+     * True if the window's buffers were reallocated while this buffer was
+     * still waiting in the presentation thread's queue.
+     *
+     * In that case, the buffer is moved to X11Window::async::retired_buffers,
+     * and the presentation thread frees it after it's been presented.
+     */
+    EGLBoolean retired;
+
     struct glvnd_list entry;
 } X11ColorBuffer;
 
+/**
+ * A frame that's waiting for the presentation thread to send it.
+ */
+typedef struct
+{
+    /**
+     * The shared buffer to present.
+     */
+    X11ColorBuffer *buffer;
+
+    /**
+     * The PresentOption flags to send.
+     */
+    uint32_t options;
+
+    /**
+     * The time from eglPresentationTimeANDROID, in microseconds, or zero.
+     */
+    uint64_t target_ust;
+
+    /**
+     * A copy of the damage rectangles from eglSwapBuffersWithDamage, or NULL.
+     */
+    EGLint *rects;
+    EGLint n_rects;
+
+    /**
+     * A fence that the presentation thread has to wait for before it sends
+     * the frame, or -1.
+     *
+     * This is used for front-buffer rendering when we can't hand the fence to
+     * the server.
+     */
+    int syncfd;
+
+    /**
+     * True if the presentation thread has to signal the buffer's next
+     * timeline point after the fence, because the fence couldn't be attached
+     * to the timeline directly.
+     */
+    EGLBoolean signal_acquire;
+
+    struct glvnd_list entry;
+} X11QueuedFrame;
+
 /**
  * Data that we need to keep track of for an X window.
  */
@@ -192,12 +522,30 @@ typedef struct
      */
     EGLBoolean use_explicit_sync;
 
+    /**
+     * If true, then we can use drmSyncobjEventfd to wait for a release point
+     * and the X connection at the same time.
+     *
+     * This is cleared if drmSyncobjEventfd ever fails, which happens with
+     * older kernels.
+     */
+    EGLBoolean use_syncobj_eventfd;
+
     /**
      * The current size of the window.
      */
     EGLint width;
     EGLint height;
 
+    /**
+     * The size to use when allocating new color buffers.
+     *
+     * This starts out the same as the window size, but after the window is
+     * resized, it's rounded up to RESIZE_BUCKET_SIZE.
+     */
+    uint32_t alloc_width;
+    uint32_t alloc_height;
+
     /**
      * The format modifiers that we're using for this window.
      */
@@ -215,6 +563,16 @@ typedef struct
      */
     EGLBoolean prime;
 
+    /**
+     * True if the window was created with EGL_RENDER_BUFFER set to
+     * EGL_SINGLE_BUFFER.
+     *
+     * A single-buffered window only has one color buffer, which is both
+     * current_front and current_back. The driver renders to it directly, and
+     * WindowDamageCallback presents it after each flush.
+     */
+    EGLBoolean single_buffered;
+
     /**
      * The pending width and height is set in response to a window resize.
      *
@@ -267,6 +625,11 @@ typedef struct
 
     /**
      * The current swap interval, as set by eglSwapInterval.
+     *
+     * A negative value means adaptive vsync, as in GLX_EXT_swap_control_tear:
+     * frames are synced to every -swap_interval refresh cycles, but if a frame
+     * is late, then we present it immediately instead of waiting for the
+     * next vblank.
      */
     EGLint swap_interval;
 
@@ -275,6 +638,27 @@ typedef struct
      */
     const X11DriverFormat *format;
 
+    /**
+     * The swapchain limits for this window.
+     */
+    const X11QueueParams *queue;
+
+    /**
+     * The current limit on the number of PRIME buffers.
+     *
+     * This starts at X11QueueParams::max_prime_buffers, and grows up to
+     * \c max_prime_buffers_cap if eglSwapBuffers keeps having to wait for a
+     * linear buffer to free up.
+     */
+    int max_prime_buffers;
+    int max_prime_buffers_cap;
+
+    /**
+     * The number of consecutive frames where we had to wait for a PRIME
+     * buffer.
+     */
+    int prime_buffer_waits;
+
     uint32_t present_event_id;
     uint32_t present_event_stamp;
     xcb_special_event_t *present_event;
@@ -284,6 +668,21 @@ typedef struct
      */
     uint32_t last_present_serial;
 
+    /**
+     * A table of recently presented buffers, indexed by the PresentPixmap
+     * serial number modulo PRESENT_RING_SIZE.
+     *
+     * This lets HandlePresentEvent find the buffer for a PresentIdleNotify
+     * event without searching the buffer list. If an entry gets overwritten
+     * before the buffer is released, then we fall back to searching the
+     * list.
+     */
+    struct
+    {
+        uint32_t serial;
+        X11ColorBuffer *buffer;
+    } present_ring[PRESENT_RING_SIZE];
+
     /**
      * The serial number of the last PresentCompleteNotify event that we
      * recieved.
@@ -295,56 +694,357 @@ typedef struct
      */
     uint64_t last_complete_msc;
 
+    /**
+     * The UST value, in microseconds, from the last PresentCompleteNotify
+     * event that we received.
+     */
+    uint64_t last_complete_ust;
+
+    /**
+     * A running estimate of the refresh period in microseconds, based on the
+     * UST and MSC values in PresentCompleteNotify events. This is zero until
+     * we've seen two events with different MSC values.
+     */
+    uint64_t msc_period_us;
+
+    /**
+     * The presentation time for the next eglSwapBuffers call, in microseconds,
+     * from eglPresentationTimeANDROID. This is zero if the app hasn't set one.
+     */
+    uint64_t next_present_ust;
+
+    /**
+     * The frame that EGL_X11_FEEDBACK_SERIAL_NVX most recently returned. The
+     * other EGL_X11_FEEDBACK_*_NVX attributes report the values from this.
+     */
+    X11FrameRecord feedback;
+
+    /**
+     * An XFixes region that we use for the update region in PresentPixmap.
+     *
+     * The server makes its own copy of the update region when it processes
+     * the PresentPixmap request, so we can create this once and then reuse it
+     * for every frame with XFixesSetRegion.
+     *
+     * This is zero until the first time that we need it.
+     */
+    xcb_xfixes_region_t damage_region;
+
+    /**
+     * A counter for the number of frames that we've presented, which is used
+     * to calculate buffer ages.
+     */
+    uint64_t frame_count;
+
+    /**
+     * Timing and fallback counters for this window.
+     */
+    X11FrameStats stats;
+
+    /**
+     * True if the application has queried EGL_BUFFER_AGE_EXT since the last
+     * eglSwapBuffers call.
+     *
+     * EGL_KHR_partial_update requires this before eglSetDamageRegionKHR.
+     */
+    EGLBoolean buffer_age_queried;
+
+    /**
+     * True if the application has called eglSetDamageRegionKHR since the
+     * last eglSwapBuffers call.
+     */
+    EGLBoolean damage_region_set;
+
     /**
      * Set to true if the native window was destroyed.
      *
      * This requires a fairly recent version of the X server.
      */
     EGLBoolean native_destroyed;
-} X11Window;
 
-static void FreeColorBuffer(X11DisplayInstance *inst, X11ColorBuffer *buffer)
-{
-    if (buffer != NULL)
+    /**
+     * Set to true if a PixmapFromBuffers request failed, so that the next
+     * eglSwapBuffers call can report it.
+     */
+    EGLBoolean pixmap_error;
+
+    /**
+     * True if a thread is currently blocked in xcb_wait_for_special_event for
+     * this window.
+     *
+     * Both eglSwapBuffers and the presentation thread can wait for Present
+     * events on the same window, but XCB doesn't give us any way to wake up
+     * a thread that's waiting on a special event queue. So, only one thread
+     * at a time reads from the queue, and any other thread waits on
+     * event_cond until that thread has handled the event.
+     */
+    EGLBoolean event_reader;
+    pthread_cond_t event_cond;
+
+    /**
+     * State for the presentation thread, if it's enabled.
+     *
+     * Everything in here is protected by X11Window::mutex, except for entry
+     * and scheduled, which are protected by X11Presenter::mutex.
+     */
+    struct
     {
-        if (buffer->gbo != NULL)
-        {
-            gbm_bo_destroy(buffer->gbo);
-        }
-        if (buffer->buffer != NULL)
-        {
-            inst->platform->priv->egl.PlatformFreeColorBufferNVX(
-                    inst->internal_display->edpy, buffer->buffer);
-        }
-        if (buffer->xpix != 0)
-        {
-            if (inst->conn != NULL)
-            {
-                // TODO: Is it safe to call into xcb if this happens during teardown?
-                xcb_free_pixmap(inst->conn, buffer->xpix);
-            }
-        }
-        eplX11TimelineDestroy(inst, &buffer->timeline);
-        if (buffer->fd >= 0)
-        {
-            close(buffer->fd);
-        }
-        free(buffer);
-    }
-}
+        /**
+         * A pointer back to the EplSurface that owns this window.
+         */
+        EplSurface *surf;
 
-/**
+        /**
+         * The frames that are waiting to be sent, in order.
+         *
+         * This is a list of X11QueuedFrame structs.
+         */
+        struct glvnd_list frames;
+
+        /**
+         * Buffers that were removed from the window while they were still
+         * queued.
+         */
+        struct glvnd_list retired_buffers;
+
+        /**
+         * Signaled whenever the presentation thread sends or drops a frame.
+         */
+        pthread_cond_t cond;
+
+        /**
+         * True if this window is in the presentation thread's list.
+         */
+        EGLBoolean scheduled;
+
+        /**
+         * Set by CancelAsyncPresent to tell the presentation thread to stop
+         * waiting and drop the window's frames.
+         */
+        EGLBoolean cancelled;
+
+        struct glvnd_list entry;
+    } async;
+} X11Window;
+
+/**
+ * The result of a FindSupportedModifiers call for one window and format.
+ */
+typedef struct
+{
+    xcb_window_t xwin;
+    uint32_t fourcc;
+
+    /**
+     * The intersection of the server's and the driver's modifier lists.
+     */
+    uint64_t *modifiers;
+    int num_modifiers;
+    EGLBoolean prime;
+
+    struct glvnd_list entry;
+} X11ModifierCacheEntry;
+
+struct _X11ModifierCache
+{
+    pthread_mutex_t mutex;
+
+    /**
+     * The cached entries, with the most recently used entry first.
+     */
+    struct glvnd_list entries;
+    int num_entries;
+};
+
+struct _X11Presenter
+{
+    pthread_t thread;
+
+    /**
+     * A mutex to protect the window list and the other fields below.
+     *
+     * If a thread needs to lock both this and X11Window::mutex, then it must
+     * lock X11Window::mutex first.
+     */
+    pthread_mutex_t mutex;
+
+    /**
+     * Signaled when a window is added to the list, or to shut down the
+     * thread.
+     */
+    pthread_cond_t cond;
+
+    /**
+     * Signaled when the thread finishes with a window.
+     */
+    pthread_cond_t idle_cond;
+
+    /**
+     * The windows that have frames waiting to be sent.
+     */
+    struct glvnd_list windows;
+
+    /**
+     * The window that the thread is currently working on, if any.
+     */
+    X11Window *current;
+
+    /**
+     * Deferred X requests that are waiting on a fence, as a list of
+     * X11PresenterJob structs.
+     */
+    struct glvnd_list jobs;
+
+    /**
+     * The parameter of the job that the thread is currently running, if any.
+     */
+    void *current_job;
+
+    /**
+     * An eventfd that CancelAsyncPresent writes to, so that the thread stops
+     * waiting for Present events on a window that's being destroyed.
+     */
+    int wake_fd;
+
+    EGLBoolean shutdown;
+};
+
+/**
+ * A function to call from the presentation thread after a fence signals.
+ */
+typedef struct
+{
+    int syncfd;
+    X11PresenterJobFunc func;
+    void *param;
+    struct glvnd_list entry;
+} X11PresenterJob;
+
+static EGLBoolean QueueAsyncPresent(EplSurface *surf, X11ColorBuffer *buffer,
+        uint32_t options, uint64_t targetUST, const EGLint *rects, EGLint n_rects, int syncfd);
+static int PollWithConnection(EplDisplay *pdpy, EplSurface *surf,
+        struct pollfd *fds, int count, int timeout_ms, int *ret_err);
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+static uint64_t GetTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void FreeColorBuffer(X11DisplayInstance *inst, X11ColorBuffer *buffer)
+{
+    if (buffer != NULL)
+    {
+        if (buffer->gbo != NULL)
+        {
+            gbm_bo_destroy(buffer->gbo);
+        }
+        if (buffer->buffer != NULL)
+        {
+            inst->platform->priv->egl.PlatformFreeColorBufferNVX(
+                    inst->internal_display->edpy, buffer->buffer);
+        }
+        if (buffer->xpix != 0)
+        {
+            if (inst->conn != NULL)
+            {
+                // TODO: Is it safe to call into xcb if this happens during teardown?
+                if (buffer->pixmap_pending)
+                {
+                    // If the pixmap is invalid, then don't let the error from
+                    // FreePixmap go to the application.
+                    xcb_discard_reply(inst->conn, buffer->pixmap_cookie.sequence);
+                    xcb_discard_reply(inst->conn,
+                            xcb_free_pixmap_checked(inst->conn, buffer->xpix).sequence);
+                }
+                else
+                {
+                    xcb_free_pixmap(inst->conn, buffer->xpix);
+                }
+            }
+        }
+        eplX11TimelineDestroy(inst, &buffer->timeline);
+        if (buffer->fd >= 0)
+        {
+            close(buffer->fd);
+        }
+        if (buffer->release_eventfd >= 0)
+        {
+            close(buffer->release_eventfd);
+        }
+        free(buffer);
+    }
+}
+
+/**
+ * Rounds a window dimension up to a multiple of RESIZE_BUCKET_SIZE.
+ */
+static uint32_t GetBucketSize(uint32_t size)
+{
+    return (size + RESIZE_BUCKET_SIZE - 1) & ~((uint32_t) RESIZE_BUCKET_SIZE - 1);
+}
+
+/**
+ * Imports a color buffer's GBM buffer object into the driver.
+ *
+ * \param inst The display instance.
+ * \param buffer The buffer. The gbo field must already be set.
+ * \param width The width of the color buffer, which may be smaller than the
+ *      buffer object.
+ * \param height The height of the color buffer, which may be smaller than
+ *      the buffer object.
+ */
+static EGLBoolean ImportColorBuffer(X11DisplayInstance *inst, X11ColorBuffer *buffer,
+        uint32_t width, uint32_t height)
+{
+    int fd;
+
+    // eplX11InitDriverFormats should have left out any modifiers that need
+    // more planes than the driver can import.
+    if (gbm_bo_get_plane_count(buffer->gbo) > X11_MAX_IMPORT_PLANES)
+    {
+        return EGL_FALSE;
+    }
+
+    fd = gbm_bo_get_fd(buffer->gbo);
+    if (fd < 0)
+    {
+        return EGL_FALSE;
+    }
+
+    buffer->buffer = inst->platform->priv->egl.PlatformImportColorBufferNVX(inst->internal_display->edpy,
+            fd, width, height, gbm_bo_get_format(buffer->gbo),
+            gbm_bo_get_stride(buffer->gbo),
+            gbm_bo_get_offset(buffer->gbo, 0),
+            gbm_bo_get_modifier(buffer->gbo));
+    close(fd);
+
+    buffer->width = width;
+    buffer->height = height;
+    return (buffer->buffer != NULL);
+}
+
+/**
  * Allocates a color buffer in the driver. This does *not* create a shared
  * pixmap from the buffer.
+ *
+ * \param alloc_width The width to allocate, which must be at least \p width.
+ * \param alloc_height The height to allocate, which must be at least
+ *      \p height.
  */
 static X11ColorBuffer *AllocOneColorBuffer(X11DisplayInstance *inst,
         const EplFormatInfo *fmt, uint32_t width, uint32_t height,
+        uint32_t alloc_width, uint32_t alloc_height,
         const uint64_t *modifiers, int num_modifiers,
         EGLBoolean scanout)
 {
-    int fd = -1;
     uint32_t flags = 0;
     X11ColorBuffer *buffer = NULL;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     assert(num_modifiers > 0);
 
@@ -361,37 +1061,81 @@ static X11ColorBuffer *AllocOneColorBuffer(X11DisplayInstance *inst,
 
     glvnd_list_init(&buffer->entry);
     buffer->fd = -1;
+    buffer->release_eventfd = -1;
 
+    assert(alloc_width >= width && alloc_height >= height);
     buffer->gbo = gbm_bo_create_with_modifiers2(inst->gbmdev,
-            width, height, fmt->fourcc, modifiers, num_modifiers, flags);
+            alloc_width, alloc_height, fmt->fourcc, modifiers, num_modifiers, flags);
 
-    if (buffer->gbo == NULL)
+    if (buffer->gbo == NULL || !ImportColorBuffer(inst, buffer, width, height))
     {
-        goto done;
+        FreeColorBuffer(inst, buffer);
+        return NULL;
     }
 
-    fd = gbm_bo_get_fd(buffer->gbo);
-    if (fd < 0)
+    return buffer;
+}
+
+/**
+ * Creates a new color buffer that shares the memory of an existing one,
+ * possibly with a smaller size.
+ *
+ * This lets us resize a window without allocating new memory, as long as
+ * the existing buffer is big enough.
+ */
+static X11ColorBuffer *ImportSharedColorBuffer(X11DisplayInstance *inst,
+        struct gbm_bo *src, uint32_t width, uint32_t height, EGLBoolean scanout)
+{
+    struct gbm_import_fd_modifier_data gimport;
+    X11ColorBuffer *buffer;
+    int numPlanes = gbm_bo_get_plane_count(src);
+    int i;
+
+    if (numPlanes <= 0 || numPlanes > GBM_MAX_PLANES)
     {
-        goto done;
+        return NULL;
     }
 
-    buffer->buffer = inst->platform->priv->egl.PlatformImportColorBufferNVX(inst->internal_display->edpy,
-            fd, width, height, gbm_bo_get_format(buffer->gbo),
-            gbm_bo_get_stride(buffer->gbo),
-            gbm_bo_get_offset(buffer->gbo, 0),
-            gbm_bo_get_modifier(buffer->gbo));
-    if (buffer->buffer == NULL)
+    buffer = calloc(1, sizeof(X11ColorBuffer));
+    if (buffer == NULL)
     {
-        goto done;
+        return NULL;
     }
 
-done:
-    if (fd >= 0)
+    glvnd_list_init(&buffer->entry);
+    buffer->fd = -1;
+    buffer->release_eventfd = -1;
+
+    memset(&gimport, 0, sizeof(gimport));
+    gimport.width = gbm_bo_get_width(src);
+    gimport.height = gbm_bo_get_height(src);
+    gimport.format = gbm_bo_get_format(src);
+    gimport.modifier = gbm_bo_get_modifier(src);
+    for (i=0; i<numPlanes; i++)
     {
-        close(fd);
+        gimport.fds[i] = gbm_bo_get_fd_for_plane(src, i);
+        if (gimport.fds[i] < 0)
+        {
+            break;
+        }
+        gimport.strides[i] = gbm_bo_get_stride_for_plane(src, i);
+        gimport.offsets[i] = gbm_bo_get_offset(src, i);
+        gimport.num_fds++;
     }
-    if (buffer->buffer == NULL)
+
+    // Note that gbm_bo_import does not take ownership of the file
+    // descriptors.
+    if (gimport.num_fds == numPlanes)
+    {
+        buffer->gbo = gbm_bo_import(inst->gbmdev, GBM_BO_IMPORT_FD_MODIFIER, &gimport,
+                scanout ? GBM_BO_USE_SCANOUT : 0);
+    }
+    for (i=0; i<gimport.num_fds; i++)
+    {
+        close(gimport.fds[i]);
+    }
+
+    if (buffer->gbo == NULL || !ImportColorBuffer(inst, buffer, width, height))
     {
         FreeColorBuffer(inst, buffer);
         return NULL;
@@ -411,6 +1155,7 @@ static X11ColorBuffer *AllocatePrimeBuffer(X11DisplayInstance *inst,
     int stride = 0;
     int offset = 0;
     EGLBoolean success = EGL_FALSE;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     buffer = calloc(1, sizeof(X11ColorBuffer));
     if (buffer == NULL)
@@ -420,6 +1165,7 @@ static X11ColorBuffer *AllocatePrimeBuffer(X11DisplayInstance *inst,
 
     glvnd_list_init(&buffer->entry);
     buffer->fd = -1;
+    buffer->release_eventfd = -1;
 
     buffer->buffer = inst->platform->priv->egl.PlatformAllocColorBufferNVX(inst->internal_display->edpy,
                 width, height, fourcc, DRM_FORMAT_MOD_LINEAR, EGL_TRUE);
@@ -452,6 +1198,8 @@ static X11ColorBuffer *AllocatePrimeBuffer(X11DisplayInstance *inst,
         goto done;
     }
 
+    buffer->width = width;
+    buffer->height = height;
     success = EGL_TRUE;
 
 done:
@@ -464,79 +1212,295 @@ done:
     return buffer;
 }
 
-static void FreeWindowBuffers(EplSurface *surf)
+/**
+ * Removes any references to a buffer from X11Window::present_ring.
+ *
+ * This must be called before freeing a buffer that might have been presented.
+ */
+static void ForgetPresentedBuffer(X11Window *pwin, X11ColorBuffer *buffer)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
+    int i;
 
-    while (!glvnd_list_is_empty(&pwin->color_buffers))
+    for (i=0; i<PRESENT_RING_SIZE; i++)
     {
-        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->color_buffers, X11ColorBuffer, entry);
-        glvnd_list_del(&buffer->entry);
-        FreeColorBuffer(pwin->inst, buffer);
+        if (pwin->present_ring[i].buffer == buffer)
+        {
+            pwin->present_ring[i].buffer = NULL;
+        }
     }
-    while (!glvnd_list_is_empty(&pwin->prime_buffers))
+}
+
+/**
+ * Frees a buffer that's being removed from a window.
+ *
+ * If the buffer is still waiting in the presentation thread's queue, then
+ * this moves it to the retired list instead, and the presentation thread
+ * will free it once it's been sent.
+ */
+static void RetireOrFreeBuffer(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    glvnd_list_del(&buffer->entry);
+    ForgetPresentedBuffer(pwin, buffer);
+    if (buffer->status == BUFFER_STATUS_QUEUED)
+    {
+        buffer->retired = EGL_TRUE;
+        glvnd_list_append(&buffer->entry, &pwin->async.retired_buffers);
+    }
+    else
     {
-        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->prime_buffers, X11ColorBuffer, entry);
-        glvnd_list_del(&buffer->entry);
         FreeColorBuffer(pwin->inst, buffer);
     }
-    pwin->current_front = NULL;
-    pwin->current_back = NULL;
-    pwin->current_prime = NULL;
 }
 
-static EGLBoolean AllocWindowBuffers(EplSurface *surf,
-        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime)
+/**
+ * Frees any buffers that haven't been presented recently.
+ *
+ * GetFreeBuffer will allocate more buffers as needed, up to the limits in
+ * X11QueueParams. This keeps a mostly-idle window from holding onto all of
+ * them forever.
+ *
+ * This never frees the current front, back, or PRIME buffer, or any
+ * buffer that the server is still using, and it always leaves at least the
+ * buffers that we'd need for a single frame.
+ */
+static void TrimIdleBuffers(EplSurface *surf)
 {
     X11Window *pwin = (X11Window *) surf->priv;
-    uint64_t modifier;
-    X11ColorBuffer *front = NULL;
-    X11ColorBuffer *back = NULL;
-    X11ColorBuffer *shared = NULL;
-    EGLPlatformColorBufferNVX sharedBuf = NULL;
-    EGLBoolean success = EGL_TRUE;
+    struct glvnd_list *list = (pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers);
+    int minBuffers = (pwin->prime ? 1 : 2);
+    X11ColorBuffer *buffer, *tmpBuf;
+    uint64_t now = GetTimeNs();
+    int count = 0;
 
-    front = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
-            modifiers, num_modifiers, !prime);
-    if (front == NULL)
+    glvnd_list_for_each_entry(buffer, list, entry)
     {
-        goto done;
+        count++;
     }
 
-    // We let the driver pick the modifier when we allocate the front buffer,
-    // and then we'll just re-use that same modifier for everything after that.
-    modifier = gbm_bo_get_modifier(front->gbo);
-
-    back = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
-            &modifier, 1, !prime);
-    if (back == NULL)
+    glvnd_list_for_each_entry_safe(buffer, tmpBuf, list, entry)
     {
-        goto done;
-    }
+        if (count <= minBuffers)
+        {
+            break;
+        }
+        if (buffer == pwin->current_front || buffer == pwin->current_back
+                || buffer == pwin->current_prime)
+        {
+            continue;
+        }
+        if (buffer->status != BUFFER_STATUS_IDLE
+                && buffer->status != BUFFER_STATUS_IDLE_NOTIFIED)
+        {
+            continue;
+        }
 
-    if (prime)
-    {
-        /*
-         * For PRIME, we need to allocate one linear buffer so that we can
-         * attach it as the blit target.
-         */
-        shared = AllocatePrimeBuffer(pwin->inst, pwin->format->fmt->fourcc, pwin->pending_width, pwin->pending_height);
-        if (shared == NULL)
+        if (buffer->last_used_ns == 0)
         {
-            goto done;
+            // We haven't presented this buffer yet, so start counting from
+            // now.
+            buffer->last_used_frame = pwin->frame_count;
+            buffer->last_used_ns = now;
+            continue;
+        }
+
+        if (pwin->frame_count - buffer->last_used_frame >= BUFFER_IDLE_FRAMES
+                || now - buffer->last_used_ns >= BUFFER_IDLE_NS)
+        {
+            RetireOrFreeBuffer(pwin, buffer);
+            pwin->stats.buffers_trimmed++;
+            count--;
         }
-        sharedBuf = shared->buffer;
     }
 
-    if (surf->internal_surface != EGL_NO_SURFACE)
+    if (pwin->prime && count < pwin->max_prime_buffers)
     {
-        EGLAttrib buffers[] =
+        // If we'd grown the limit on PRIME buffers, then start over from the
+        // default. GetFreeBuffer will grow it again if it has to.
+        pwin->max_prime_buffers = count;
+        if (pwin->max_prime_buffers < pwin->queue->max_prime_buffers)
         {
-            GL_FRONT, (EGLAttrib) front->buffer,
-            GL_BACK,  (EGLAttrib) back->buffer,
-            EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX, (EGLAttrib) sharedBuf,
+            pwin->max_prime_buffers = pwin->queue->max_prime_buffers;
+        }
+        pwin->prime_buffer_waits = 0;
+    }
+}
+
+static void FreeWindowBuffers(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    while (!glvnd_list_is_empty(&pwin->color_buffers))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->color_buffers, X11ColorBuffer, entry);
+        RetireOrFreeBuffer(pwin, buffer);
+    }
+    while (!glvnd_list_is_empty(&pwin->prime_buffers))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->prime_buffers, X11ColorBuffer, entry);
+        RetireOrFreeBuffer(pwin, buffer);
+    }
+    pwin->current_front = NULL;
+    pwin->current_back = NULL;
+    pwin->current_prime = NULL;
+}
+
+/**
+ * Looks for an idle color buffer that's big enough to hold a window's new
+ * size, and if there is one, creates a new buffer that uses the same memory.
+ *
+ * \param pwin The window.
+ * \param width The new width.
+ * \param height The new height.
+ * \param modifiers The allowed format modifiers.
+ * \param num_modifiers The number of elements in \p modifiers.
+ * \param prime The new value of X11Window::prime.
+ * \param[in,out] src Returns the buffer that we reused. If this is not NULL
+ *      on entry, then that buffer is skipped.
+ * \return A new X11ColorBuffer, or NULL if there's no suitable buffer.
+ */
+static X11ColorBuffer *ReuseColorBuffer(X11Window *pwin, uint32_t width, uint32_t height,
+        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime,
+        X11ColorBuffer **src)
+{
+    X11ColorBuffer *buffer;
+
+    if (prime != pwin->prime)
+    {
+        // The old buffers were allocated with different usage flags.
+        return NULL;
+    }
+
+    glvnd_list_for_each_entry(buffer, &pwin->color_buffers, entry)
+    {
+        uint32_t bufWidth = gbm_bo_get_width(buffer->gbo);
+        uint32_t bufHeight = gbm_bo_get_height(buffer->gbo);
+        uint64_t mod = gbm_bo_get_modifier(buffer->gbo);
+        int i;
+
+        if (buffer == *src || buffer->status != BUFFER_STATUS_IDLE)
+        {
+            continue;
+        }
+
+        // Don't hold on to an oversized buffer if the window shrank a lot.
+        if (bufWidth < width || bufHeight < height
+                || bufWidth > GetBucketSize(width) || bufHeight > GetBucketSize(height))
+        {
+            continue;
+        }
+
+        for (i=0; i<num_modifiers; i++)
+        {
+            if (modifiers[i] == mod)
+            {
+                X11ColorBuffer *ret = ImportSharedColorBuffer(pwin->inst, buffer->gbo,
+                        width, height, !prime);
+                if (ret != NULL)
+                {
+                    *src = buffer;
+                }
+                return ret;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static EGLBoolean AllocWindowBuffers(EplSurface *surf,
+        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t modifier;
+    X11ColorBuffer *front = NULL;
+    X11ColorBuffer *back = NULL;
+    X11ColorBuffer *shared = NULL;
+    X11ColorBuffer *reused = NULL;
+    EGLPlatformColorBufferNVX sharedBuf = NULL;
+    uint32_t allocWidth = pwin->pending_width;
+    uint32_t allocHeight = pwin->pending_height;
+    uint32_t numAllocated = 0;
+    EGLBoolean success = EGL_FALSE;
+
+    if (surf->internal_surface != EGL_NO_SURFACE)
+    {
+        /*
+         * If the window is being resized, then it's likely to get resized
+         * again soon, so leave some headroom. That way, a series of small
+         * resizes can reuse the same memory.
+         */
+        allocWidth = GetBucketSize(pwin->pending_width);
+        allocHeight = GetBucketSize(pwin->pending_height);
+    }
+
+    front = ReuseColorBuffer(pwin, pwin->pending_width, pwin->pending_height,
+            modifiers, num_modifiers, prime, &reused);
+    if (front == NULL)
+    {
+        front = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
+                allocWidth, allocHeight, modifiers, num_modifiers, !prime);
+        numAllocated++;
+    }
+    if (front == NULL)
+    {
+        goto done;
+    }
+
+    // We let the driver pick the modifier when we allocate the front buffer,
+    // and then we'll just re-use that same modifier for everything after that.
+    modifier = gbm_bo_get_modifier(front->gbo);
+
+    if (pwin->single_buffered)
+    {
+        // A single-buffered window renders directly to its one buffer.
+        back = front;
+    }
+    else
+    {
+        back = ReuseColorBuffer(pwin, pwin->pending_width, pwin->pending_height,
+                &modifier, 1, prime, &reused);
+        if (back == NULL)
+        {
+            back = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->pending_width, pwin->pending_height,
+                    allocWidth, allocHeight, &modifier, 1, !prime);
+            numAllocated++;
+        }
+        if (back == NULL)
+        {
+            goto done;
+        }
+    }
+
+    if (prime)
+    {
+        /*
+         * For PRIME, we need to allocate one linear buffer so that we can
+         * attach it as the blit target.
+         */
+        shared = AllocatePrimeBuffer(pwin->inst, pwin->format->fmt->fourcc, pwin->pending_width, pwin->pending_height);
+        if (shared == NULL)
+        {
+            goto done;
+        }
+        sharedBuf = shared->buffer;
+        numAllocated++;
+    }
+
+    if (surf->internal_surface != EGL_NO_SURFACE)
+    {
+        EGLAttrib buffers[] =
+        {
+            GL_BACK,  (EGLAttrib) back->buffer,
+            EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX, (EGLAttrib) sharedBuf,
+            GL_FRONT, (EGLAttrib) front->buffer,
             EGL_NONE
         };
+        if (pwin->single_buffered)
+        {
+            // The driver only gets a back buffer for a single-buffered
+            // surface.
+            buffers[4] = EGL_NONE;
+        }
         if (!pwin->inst->platform->priv->egl.PlatformSetColorBuffersNVX(pwin->inst->internal_display->edpy,
                 surf->internal_surface, buffers))
         {
@@ -547,7 +1511,10 @@ static EGLBoolean AllocWindowBuffers(EplSurface *surf,
     FreeWindowBuffers(surf);
 
     glvnd_list_add(&front->entry, &pwin->color_buffers);
-    glvnd_list_add(&back->entry, &pwin->color_buffers);
+    if (back != front)
+    {
+        glvnd_list_add(&back->entry, &pwin->color_buffers);
+    }
     if (shared != NULL)
     {
         glvnd_list_append(&shared->entry, &pwin->prime_buffers);
@@ -557,15 +1524,21 @@ static EGLBoolean AllocWindowBuffers(EplSurface *surf,
     pwin->current_prime = shared;
     pwin->width = pwin->pending_width;
     pwin->height = pwin->pending_height;
+    pwin->alloc_width = allocWidth;
+    pwin->alloc_height = allocHeight;
     pwin->modifier = modifier;
     pwin->prime = prime;
+    pwin->stats.buffers_allocated += numAllocated;
     success = EGL_TRUE;
 
 done:
     if (!success)
     {
+        if (back != front)
+        {
+            FreeColorBuffer(pwin->inst, back);
+        }
         FreeColorBuffer(pwin->inst, front);
-        FreeColorBuffer(pwin->inst, back);
         FreeColorBuffer(pwin->inst, shared);
     }
 
@@ -617,11 +1590,183 @@ static int GetModifierIntersection(uint64_t *mods,
     return count;
 }
 
+X11ModifierCache *eplX11ModifierCacheCreate(void)
+{
+    X11ModifierCache *cache = calloc(1, sizeof(X11ModifierCache));
+
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_init(&cache->mutex, NULL);
+    glvnd_list_init(&cache->entries);
+    return cache;
+}
+
+static void FreeModifierCacheEntry(X11ModifierCache *cache, X11ModifierCacheEntry *entry)
+{
+    glvnd_list_del(&entry->entry);
+    cache->num_entries--;
+    free(entry->modifiers);
+    free(entry);
+}
+
+void eplX11ModifierCacheDestroy(X11ModifierCache *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    while (!glvnd_list_is_empty(&cache->entries))
+    {
+        X11ModifierCacheEntry *entry = glvnd_list_first_entry(&cache->entries,
+                X11ModifierCacheEntry, entry);
+        FreeModifierCacheEntry(cache, entry);
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
+
+/**
+ * Looks up a cached result from FindSupportedModifiers.
+ *
+ * \return EGL_TRUE if there was a cached result. If there wasn't, or if we
+ *      ran out of memory, then this returns EGL_FALSE.
+ */
+static EGLBoolean LookupModifierCache(X11ModifierCache *cache,
+        xcb_window_t xwin, uint32_t fourcc,
+        uint64_t **ret_modifiers, int *ret_num_modifiers,
+        EGLBoolean *ret_prime)
+{
+    X11ModifierCacheEntry *entry;
+    EGLBoolean found = EGL_FALSE;
+
+    if (cache == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    glvnd_list_for_each_entry(entry, &cache->entries, entry)
+    {
+        if (entry->xwin == xwin && entry->fourcc == fourcc)
+        {
+            uint64_t *mods = malloc(entry->num_modifiers * sizeof(uint64_t));
+            if (mods != NULL)
+            {
+                memcpy(mods, entry->modifiers, entry->num_modifiers * sizeof(uint64_t));
+                *ret_modifiers = mods;
+                *ret_num_modifiers = entry->num_modifiers;
+                *ret_prime = entry->prime;
+                found = EGL_TRUE;
+
+                glvnd_list_del(&entry->entry);
+                glvnd_list_add(&entry->entry, &cache->entries);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+
+    return found;
+}
+
+/**
+ * Removes every cached entry for a window.
+ *
+ * This is called when the native window is destroyed, since the server can
+ * reuse its XID for a different window.
+ */
+static void RemoveModifierCacheWindow(X11ModifierCache *cache, xcb_window_t xwin)
+{
+    X11ModifierCacheEntry *entry, *tmp;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->mutex);
+    glvnd_list_for_each_entry_safe(entry, tmp, &cache->entries, entry)
+    {
+        if (entry->xwin == xwin)
+        {
+            FreeModifierCacheEntry(cache, entry);
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+/**
+ * Adds or replaces an entry in the modifier cache.
+ *
+ * If we run out of memory, then this just leaves the cache unchanged.
+ */
+static void UpdateModifierCache(X11ModifierCache *cache,
+        xcb_window_t xwin, uint32_t fourcc,
+        const uint64_t *modifiers, int num_modifiers, EGLBoolean prime)
+{
+    X11ModifierCacheEntry *entry, *tmp;
+    X11ModifierCacheEntry *newEntry;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    newEntry = malloc(sizeof(X11ModifierCacheEntry));
+    if (newEntry == NULL)
+    {
+        return;
+    }
+    newEntry->modifiers = malloc(num_modifiers * sizeof(uint64_t));
+    if (newEntry->modifiers == NULL)
+    {
+        free(newEntry);
+        return;
+    }
+    memcpy(newEntry->modifiers, modifiers, num_modifiers * sizeof(uint64_t));
+    newEntry->num_modifiers = num_modifiers;
+    newEntry->xwin = xwin;
+    newEntry->fourcc = fourcc;
+    newEntry->prime = prime;
+
+    pthread_mutex_lock(&cache->mutex);
+    glvnd_list_for_each_entry_safe(entry, tmp, &cache->entries, entry)
+    {
+        if (entry->xwin == xwin && entry->fourcc == fourcc)
+        {
+            FreeModifierCacheEntry(cache, entry);
+            break;
+        }
+    }
+
+    if (cache->num_entries >= MODIFIER_CACHE_SIZE)
+    {
+        entry = glvnd_list_last_entry(&cache->entries, X11ModifierCacheEntry, entry);
+        FreeModifierCacheEntry(cache, entry);
+    }
+
+    glvnd_list_add(&newEntry->entry, &cache->entries);
+    cache->num_entries++;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
 /**
  * Finds the set of modifiers that we can use for the color buffers.
+ *
+ * The results are cached in X11DisplayInstance::modifier_cache, so that
+ * creating another surface for the same window doesn't need a round trip.
+ *
+ * \param refresh If true, then ignore any cached result and send a new
+ *      DRI3GetSupportedModifiers request. This is used after the server
+ *      reports that the current modifier is suboptimal, since that means the
+ *      server's modifier list for the window has changed.
  */
 static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
-        const X11DriverFormat *format, xcb_window_t xwin,
+        const X11DriverFormat *format, xcb_window_t xwin, EGLBoolean refresh,
         uint64_t **ret_modifiers, int *ret_num_modifiers,
         EGLBoolean *ret_prime)
 {
@@ -642,6 +1787,13 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
         return EGL_FALSE;
     }
 
+    if (!inst->force_prime && !refresh
+            && LookupModifierCache(inst->modifier_cache, xwin, format->fourcc,
+                ret_modifiers, ret_num_modifiers, ret_prime))
+    {
+        return EGL_TRUE;
+    }
+
     mods = malloc(driverFmt->num_modifiers * sizeof(uint64_t));
     if (mods == NULL)
     {
@@ -653,6 +1805,7 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
         cookie = xcb_dri3_get_supported_modifiers(inst->conn, xwin,
                 eplFormatInfoDepth(format->fmt), format->fmt->bpp);
 
+        X11_TRACE_ROUND_TRIP("xcb_dri3_get_supported_modifiers");
         reply = xcb_dri3_get_supported_modifiers_reply(inst->conn, cookie, &error);
         if (reply == NULL)
         {
@@ -722,17 +1875,92 @@ static EGLBoolean FindSupportedModifiers(X11DisplayInstance *inst,
         return EGL_FALSE;
     }
 
+    if (!inst->force_prime)
+    {
+        UpdateModifierCache(inst->modifier_cache, xwin, format->fourcc,
+                mods, numMods, prime);
+    }
+
     *ret_modifiers = mods;
     *ret_num_modifiers = numMods;
     *ret_prime = prime;
     return EGL_TRUE;
 }
 
+/**
+ * Removes a window from the presentation thread, and drops any frames that
+ * it hasn't sent yet.
+ *
+ * The caller must not be holding the window's mutex.
+ */
+static void CancelAsyncPresent(X11Window *pwin)
+{
+    X11Presenter *presenter = pwin->inst->presenter;
+
+    if (presenter == NULL)
+    {
+        return;
+    }
+
+    // If the presentation thread is waiting on another thread's event read,
+    // then wake it up so that it notices the cancelled flag.
+    pthread_mutex_lock(&pwin->mutex);
+    pwin->async.cancelled = EGL_TRUE;
+    pthread_cond_broadcast(&pwin->event_cond);
+    pthread_mutex_unlock(&pwin->mutex);
+
+    pthread_mutex_lock(&presenter->mutex);
+    if (pwin->async.scheduled)
+    {
+        glvnd_list_del(&pwin->async.entry);
+        pwin->async.scheduled = EGL_FALSE;
+    }
+    if (presenter->current == pwin)
+    {
+        // The thread might be waiting for a Present event that will never
+        // arrive, so interrupt it instead of waiting for the server.
+        uint64_t value = 1;
+        if (write(presenter->wake_fd, &value, sizeof(value)) < 0)
+        {
+            // The eventfd counter can't overflow from this, so a failure
+            // just means that the thread is already awake.
+        }
+    }
+    while (presenter->current == pwin)
+    {
+        pthread_cond_wait(&presenter->idle_cond, &presenter->mutex);
+    }
+    pthread_mutex_unlock(&presenter->mutex);
+
+    pthread_mutex_lock(&pwin->mutex);
+    while (!glvnd_list_is_empty(&pwin->async.frames))
+    {
+        X11QueuedFrame *frame = glvnd_list_first_entry(&pwin->async.frames, X11QueuedFrame, entry);
+        glvnd_list_del(&frame->entry);
+        frame->buffer->status = BUFFER_STATUS_IDLE;
+        if (frame->syncfd >= 0)
+        {
+            close(frame->syncfd);
+        }
+        free(frame->rects);
+        free(frame);
+    }
+    pthread_cond_broadcast(&pwin->async.cond);
+    pthread_mutex_unlock(&pwin->mutex);
+}
+
 void eplX11FreeWindow(EplSurface *surf)
 {
     X11Window *pwin = (X11Window *) surf->priv;
 
+    CancelAsyncPresent(pwin);
     FreeWindowBuffers(surf);
+    while (!glvnd_list_is_empty(&pwin->async.retired_buffers))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&pwin->async.retired_buffers, X11ColorBuffer, entry);
+        glvnd_list_del(&buffer->entry);
+        FreeColorBuffer(pwin->inst, buffer);
+    }
 
     if (pwin->inst->conn != NULL && pwin->present_event != NULL)
     {
@@ -747,19 +1975,58 @@ void eplX11FreeWindow(EplSurface *surf)
         }
         xcb_unregister_for_special_event(pwin->inst->conn, pwin->present_event);
     }
+    if (pwin->inst->conn != NULL && pwin->damage_region != 0)
+    {
+        xcb_xfixes_destroy_region(pwin->inst->conn, pwin->damage_region);
+    }
 
     surf->priv = NULL;
+    pthread_cond_destroy(&pwin->async.cond);
+    pthread_cond_destroy(&pwin->event_cond);
     pthread_mutex_destroy(&pwin->mutex);
     eplX11DisplayInstanceUnref(pwin->inst);
     free(pwin);
 }
 
-static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
+/**
+ * Finds the buffer for a PresentIdleNotify event.
+ *
+ * \param pwin The window.
+ * \param xpix The pixmap from the event.
+ * \param serial The serial number from the event.
+ * \return The matching buffer, or NULL if there isn't one.
+ */
+static X11ColorBuffer *FindPresentedBuffer(X11Window *pwin, xcb_pixmap_t xpix, uint32_t serial)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    xcb_present_generic_event_t *ge = (xcb_present_generic_event_t *) xcbevt;
+    X11ColorBuffer *buffer = pwin->present_ring[serial % PRESENT_RING_SIZE].buffer;
+    struct glvnd_list *buffers;
 
-    if (ge->evtype == XCB_PRESENT_CONFIGURE_NOTIFY)
+    if (buffer != NULL && pwin->present_ring[serial % PRESENT_RING_SIZE].serial == serial
+            && buffer->xpix == xpix && buffer->last_present_serial == serial)
+    {
+        pwin->present_ring[serial % PRESENT_RING_SIZE].buffer = NULL;
+        return buffer;
+    }
+
+    // The slot was reused by a later frame, so do it the slow way.
+    buffers = pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers;
+    glvnd_list_for_each_entry(buffer, buffers, entry)
+    {
+        if (buffer->xpix == xpix && buffer->last_present_serial == serial)
+        {
+            return buffer;
+        }
+    }
+
+    return NULL;
+}
+
+static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    xcb_present_generic_event_t *ge = (xcb_present_generic_event_t *) xcbevt;
+
+    if (ge->evtype == XCB_PRESENT_CONFIGURE_NOTIFY)
     {
         xcb_present_configure_notify_event_t *evt = (xcb_present_configure_notify_event_t *) xcbevt;
         pwin->pending_width = evt->width;
@@ -768,6 +2035,7 @@ static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
         if (evt->pixmap_flags & PRESENT_WINDOW_DESTROYED_FLAG)
         {
             pwin->native_destroyed = EGL_TRUE;
+            RemoveModifierCacheWindow(pwin->inst->modifier_cache, pwin->xwin);
         }
     }
     else if (ge->evtype == XCB_PRESENT_IDLE_NOTIFY)
@@ -775,32 +2043,28 @@ static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
         // With explicit sync, we don't care about PresentIdleNotify events.
         if (!pwin->use_explicit_sync)
         {
-            X11ColorBuffer *buffer;
             xcb_present_idle_notify_event_t *evt = (xcb_present_idle_notify_event_t *) xcbevt;
-            struct glvnd_list *buffers = pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers;
+            X11ColorBuffer *buffer = FindPresentedBuffer(pwin, evt->pixmap, evt->serial);
 
-            glvnd_list_for_each_entry(buffer, buffers, entry)
+            if (buffer != NULL)
             {
-                if (buffer->xpix == evt->pixmap && buffer->last_present_serial == evt->serial)
+                struct glvnd_list *buffers = pwin->prime ? &pwin->prime_buffers : &pwin->color_buffers;
+
+                assert(buffer->status == BUFFER_STATUS_IN_USE);
+                if (buffer->status == BUFFER_STATUS_IN_USE)
                 {
-                    assert(buffer->status == BUFFER_STATUS_IN_USE);
-                    if (buffer->status == BUFFER_STATUS_IN_USE)
-                    {
-                        buffer->status = BUFFER_STATUS_IDLE_NOTIFIED;
-                    }
-                    buffer->last_present_serial = 0;
-
-                    /*
-                     * Move the buffer to the end of the list. If we don't have any
-                     * server -> client synchronization, then this ensures that
-                     * we'll reuse the oldest buffers first, so we'll have the best
-                     * chance that the buffer really is idle.
-                     */
-                    glvnd_list_del(&buffer->entry);
-                    glvnd_list_append(&buffer->entry, buffers);
-
-                    break;
+                    buffer->status = BUFFER_STATUS_IDLE_NOTIFIED;
                 }
+                buffer->last_present_serial = 0;
+
+                /*
+                 * Move the buffer to the end of the list. If we don't have any
+                 * server -> client synchronization, then this ensures that
+                 * we'll reuse the oldest buffers first, so we'll have the best
+                 * chance that the buffer really is idle.
+                 */
+                glvnd_list_del(&buffer->entry);
+                glvnd_list_append(&buffer->entry, buffers);
             }
         }
     }
@@ -809,10 +2073,56 @@ static void HandlePresentEvent(EplSurface *surf, xcb_generic_event_t *xcbevt)
         xcb_present_complete_notify_event_t *evt = (xcb_present_complete_notify_event_t *) xcbevt;
         uint32_t age = pwin->last_present_serial - evt->serial;
         uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
+        X11FrameRecord *record = &pwin->stats.frames[evt->serial % FRAME_STATS_RING_SIZE];
+
         if (age < pending)
         {
+            if (pwin->last_complete_ust != 0 && evt->msc > pwin->last_complete_msc
+                    && evt->ust > pwin->last_complete_ust)
+            {
+                uint64_t period = (evt->ust - pwin->last_complete_ust)
+                    / (evt->msc - pwin->last_complete_msc);
+
+                // Smooth out the estimate, since the UST values can jitter.
+                if (pwin->msc_period_us == 0)
+                {
+                    pwin->msc_period_us = period;
+                }
+                else
+                {
+                    pwin->msc_period_us = (pwin->msc_period_us * 7 + period) / 8;
+                }
+            }
+
             pwin->last_complete_serial = evt->serial;
             pwin->last_complete_msc = evt->msc;
+            pwin->last_complete_ust = evt->ust;
+        }
+
+        switch (evt->mode)
+        {
+            case XCB_PRESENT_COMPLETE_MODE_FLIP:
+                pwin->stats.presents_flip++;
+                break;
+            case XCB_PRESENT_COMPLETE_MODE_COPY:
+                pwin->stats.presents_copy++;
+                break;
+            case XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY:
+                pwin->stats.presents_suboptimal_copy++;
+                break;
+            case XCB_PRESENT_COMPLETE_MODE_SKIP:
+                pwin->stats.presents_skip++;
+                break;
+        }
+
+        if (record->serial == evt->serial && !record->completed)
+        {
+            record->completed = EGL_TRUE;
+            record->complete_msc = evt->msc;
+            record->complete_ust = evt->ust;
+            record->mode = evt->mode;
+            pwin->stats.last_msc_delta = evt->msc - record->send_msc;
+            pwin->stats.last_ust_delta = evt->ust - record->send_ust;
         }
 
         if (!pwin->inst->force_prime && evt->mode == XCB_PRESENT_COMPLETE_MODE_SUBOPTIMAL_COPY)
@@ -848,6 +2158,7 @@ static EGLBoolean CheckReallocWindow(EplSurface *surf,
 {
     X11Window *pwin = (X11Window *) surf->priv;
     EGLBoolean need_realloc = EGL_FALSE;
+    EGLBoolean resize = EGL_FALSE;
 
     if (was_resized)
     {
@@ -863,6 +2174,7 @@ static EGLBoolean CheckReallocWindow(EplSurface *surf,
             || pwin->pending_height != pwin->height)
     {
         need_realloc = EGL_TRUE;
+        resize = EGL_TRUE;
     }
 
     if (need_realloc || (allow_modifier_change && pwin->needs_modifier_check))
@@ -875,7 +2187,8 @@ static EGLBoolean CheckReallocWindow(EplSurface *surf,
 
         if (pwin->needs_modifier_check)
         {
-            if (!FindSupportedModifiers(pwin->inst, pwin->format, pwin->xwin, &modsBuffer, &numMods, &prime))
+            if (!FindSupportedModifiers(pwin->inst, pwin->format, pwin->xwin, EGL_TRUE,
+                        &modsBuffer, &numMods, &prime))
             {
                 return EGL_FALSE;
             }
@@ -924,6 +2237,14 @@ static EGLBoolean CheckReallocWindow(EplSurface *surf,
             {
                 *was_resized = EGL_TRUE;
             }
+            if (resize)
+            {
+                pwin->stats.resize_reallocs++;
+            }
+            else
+            {
+                pwin->stats.modifier_reallocs++;
+            }
             pwin->needs_modifier_check = EGL_FALSE;
         }
         else if (allow_modifier_change)
@@ -940,10 +2261,117 @@ static EGLBoolean CheckReallocWindow(EplSurface *surf,
     return EGL_TRUE;
 }
 
+/**
+ * Cleans up after a PixmapFromBuffers request fails.
+ *
+ * If we already sent a PresentPixmap request with the pixmap, then the server
+ * will have rejected that too, so we'll never get the events for it.
+ */
+static void HandleSharedPixmapFailure(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    buffer->xpix = 0;
+    buffer->pixmap_pending = EGL_FALSE;
+    pwin->pixmap_error = EGL_TRUE;
+
+    if (buffer->status == BUFFER_STATUS_IN_USE && buffer->last_present_serial != 0)
+    {
+        uint32_t age = pwin->last_present_serial - buffer->last_present_serial;
+        uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
+        if (age < pending)
+        {
+            pwin->last_complete_serial = buffer->last_present_serial;
+        }
+
+        if (pwin->use_explicit_sync)
+        {
+            // Nothing is going to signal the release point, so do it here.
+            pwin->inst->platform->priv->drm.SyncobjTimelineSignal(
+                    gbm_device_get_fd(pwin->inst->gbmdev),
+                    &buffer->timeline.handle, &buffer->timeline.point, 1);
+        }
+        buffer->status = BUFFER_STATUS_IDLE;
+        buffer->last_present_serial = 0;
+    }
+}
+
+/**
+ * Checks whether the PixmapFromBuffers request for a buffer succeeded.
+ *
+ * \param pwin The window.
+ * \param buffer The buffer to check.
+ * \param wait If true, then wait for the server's reply. Otherwise, only
+ *      check if we've already received it.
+ * \return EGL_FALSE if the request failed. If we don't know yet, then this
+ *      returns EGL_TRUE.
+ */
+static EGLBoolean CheckSharedPixmap(X11Window *pwin, X11ColorBuffer *buffer, EGLBoolean wait)
+{
+    xcb_generic_error_t *error = NULL;
+
+    if (!buffer->pixmap_pending)
+    {
+        return EGL_TRUE;
+    }
+
+    if (wait)
+    {
+        X11_TRACE_ROUND_TRIP("xcb_dri3_pixmap_from_buffers");
+        error = xcb_request_check(pwin->inst->conn, buffer->pixmap_cookie);
+    }
+    else
+    {
+        void *reply = NULL;
+        if (!xcb_poll_for_reply(pwin->inst->conn, buffer->pixmap_cookie.sequence, &reply, &error))
+        {
+            return EGL_TRUE;
+        }
+        free(reply);
+    }
+
+    buffer->pixmap_pending = EGL_FALSE;
+    if (error != NULL)
+    {
+        free(error);
+        HandleSharedPixmapFailure(pwin, buffer);
+        return EGL_FALSE;
+    }
+    return EGL_TRUE;
+}
+
+static void CheckPendingPixmaps(X11Window *pwin)
+{
+    X11ColorBuffer *buffer;
+
+    glvnd_list_for_each_entry(buffer, &pwin->color_buffers, entry)
+    {
+        CheckSharedPixmap(pwin, buffer, EGL_FALSE);
+    }
+    glvnd_list_for_each_entry(buffer, &pwin->prime_buffers, entry)
+    {
+        CheckSharedPixmap(pwin, buffer, EGL_FALSE);
+    }
+}
+
 static void PollForWindowEvents(EplSurface *surf)
 {
     X11Window *pwin = (X11Window *) surf->priv;
 
+    if (!pwin->native_destroyed && !surf->deleted)
+    {
+        CheckPendingPixmaps(pwin);
+    }
+
+    if (pwin->event_reader)
+    {
+        /*
+         * Another thread is waiting in xcb_wait_for_special_event. If we
+         * polled here, we could steal the event that it's waiting for, and
+         * it would keep waiting. That thread will handle any pending events
+         * when it wakes up.
+         */
+        return;
+    }
+
     while (!pwin->native_destroyed && !surf->deleted)
     {
         xcb_generic_event_t *xcbevt = xcb_poll_for_special_event(pwin->inst->conn, pwin->present_event);
@@ -957,10 +2385,69 @@ static void PollForWindowEvents(EplSurface *surf)
     }
 }
 
+/**
+ * Waits for at least one Present event to arrive and handles it.
+ *
+ * The caller must hold the window's mutex exactly once, and must not be
+ * holding the display lock. This will unlock the window's mutex while it
+ * waits.
+ *
+ * If another thread is already waiting for events on this window, then this
+ * will wait for that thread to handle its event instead.
+ *
+ * \return EGL_FALSE if the connection to the server was lost.
+ */
+static EGLBoolean ReadWindowEvent(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    xcb_generic_event_t *xcbevt;
+
+    if (pwin->native_destroyed)
+    {
+        // We'll never get any more events for this window, so don't wait.
+        return EGL_TRUE;
+    }
+
+    if (pwin->event_reader)
+    {
+        // If the other thread fails, then it'll set native_destroyed, which
+        // the caller will check for.
+        pthread_cond_wait(&pwin->event_cond, &pwin->mutex);
+        return EGL_TRUE;
+    }
+
+    pwin->event_reader = EGL_TRUE;
+    pthread_mutex_unlock(&pwin->mutex);
+
+    xcbevt = xcb_wait_for_special_event(pwin->inst->conn, pwin->present_event);
+
+    pthread_mutex_lock(&pwin->mutex);
+    pwin->event_reader = EGL_FALSE;
+
+    if (xcbevt == NULL)
+    {
+        // Note that this only happens if the X11 connection gets killed, as
+        // per XKillClient.
+        pwin->native_destroyed = EGL_TRUE;
+        pthread_cond_broadcast(&pwin->event_cond);
+        return EGL_FALSE;
+    }
+
+    HandlePresentEvent(surf, xcbevt);
+    free(xcbevt);
+
+    // There might be more than one event, so poll, but don't wait for them.
+    PollForWindowEvents(surf);
+
+    pthread_cond_broadcast(&pwin->event_cond);
+    return EGL_TRUE;
+}
+
 static void WindowUpdateCallback(void *param)
 {
     EplSurface *surf = param;
     X11Window *pwin = (X11Window *) surf->priv;
+    X11_TRACE_SCOPE(0, pwin->xwin, 0);
 
     /*
      * Here, we lock the window mutex, but *not* the display mutex.
@@ -990,21 +2477,209 @@ static void WindowUpdateCallback(void *param)
     pthread_mutex_unlock(&pwin->mutex);
 }
 
+/**
+ * Sets up the update region for a PresentPixmap request from the damage
+ * rectangles passed to eglSwapBuffersWithDamage.
+ *
+ * The damage rectangles use a bottom-left origin, so this flips them to X11's
+ * top-left origin and clips them to the window.
+ *
+ * \param surf The window surface.
+ * \param buffer The buffer that's being presented.
+ * \param rects The damage rectangles, as (x, y, width, height) tuples.
+ * \param n_rects The number of rectangles in \p rects.
+ * \return The region to send as the update region, or 0 (None) to update the
+ *      whole window.
+ */
+static xcb_xfixes_region_t SetupUpdateRegion(EplSurface *surf, X11ColorBuffer *buffer,
+        const EGLint *rects, EGLint n_rects)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    xcb_rectangle_t *xrects;
+    uint32_t count = 0;
+    EGLint width, height;
+    EGLint i;
+
+    if (rects == NULL || n_rects <= 0 || !pwin->inst->supports_update_regions)
+    {
+        return 0;
+    }
+
+    xrects = malloc(n_rects * sizeof(xcb_rectangle_t));
+    if (xrects == NULL)
+    {
+        // If we run out of memory here, then just update the whole window.
+        return 0;
+    }
+
+    // Use the size of the buffer rather than the window, since the window
+    // might have been resized since the frame was rendered.
+    width = buffer->width;
+    height = buffer->height;
+
+    for (i=0; i<n_rects; i++)
+    {
+        EGLint x1 = rects[i * 4];
+        EGLint y1 = rects[i * 4 + 1];
+        EGLint x2 = x1 + rects[i * 4 + 2];
+        EGLint y2 = y1 + rects[i * 4 + 3];
+
+        if (x1 < 0)
+        {
+            x1 = 0;
+        }
+        if (y1 < 0)
+        {
+            y1 = 0;
+        }
+        if (x2 > width)
+        {
+            x2 = width;
+        }
+        if (y2 > height)
+        {
+            y2 = height;
+        }
+        if (x1 >= x2 || y1 >= y2)
+        {
+            continue;
+        }
+
+        xrects[count].x = x1;
+        xrects[count].y = height - y2;
+        xrects[count].width = x2 - x1;
+        xrects[count].height = y2 - y1;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        /*
+         * If every rectangle was outside the window, then there's no useful
+         * update region. Rather than trying to send an empty region, just
+         * update the whole window.
+         */
+        free(xrects);
+        return 0;
+    }
+
+    if (pwin->damage_region == 0)
+    {
+        pwin->damage_region = xcb_generate_id(pwin->inst->conn);
+        xcb_xfixes_create_region(pwin->inst->conn, pwin->damage_region, count, xrects);
+    }
+    else
+    {
+        xcb_xfixes_set_region(pwin->inst->conn, pwin->damage_region, count, xrects);
+    }
+
+    free(xrects);
+    return pwin->damage_region;
+}
+
+/**
+ * Converts a UST value into the nearest MSC value, based on the most recent
+ * PresentCompleteNotify event and the estimated refresh period.
+ *
+ * Returns zero if we don't have enough history yet, or if the time has
+ * already passed.
+ */
+static uint64_t GetTargetMSCForTime(const X11Window *pwin, uint64_t ust)
+{
+    uint64_t delta;
+
+    if (pwin->msc_period_us == 0 || pwin->last_complete_ust == 0
+            || ust <= pwin->last_complete_ust)
+    {
+        return 0;
+    }
+
+    delta = ust - pwin->last_complete_ust;
+    return pwin->last_complete_msc + (delta + (pwin->msc_period_us / 2)) / pwin->msc_period_us;
+}
+
+/**
+ * Checks whether a frame with the given target MSC would be late, for
+ * adaptive vsync.
+ *
+ * If we have an estimate of the refresh period, then we use it to guess the
+ * current MSC from the last PresentCompleteNotify event. Otherwise, we assume
+ * that we're late if the last frame to complete missed its target.
+ */
+static EGLBoolean IsFrameLate(const X11Window *pwin, uint64_t targetMSC)
+{
+    const X11FrameRecord *record;
+
+    if (pwin->msc_period_us != 0 && pwin->last_complete_ust != 0)
+    {
+        uint64_t now = GetTimeNs() / 1000;
+        uint64_t currentMSC = pwin->last_complete_msc;
+
+        if (now > pwin->last_complete_ust)
+        {
+            currentMSC += (now - pwin->last_complete_ust) / pwin->msc_period_us;
+        }
+        return (currentMSC >= targetMSC);
+    }
+
+    record = &pwin->stats.frames[pwin->last_complete_serial % FRAME_STATS_RING_SIZE];
+    return (record->serial == pwin->last_complete_serial && record->completed
+            && record->target_msc != 0 && record->complete_msc > record->target_msc);
+}
+
 /**
  * A common helper function to send a PresentPixmap or PresentPixmapSynced
  * request.
  *
  * If explicit sync is supported, then the pixmap's current timeline point must
  * already be set up to the correct acquire fence.
+ *
+ * This doesn't flush the connection, so that the presentation thread can
+ * send the requests for several windows and then flush them all at once.
+ * The caller has to call xcb_flush before it waits for any events.
+ *
+ * \param surf The window surface.
+ * \param sharedPixmap The buffer to present.
+ * \param options The PresentOption flags to send.
+ * \param targetUST The time from eglPresentationTimeANDROID, in
+ *      microseconds, or zero to present at the next refresh allowed by the
+ *      swap interval.
+ * \param rects The damage rectangles from eglSwapBuffersWithDamage, or NULL
+ *      to update the whole window.
+ * \param n_rects The number of rectangles in \p rects.
+ * \return EGL_FALSE if the buffer's shared pixmap is invalid, in which case
+ *      nothing is sent and the buffer is marked idle.
  */
-static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, uint32_t options)
+static EGLBoolean SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, uint32_t options,
+        uint64_t targetUST, const EGLint *rects, EGLint n_rects)
 {
     X11Window *pwin = (X11Window *) surf->priv;
     uint32_t numPending = pwin->last_present_serial - pwin->last_complete_serial;
-    uint32_t targetMSC = 0;
+    uint64_t interval = (pwin->swap_interval < 0)
+        ? (uint64_t) -((int64_t) pwin->swap_interval) : (uint64_t) pwin->swap_interval;
+    uint64_t targetMSC = 0;
     uint64_t divisor = 1;
+    xcb_xfixes_region_t update;
+    xcb_void_cookie_t cookie;
+    X11FrameRecord *record;
+    EGLBoolean checked;
+    X11_TRACE_SCOPE(0, sharedPixmap->xpix, sharedPixmap->timeline.point);
+
+    if (sharedPixmap->pixmap_pending && pwin->use_explicit_sync
+            && pwin->inst->platform->priv->xcb.present_pixmap_synced_checked == NULL)
+    {
+        // We can't send a checked PresentPixmapSynced request, so we have to
+        // wait to find out if the pixmap is valid.
+        CheckSharedPixmap(pwin, sharedPixmap, EGL_TRUE);
+    }
+    if (sharedPixmap->xpix == 0)
+    {
+        sharedPixmap->status = BUFFER_STATUS_IDLE;
+        return EGL_FALSE;
+    }
+    checked = sharedPixmap->pixmap_pending;
 
-    if (pwin->swap_interval <= 0)
+    if (pwin->swap_interval == 0)
     {
         options |= XCB_PRESENT_OPTION_ASYNC;
     }
@@ -1052,16 +2727,46 @@ static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, ui
          *   server.
          */
 
-        targetMSC = pwin->last_complete_msc + ((numPending + 1) * pwin->swap_interval);
+        targetMSC = pwin->last_complete_msc + ((numPending + 1) * interval);
+
+        if (pwin->swap_interval < 0
+                && (pwin->present_capabilities & XCB_PRESENT_CAPABILITY_ASYNC)
+                && IsFrameLate(pwin, targetMSC))
+        {
+            /*
+             * With adaptive vsync, if we've already missed the target, then
+             * tear instead of waiting for another refresh cycle. The server
+             * presents an async frame immediately if its target MSC has
+             * already passed.
+             */
+            options |= XCB_PRESENT_OPTION_ASYNC;
+        }
+    }
+
+    if (targetUST != 0)
+    {
+        /*
+         * If the app set a presentation time, then don't show the frame
+         * before the refresh cycle closest to that time. We still keep the
+         * swap interval's target if that's later.
+         */
+        uint64_t timeMSC = GetTargetMSCForTime(pwin, targetUST);
+        if (timeMSC > targetMSC)
+        {
+            targetMSC = timeMSC;
+        }
     }
 
+    update = SetupUpdateRegion(surf, sharedPixmap, rects, n_rects);
+
     pwin->last_present_serial++;
 
     if (pwin->use_explicit_sync)
     {
-        pwin->inst->platform->priv->xcb.present_pixmap_synced(pwin->inst->conn, pwin->xwin,
+        cookie = (checked ? pwin->inst->platform->priv->xcb.present_pixmap_synced_checked
+                : pwin->inst->platform->priv->xcb.present_pixmap_synced)(pwin->inst->conn, pwin->xwin,
                 sharedPixmap->xpix, pwin->last_present_serial,
-                0, 0, 0, 0, 0,
+                0, update, 0, 0, 0,
                 sharedPixmap->timeline.xid, sharedPixmap->timeline.xid,
                 sharedPixmap->timeline.point, sharedPixmap->timeline.point + 1,
                 options, targetMSC, divisor, 0,
@@ -1071,19 +2776,39 @@ static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, ui
     }
     else
     {
-        xcb_present_pixmap(pwin->inst->conn,
+        cookie = (checked ? xcb_present_pixmap_checked : xcb_present_pixmap)(pwin->inst->conn,
                 pwin->xwin,
                 sharedPixmap->xpix,
                 pwin->last_present_serial,
-                0, 0, // No update regions
-                0, 0, // No offset -- update the whole window
+                0, update, // No valid region, and the damage region if we have one
+                0, 0, // No offset
                 0, 0, 0, // No CRTC or fences
                 options, targetMSC, divisor, 0, 0, NULL);
     }
 
-    xcb_flush(pwin->inst->conn);
+    if (checked)
+    {
+        // If the pixmap turns out to be invalid, then we'll find out from the
+        // PixmapFromBuffers request instead.
+        xcb_discard_reply(pwin->inst->conn, cookie.sequence);
+    }
+
     sharedPixmap->status = BUFFER_STATUS_IN_USE;
     sharedPixmap->last_present_serial = pwin->last_present_serial;
+    sharedPixmap->last_used_frame = pwin->frame_count;
+    sharedPixmap->last_used_ns = GetTimeNs();
+    X11_TRACE_ARGS(pwin->last_present_serial, sharedPixmap->xpix, sharedPixmap->timeline.point);
+
+    record = &pwin->stats.frames[pwin->last_present_serial % FRAME_STATS_RING_SIZE];
+    record->serial = pwin->last_present_serial;
+    record->send_msc = pwin->last_complete_msc;
+    record->target_msc = targetMSC;
+    record->send_ust = GetTimeNs() / 1000;
+    record->completed = EGL_FALSE;
+
+    pwin->present_ring[pwin->last_present_serial % PRESENT_RING_SIZE].serial = pwin->last_present_serial;
+    pwin->present_ring[pwin->last_present_serial % PRESENT_RING_SIZE].buffer = sharedPixmap;
+    return EGL_TRUE;
 }
 
 /**
@@ -1092,26 +2817,40 @@ static void SendPresentPixmap(EplSurface *surf, X11ColorBuffer *sharedPixmap, ui
 static EGLBoolean CreateSharedPixmap(EplSurface *psurf, X11ColorBuffer *buffer, const EplFormatInfo *fmt)
 {
     X11Window *pwin = (X11Window *) psurf->priv;
-    xcb_void_cookie_t cookie;
-    xcb_generic_error_t *error;
-    int fd = -1;
+    int32_t fds[GBM_MAX_PLANES];
+    uint32_t strides[GBM_MAX_PLANES] = { 0 };
+    uint32_t offsets[GBM_MAX_PLANES] = { 0 };
+    int numPlanes = gbm_bo_get_plane_count(buffer->gbo);
+    int numFds = 0;
+    int i;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     assert(buffer->xpix == 0);
 
-    // Note that XCB will close the file descriptor after it sends the request,
-    // so even if we already have a file descriptor, we have to duplicate it.
-    if (buffer->fd >= 0)
+    if (numPlanes <= 0 || numPlanes > GBM_MAX_PLANES)
     {
-        fd = dup(buffer->fd);
-    }
-    else
-    {
-        fd = gbm_bo_get_fd(buffer->gbo);
+        return EGL_FALSE;
     }
 
-    if (fd < 0)
+    for (numFds=0; numFds<numPlanes; numFds++)
     {
-        return EGL_FALSE;
+        // Note that XCB will close the file descriptors after it sends the
+        // request, so even if we already have a file descriptor, we have to
+        // duplicate it.
+        if (numFds == 0 && buffer->fd >= 0)
+        {
+            fds[numFds] = dup(buffer->fd);
+        }
+        else
+        {
+            fds[numFds] = gbm_bo_get_fd_for_plane(buffer->gbo, numFds);
+        }
+        if (fds[numFds] < 0)
+        {
+            goto fail;
+        }
+        strides[numFds] = gbm_bo_get_stride_for_plane(buffer->gbo, numFds);
+        offsets[numFds] = gbm_bo_get_offset(buffer->gbo, numFds);
     }
 
     if (pwin->use_explicit_sync && buffer->timeline.xid == 0)
@@ -1119,32 +2858,86 @@ static EGLBoolean CreateSharedPixmap(EplSurface *psurf, X11ColorBuffer *buffer,
         // If we're able to use explicit sync, then create a timeline object.
         if (!eplX11TimelineInit(pwin->inst, &buffer->timeline))
         {
-            close(fd);
-            return EGL_FALSE;
+            goto fail;
         }
     }
 
-    // Temporary hack: Send the PixmapFromBuffers request synchronously to
-    // check for errors.
+    /*
+     * Send a checked request so that any error comes back to us instead of
+     * the application, but don't wait for the reply here. CheckSharedPixmap
+     * will pick up the result later.
+     */
     buffer->xpix = xcb_generate_id(pwin->inst->conn);
-    cookie = xcb_dri3_pixmap_from_buffers_checked(pwin->inst->conn, buffer->xpix,
-            pwin->inst->xscreen->root, 1,
-            gbm_bo_get_width(buffer->gbo),
-            gbm_bo_get_height(buffer->gbo),
-            gbm_bo_get_stride(buffer->gbo),
-            gbm_bo_get_offset(buffer->gbo, 0),
-            0, 0, 0, 0, 0, 0,
+    buffer->pixmap_pending = EGL_TRUE;
+    buffer->pixmap_cookie = xcb_dri3_pixmap_from_buffers_checked(pwin->inst->conn, buffer->xpix,
+            pwin->inst->xscreen->root, numPlanes,
+            buffer->width, buffer->height,
+            strides[0], offsets[0],
+            strides[1], offsets[1],
+            strides[2], offsets[2],
+            strides[3], offsets[3],
             eplFormatInfoDepth(fmt), fmt->bpp,
-            gbm_bo_get_modifier(buffer->gbo), &fd);
+            gbm_bo_get_modifier(buffer->gbo), fds);
 
-    error = xcb_request_check(pwin->inst->conn, cookie);
-    if (error != NULL)
+    return EGL_TRUE;
+
+fail:
+    for (i=0; i<numFds; i++)
+    {
+        close(fds[i]);
+    }
+    return EGL_FALSE;
+}
+
+/**
+ * Manually signals the next point on a buffer's timeline, for when we can't
+ * attach a fence to it.
+ *
+ * The caller must have already waited for the rendering to finish.
+ */
+static EGLBoolean SignalNextTimelinePoint(X11Window *pwin, X11ColorBuffer *buffer)
+{
+    uint32_t handle = buffer->timeline.handle;
+    uint64_t point = buffer->timeline.point + 1;
+
+    if (pwin->inst->platform->priv->drm.SyncobjTimelineSignal(
+            gbm_device_get_fd(pwin->inst->gbmdev),
+            &handle, &point, 1) != 0)
     {
-        buffer->xpix = 0;
-        free(error);
         return EGL_FALSE;
     }
+    buffer->timeline.point++;
+    return EGL_TRUE;
+}
+
+/**
+ * Lets the presentation thread wait for a front-buffer fence and then send
+ * the PresentPixmap request, so that the damage callback doesn't stall the
+ * driver.
+ *
+ * \return EGL_TRUE if the frame was queued.
+ */
+static EGLBoolean DeferDamagePresent(EplSurface *surf, X11ColorBuffer *sharedPixmap, int syncfd)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    int fd;
 
+    if (pwin->inst->presenter == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    fd = dup(syncfd);
+    if (fd < 0)
+    {
+        return EGL_FALSE;
+    }
+    if (!QueueAsyncPresent(surf, sharedPixmap,
+                XCB_PRESENT_OPTION_ASYNC | XCB_PRESENT_OPTION_COPY, 0, NULL, 0, fd))
+    {
+        close(fd);
+        return EGL_FALSE;
+    }
     return EGL_TRUE;
 }
 
@@ -1181,6 +2974,53 @@ static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
 
     assert(sharedPixmap != NULL);
 
+    if (sharedPixmap->status == BUFFER_STATUS_QUEUED)
+    {
+        // The presentation thread is about to send this buffer anyway.
+        if (syncfd >= 0)
+        {
+            X11QueuedFrame *frame;
+            X11QueuedFrame *owner = NULL;
+            int fd = -1;
+
+            // The buffer might be queued more than once, so pick the newest
+            // frame that uses it.
+            glvnd_list_for_each_entry(frame, &pwin->async.frames, entry)
+            {
+                if (frame->buffer == sharedPixmap)
+                {
+                    owner = frame;
+                }
+            }
+
+            if (owner != NULL)
+            {
+                fd = dup(syncfd);
+            }
+            if (fd >= 0)
+            {
+                /*
+                 * Make it wait for the new rendering, too. The new fence
+                 * comes from later in the same command stream, so it
+                 * replaces any fence that the frame already has.
+                 */
+                if (owner->syncfd >= 0)
+                {
+                    close(owner->syncfd);
+                }
+                owner->syncfd = fd;
+            }
+            else
+            {
+                // If we can't hand the fence to the presentation thread,
+                // then it might send the buffer before the rendering
+                // lands, so wait for it here.
+                eplX11WaitForFD(syncfd);
+            }
+        }
+        goto done;
+    }
+
     if (sharedPixmap->xpix == 0)
     {
         if (!CreateSharedPixmap(surf, sharedPixmap, pwin->format->fmt))
@@ -1203,44 +3043,181 @@ static void WindowDamageCallback(void *param, int syncfd, unsigned int flags)
 
         if (!syncOK)
         {
-            uint32_t handle;
-            uint64_t point;
-
+            /*
+             * If eplX11TimelineAttachSyncFD fails, then let the presentation
+             * thread wait for the fence and signal the timeline point. As a
+             * last resort, or if we don't have a sync FD, then wait here and
+             * manually signal the next timeline point.
+             */
+            if (syncfd >= 0 && DeferDamagePresent(surf, sharedPixmap, syncfd))
+            {
+                goto done;
+            }
             if (!eplX11WaitForFD(syncfd))
             {
                 goto done;
             }
-
-            // If eplX11TimelineAttachSyncFD fails or if we don't have a
-            // sync FD, then just manually signal the next timeline point.
-            handle = sharedPixmap->timeline.handle;
-            point = sharedPixmap->timeline.point + 1;
-            if (pwin->inst->platform->priv->drm.SyncobjTimelineSignal(
-                    gbm_device_get_fd(pwin->inst->gbmdev),
-                    &handle, &point, 1) != 0)
+            if (!SignalNextTimelinePoint(pwin, sharedPixmap))
             {
                 goto done;
             }
-            sharedPixmap->timeline.point++;
         }
     }
-    else
+    else if (syncfd >= 0)
     {
-        // If we don't have explicit sync, then just do a CPU wait.
-        // TODO: Is there a way that we can reliably use implicit sync if
-        // the server supports it?
-        if (!eplX11WaitForFD(syncfd))
+        /*
+         * Without explicit sync, try to attach the fence to the dma-buf, the
+         * same way that SyncRendering does in eglSwapBuffers.
+         *
+         * If we can't do that, then let the presentation thread wait for the
+         * fence and send the PresentPixmap request, so that we don't stall
+         * the driver here. As a last resort, do a CPU wait.
+         */
+        if (sharedPixmap->fd < 0
+                || !eplX11ImportDmaBufSyncFile(pwin->inst, sharedPixmap->fd, syncfd))
         {
-            goto done;
+            if (DeferDamagePresent(surf, sharedPixmap, syncfd))
+            {
+                goto done;
+            }
+            if (!eplX11WaitForFD(syncfd))
+            {
+                goto done;
+            }
         }
     }
 
-    SendPresentPixmap(surf, sharedPixmap, XCB_PRESENT_OPTION_ASYNC | XCB_PRESENT_OPTION_COPY);
+    // If the pixmap is invalid, then SendPresentPixmap will flag the error
+    // for the next eglSwapBuffers call.
+    SendPresentPixmap(surf, sharedPixmap, XCB_PRESENT_OPTION_ASYNC | XCB_PRESENT_OPTION_COPY, 0, NULL, 0);
+    xcb_flush(pwin->inst->conn);
 
 done:
     pthread_mutex_unlock(&pwin->mutex);
 }
 
+/**
+ * Returns the most linear buffers that a PRIME window can grow to, based on
+ * the __NV_X11_EGL_MAX_PRIME_BUFFERS environment variable.
+ *
+ * This is never less than the starting number of buffers.
+ */
+static int GetPrimeBufferCap(const X11QueueParams *queue)
+{
+    int cap = DEFAULT_PRIME_BUFFER_CAP;
+    const char *env = getenv(MAX_PRIME_BUFFERS_ENV);
+
+    if (env != NULL)
+    {
+        cap = atoi(env);
+    }
+    if (cap < queue->max_prime_buffers)
+    {
+        cap = queue->max_prime_buffers;
+    }
+    return cap;
+}
+
+/**
+ * Picks the swapchain limits for a new window, based on the
+ * EGL_X11_QUEUE_MODE_NVX attribute and the __NV_X11_EGL_QUEUE_MODE
+ * environment variable.
+ *
+ * \param plat The platform data.
+ * \param attribs The attribute list passed to eglCreateWindowSurface.
+ * \return The X11QueueParams to use, or NULL if the attribute is invalid.
+ */
+static const X11QueueParams *GetQueueParams(EplPlatformData *plat, const EGLAttrib *attribs)
+{
+    EGLAttrib mode = EGL_X11_QUEUE_MODE_DEFAULT_NVX;
+    const char *env;
+
+    if (attribs != NULL)
+    {
+        int i;
+        for (i=0; attribs[i] != EGL_NONE; i += 2)
+        {
+            if (attribs[i] == EGL_X11_QUEUE_MODE_NVX)
+            {
+                mode = attribs[i + 1];
+            }
+        }
+    }
+
+    env = getenv(QUEUE_MODE_ENV);
+    if (env != NULL)
+    {
+        if (strcmp(env, "low-latency") == 0)
+        {
+            mode = EGL_X11_QUEUE_MODE_LOW_LATENCY_NVX;
+        }
+        else if (strcmp(env, "throughput") == 0)
+        {
+            mode = EGL_X11_QUEUE_MODE_THROUGHPUT_NVX;
+        }
+        else if (strcmp(env, "default") == 0)
+        {
+            mode = EGL_X11_QUEUE_MODE_DEFAULT_NVX;
+        }
+        else
+        {
+            fprintf(stderr, "nvidia-egl-x11: Ignoring unknown %s value \"%s\". "
+                    "Expected \"default\", \"low-latency\", or \"throughput\".\n",
+                    QUEUE_MODE_ENV, env);
+        }
+    }
+
+    switch (mode)
+    {
+        case EGL_X11_QUEUE_MODE_DEFAULT_NVX:
+            return &QUEUE_PARAMS_DEFAULT;
+        case EGL_X11_QUEUE_MODE_LOW_LATENCY_NVX:
+            return &QUEUE_PARAMS_LOW_LATENCY;
+        case EGL_X11_QUEUE_MODE_THROUGHPUT_NVX:
+            return &QUEUE_PARAMS_THROUGHPUT;
+        default:
+            eplSetError(plat, EGL_BAD_ATTRIBUTE, "Invalid value 0x%04llx for EGL_X11_QUEUE_MODE_NVX",
+                    (unsigned long long) mode);
+            return NULL;
+    }
+}
+
+/**
+ * Checks the EGL_RENDER_BUFFER attribute for a new window.
+ *
+ * \param plat The platform data.
+ * \param attribs The attribute list passed to eglCreateWindowSurface.
+ * \param[out] ret_single Returns EGL_TRUE if the window is single-buffered.
+ * \return EGL_TRUE on success, or EGL_FALSE if the attribute is invalid.
+ */
+static EGLBoolean GetRenderBuffer(EplPlatformData *plat, const EGLAttrib *attribs,
+        EGLBoolean *ret_single)
+{
+    EGLAttrib renderBuffer = EGL_BACK_BUFFER;
+
+    if (attribs != NULL)
+    {
+        int i;
+        for (i=0; attribs[i] != EGL_NONE; i += 2)
+        {
+            if (attribs[i] == EGL_RENDER_BUFFER)
+            {
+                renderBuffer = attribs[i + 1];
+            }
+        }
+    }
+
+    if (renderBuffer != EGL_BACK_BUFFER && renderBuffer != EGL_SINGLE_BUFFER)
+    {
+        eplSetError(plat, EGL_BAD_ATTRIBUTE, "Invalid value 0x%04llx for EGL_RENDER_BUFFER",
+                (unsigned long long) renderBuffer);
+        return EGL_FALSE;
+    }
+
+    *ret_single = (renderBuffer == EGL_SINGLE_BUFFER);
+    return EGL_TRUE;
+}
+
 static EGLBoolean CheckExistingWindow(EplDisplay *pdpy, xcb_window_t xwin)
 {
     EplSurface *psurf;
@@ -1282,9 +3259,13 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     uint64_t *mods = NULL;
     int numMods = 0;
     EGLBoolean prime = EGL_FALSE;
+    EGLBoolean singleBuffered = EGL_FALSE;
     EGLAttrib platformAttribs[15];
     EGLAttrib *internalAttribs = NULL;
+    const X11QueueParams *queue = NULL;
+    const char *env;
     uint32_t eventMask;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     if (xwin == 0)
     {
@@ -1308,7 +3289,17 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         return EGL_NO_SURFACE;
     }
 
-    internalAttribs = eplX11GetInternalSurfaceAttribs(plat, pdpy, internalAttribs);
+    queue = GetQueueParams(plat, attribs);
+    if (queue == NULL)
+    {
+        return EGL_NO_SURFACE;
+    }
+    if (!GetRenderBuffer(plat, attribs, &singleBuffered))
+    {
+        return EGL_NO_SURFACE;
+    }
+
+    internalAttribs = eplX11GetInternalSurfaceAttribs(plat, pdpy, attribs);
     if (internalAttribs == NULL)
     {
         goto done;
@@ -1330,22 +3321,38 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         pwin = NULL;
         goto done;
     }
+    pthread_cond_init(&pwin->event_cond, NULL);
+    pthread_cond_init(&pwin->async.cond, NULL);
     glvnd_list_init(&pwin->color_buffers);
     glvnd_list_init(&pwin->prime_buffers);
+    glvnd_list_init(&pwin->async.frames);
+    glvnd_list_init(&pwin->async.retired_buffers);
+    glvnd_list_init(&pwin->async.entry);
+    pwin->async.surf = surf;
     surf->priv = (EplImplSurface *) pwin;
     pwin->inst = eplX11DisplayInstanceRef(inst);
     pwin->xwin = xwin;
     pwin->format = fmt;
+    pwin->queue = queue;
+    pwin->single_buffered = singleBuffered;
+    pwin->max_prime_buffers = queue->max_prime_buffers;
+    pwin->max_prime_buffers_cap = GetPrimeBufferCap(queue);
+    env = getenv(FRAME_STATS_ENV);
+    if (env != NULL && atoi(env) > 0)
+    {
+        pwin->stats.log_interval = atoi(env);
+    }
     pwin->modifier = DRM_FORMAT_MOD_INVALID;
     pwin->swap_interval = 1;
 
-    if (!FindSupportedModifiers(inst, fmt, xwin, &mods, &numMods, &prime))
+    if (!FindSupportedModifiers(inst, fmt, xwin, EGL_FALSE, &mods, &numMods, &prime))
     {
         eplSetError(plat, EGL_BAD_CONFIG, "No matching format modifiers for window");
         goto done;
     }
 
     presentCapsCookie = xcb_present_query_capabilities(inst->conn, xwin);
+    X11_TRACE_ROUND_TRIP("xcb_present_query_capabilities");
     presentCapsReply = xcb_present_query_capabilities_reply(inst->conn, presentCapsCookie, &error);
     if (presentCapsReply == NULL)
     {
@@ -1356,6 +3363,7 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     if ((pwin->present_capabilities & XCB_PRESENT_CAPABILITY_SYNCOBJ) && inst->supports_explicit_sync)
     {
         pwin->use_explicit_sync = EGL_TRUE;
+        pwin->use_syncobj_eventfd = (plat->priv->drm.SyncobjEventfd != NULL);
     }
 
     /*
@@ -1378,6 +3386,7 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
             &xcb_present_id, pwin->present_event_id, &pwin->present_event_stamp);
     presentSelectCookie = xcb_present_select_input_checked(inst->conn,
             pwin->present_event_id, xwin, eventMask);
+    X11_TRACE_ROUND_TRIP("xcb_present_select_input");
     error = xcb_request_check(inst->conn, presentSelectCookie);
     if (error != NULL)
     {
@@ -1386,6 +3395,7 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     }
 
     winodwAttribCookie = xcb_get_window_attributes(inst->conn, xwin);
+    X11_TRACE_ROUND_TRIP("xcb_get_window_attributes");
     windowAttribReply = xcb_get_window_attributes_reply(inst->conn, winodwAttribCookie, &error);
     if (windowAttribReply == NULL)
     {
@@ -1400,6 +3410,7 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
     }
 
     geomCookie = xcb_get_geometry(inst->conn, xwin);
+    X11_TRACE_ROUND_TRIP("xcb_get_geometry");
     geomReply = xcb_get_geometry_reply(inst->conn, geomCookie, &error);
     if (geomReply == NULL)
     {
@@ -1421,166 +3432,603 @@ EGLSurface eplX11CreateWindowSurface(EplPlatformData *plat, EplDisplay *pdpy, Ep
         goto done;
     }
 
-    platformAttribs[0] = GL_FRONT;
-    platformAttribs[1] = (EGLAttrib) pwin->current_front->buffer;
-    platformAttribs[2] = GL_BACK;
-    platformAttribs[3] = (EGLAttrib) pwin->current_back->buffer;
-    platformAttribs[4] = EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX;
-    if (pwin->current_prime != NULL)
+    platformAttribs[0] = GL_BACK;
+    platformAttribs[1] = (EGLAttrib) pwin->current_back->buffer;
+    platformAttribs[2] = EGL_PLATFORM_SURFACE_BLIT_TARGET_NVX;
+    if (pwin->current_prime != NULL)
+    {
+        platformAttribs[3] = (EGLAttrib) pwin->current_prime->buffer;
+    }
+    else
+    {
+        platformAttribs[3] = (EGLAttrib) NULL;
+    }
+
+    platformAttribs[4] = EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_NVX;
+    platformAttribs[5] = (EGLAttrib) WindowUpdateCallback;
+    platformAttribs[6] = EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_PARAM_NVX;
+    platformAttribs[7] = (EGLAttrib) surf;
+    platformAttribs[8] = EGL_PLATFORM_SURFACE_DAMAGE_CALLBACK_NVX;
+    platformAttribs[9] = (EGLAttrib) WindowDamageCallback;
+    platformAttribs[10] = EGL_PLATFORM_SURFACE_DAMAGE_CALLBACK_PARAM_NVX;
+    platformAttribs[11] = (EGLAttrib) surf;
+    if (pwin->single_buffered)
+    {
+        // Without a front buffer, the driver creates a single-buffered
+        // surface, and it calls the damage callback after every flush.
+        platformAttribs[12] = EGL_NONE;
+    }
+    else
+    {
+        platformAttribs[12] = GL_FRONT;
+        platformAttribs[13] = (EGLAttrib) pwin->current_front->buffer;
+        platformAttribs[14] = EGL_NONE;
+    }
+    esurf = inst->platform->priv->egl.PlatformCreateSurfaceNVX(inst->internal_display->edpy,
+            config, platformAttribs, internalAttribs);
+
+done:
+    if (esurf == EGL_NO_SURFACE)
+    {
+        eplX11FreeWindow(surf);
+    }
+    free(windowAttribReply);
+    free(geomReply);
+    free(presentCapsReply);
+    free(error);
+    free(mods);
+    free(internalAttribs);
+    return esurf;
+}
+
+void eplX11DestroyWindow(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    EGLSurface internalSurf;
+
+    assert(surf->type == EPL_SURFACE_TYPE_WINDOW);
+
+    /*
+     * Lock the surface and increment skip_update_callback. After that, if
+     * another thread tries to call the update callback after this, then
+     * the update callback won't try to call into the driver.
+     */
+    pthread_mutex_lock(&pwin->mutex);
+
+    pwin->skip_update_callback++;
+    internalSurf = surf->internal_surface;
+
+    pthread_mutex_unlock(&pwin->mutex);
+
+    // Make sure that the presentation thread is finished with the window
+    // before we return.
+    CancelAsyncPresent(pwin);
+
+    /*
+     * We have to unlock the surface before we call the driver's
+     * eglDestroySurface.
+     *
+     * If another thread tries to call the window update callback for this
+     * surface, then it will be holding a mutex in the driver, and then the
+     * callback will try to lock the surface's mutex.
+     *
+     * If we had the surface locked here, then the driver's eglDestroySurface
+     * implementation would try to take the driver's mutex, which would lead to
+     * a deadlock.
+     */
+    if (internalSurf != EGL_NO_SURFACE)
+    {
+        pwin->inst->platform->egl.DestroySurface(pwin->inst->internal_display->edpy, internalSurf);
+    }
+}
+
+/**
+ * Waits for at least one Present event to arrive.
+ *
+ * This function will unlock the surface and the display while waiting, so the
+ * caller must check the EplSurface::deleted flag to check whether another
+ * thread destroyed the surface in the meantime.
+ *
+ * \param pdpy The EplDisplay pointer, or NULL if the caller has already
+ *      released the display lock, as eglSwapBuffers does.
+ * \param surf The EplSurface pointer.
+ */
+static EGLBoolean WaitForWindowEvents(EplDisplay *pdpy, EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    uint64_t start;
+    EGLBoolean success;
+
+    /*
+     * We don't want to block other threads while we wait, so we need to
+     * release our locks.
+     *
+     * The use counter in EplDisplay should prevent the display from
+     * getting terminated out from under us, and the refcount in EplSurface
+     * will ensure that the EplSurface struct itself sticks around.
+     *
+     * It's still possible that the surface will get destroyed by another
+     * thread in the meantime, though, so the caller needs to check for that.
+     */
+
+    if (pwin->native_destroyed)
+    {
+        /*
+         * If the X window was destroyed, then xcb_wait_for_special_event would
+         * hang because it would never receive any events for that window.
+         * However, a new enough X server will send a PresentConfigureNotify
+         * event with a special flag set to notify the client when that
+         * happens.
+         *
+         * There is still a race condition if the X window gets destroyed
+         * before the server receives the PresentPixmap request, but there's
+         * not much that we can do about that.
+         */
+        return EGL_TRUE;
+    }
+
+    if (pdpy != NULL)
+    {
+        eplDisplayUnlock(pdpy);
+    }
+
+    // ReadWindowEvent will release the window mutex while it waits.
+    start = GetTimeNs();
+    success = ReadWindowEvent(surf);
+    pwin->stats.event_wait_ns += GetTimeNs() - start;
+
+    if (pdpy != NULL)
+    {
+        // Re-take the locks in the right order.
+        pthread_mutex_unlock(&pwin->mutex);
+        eplDisplayLock(pdpy);
+        pthread_mutex_lock(&pwin->mutex);
+
+        // Sanity check: If something called eglTerminate, then that should
+        // have destroyed the surface.
+        assert(pdpy->priv->inst == pwin->inst || surf->deleted);
+    }
+
+    if (surf->deleted)
+    {
+        /*
+         * Some other thread came along and called eglDestroySurface or
+         * eglTerminate.
+         */
+        return EGL_TRUE;
+    }
+
+    if (!success)
+    {
+        eplSetError(pwin->inst->platform, EGL_BAD_ALLOC, "Failed to check window-system events.");
+        return EGL_FALSE;
+    }
+
+    return EGL_TRUE;
+}
+
+/**
+ * Waits for the presentation thread to send or drop at least one frame for
+ * this window.
+ *
+ * Like WaitForWindowEvents, this unlocks the display and the window while
+ * waiting, so the caller must check whether the surface was deleted.
+ */
+static void WaitForAsyncPresent(EplDisplay *pdpy, EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+
+    if (pdpy != NULL)
+    {
+        eplDisplayUnlock(pdpy);
+    }
+
+    pthread_cond_wait(&pwin->async.cond, &pwin->mutex);
+
+    if (pdpy != NULL)
+    {
+        pthread_mutex_unlock(&pwin->mutex);
+        eplDisplayLock(pdpy);
+        pthread_mutex_lock(&pwin->mutex);
+    }
+}
+
+/**
+ * Hands off a frame to the presentation thread.
+ *
+ * The buffer must already have a shared pixmap, and its rendering must
+ * already be flushed and synchronized, exactly as if we were calling
+ * SendPresentPixmap directly, unless \p syncfd is given.
+ *
+ * \param syncfd A fence for the presentation thread to wait for before it
+ *      sends the frame, or -1. On success, this takes ownership of the file
+ *      descriptor.
+ */
+static EGLBoolean QueueAsyncPresent(EplSurface *surf, X11ColorBuffer *buffer,
+        uint32_t options, uint64_t targetUST, const EGLint *rects, EGLint n_rects, int syncfd)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11Presenter *presenter = pwin->inst->presenter;
+    X11QueuedFrame *frame;
+
+    frame = calloc(1, sizeof(X11QueuedFrame));
+    if (frame == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    if (rects != NULL && n_rects > 0)
+    {
+        frame->rects = malloc(n_rects * 4 * sizeof(EGLint));
+        if (frame->rects == NULL)
+        {
+            free(frame);
+            return EGL_FALSE;
+        }
+        memcpy(frame->rects, rects, n_rects * 4 * sizeof(EGLint));
+        frame->n_rects = n_rects;
+    }
+    frame->buffer = buffer;
+    frame->options = options;
+    frame->target_ust = targetUST;
+    frame->syncfd = syncfd;
+    // A frame with a fence comes from the damage callback, which only hands
+    // the fence to us if it couldn't attach it to the timeline.
+    frame->signal_acquire = (syncfd >= 0 && pwin->use_explicit_sync);
+    buffer->status = BUFFER_STATUS_QUEUED;
+    glvnd_list_append(&frame->entry, &pwin->async.frames);
+
+    pthread_mutex_lock(&presenter->mutex);
+    if (!pwin->async.scheduled)
+    {
+        glvnd_list_append(&pwin->async.entry, &presenter->windows);
+        pwin->async.scheduled = EGL_TRUE;
+        pthread_cond_signal(&presenter->cond);
+    }
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return EGL_TRUE;
+}
+
+/**
+ * Waits for a Present event on a window from the presentation thread.
+ *
+ * Unlike ReadWindowEvent, this doesn't block in xcb_wait_for_special_event.
+ * It polls the X connection along with X11Presenter::wake_fd, so that
+ * CancelAsyncPresent can interrupt it, and eglDestroySurface never has to
+ * wait for the server.
+ *
+ * The caller must hold the window's mutex exactly once. This will unlock it
+ * while it waits.
+ */
+static void WaitForPresenterEvent(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    X11Presenter *presenter = pwin->inst->presenter;
+    struct pollfd fds[2];
+    int err;
+
+    if (pwin->event_reader)
+    {
+        // Another thread is reading events for this window, so let it
+        // handle them. CancelAsyncPresent also signals event_cond.
+        pthread_cond_wait(&pwin->event_cond, &pwin->mutex);
+        return;
+    }
+
+    fds[0].fd = presenter->wake_fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    PollWithConnection(NULL, surf, fds, 1, -1, &err);
+
+    if (fds[0].revents & POLLIN)
+    {
+        uint64_t value;
+        if (read(presenter->wake_fd, &value, sizeof(value)) < 0)
+        {
+            // The eventfd is non-blocking, so this only fails if another
+            // wakeup already drained it.
+        }
+    }
+}
+
+/**
+ * Sends every queued frame for a window. This is called from the presentation
+ * thread.
+ */
+static void PresentQueuedFrames(EplSurface *surf)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    struct glvnd_list retired;
+
+    glvnd_list_init(&retired);
+
+    pthread_mutex_lock(&pwin->mutex);
+
+    while (!glvnd_list_is_empty(&pwin->async.frames))
+    {
+        X11QueuedFrame *frame = glvnd_list_first_entry(&pwin->async.frames, X11QueuedFrame, entry);
+        X11ColorBuffer *buffer = frame->buffer;
+
+        /*
+         * Wait for the rendering to finish, and for pending frames to
+         * complete before we send the next one. Neither wait needs the
+         * window's mutex, and the damage callback might give the frame a
+         * newer fence during either one, so keep going until both are done
+         * while we hold the mutex.
+         */
+        while (!surf->deleted && !pwin->native_destroyed && !pwin->async.cancelled)
+        {
+            uint32_t pending;
+
+            if (frame->syncfd >= 0)
+            {
+                int fd = frame->syncfd;
+                frame->syncfd = -1;
+
+                pthread_mutex_unlock(&pwin->mutex);
+
+                // Send anything that we've already batched up first, so that
+                // other windows don't have to wait for this fence.
+                xcb_flush(pwin->inst->conn);
+                eplX11WaitForFD(fd);
+                close(fd);
+                pthread_mutex_lock(&pwin->mutex);
+                continue;
+            }
+
+            PollForWindowEvents(surf);
+            pending = pwin->last_present_serial - pwin->last_complete_serial;
+            if (pending <= pwin->queue->max_pending_frames)
+            {
+                break;
+            }
+
+            // The frames that we're waiting for might still be in XCB's
+            // output buffer.
+            xcb_flush(pwin->inst->conn);
+            WaitForPresenterEvent(surf);
+        }
+
+        glvnd_list_del(&frame->entry);
+        if (surf->deleted || pwin->native_destroyed || pwin->async.cancelled)
+        {
+            // Nobody's going to see this frame, so just drop it.
+            buffer->status = BUFFER_STATUS_IDLE;
+        }
+        else if (frame->signal_acquire && !SignalNextTimelinePoint(pwin, buffer))
+        {
+            // The server would never see the acquire point, so drop the frame.
+            buffer->status = BUFFER_STATUS_IDLE;
+        }
+        else
+        {
+            // If this fails, then SendPresentPixmap will set the
+            // pixmap_error flag, and the next eglSwapBuffers will fail.
+            SendPresentPixmap(surf, buffer, frame->options, frame->target_ust,
+                    frame->rects, frame->n_rects);
+        }
+
+        if (buffer->retired)
+        {
+            // We can't call into the driver while holding the window's
+            // mutex, so free retired buffers after we unlock it.
+            ForgetPresentedBuffer(pwin, buffer);
+            glvnd_list_del(&buffer->entry);
+            glvnd_list_append(&buffer->entry, &retired);
+        }
+
+        if (frame->syncfd >= 0)
+        {
+            close(frame->syncfd);
+        }
+        free(frame->rects);
+        free(frame);
+
+        pthread_cond_broadcast(&pwin->async.cond);
+    }
+
+    pthread_mutex_unlock(&pwin->mutex);
+
+    while (!glvnd_list_is_empty(&retired))
+    {
+        X11ColorBuffer *buffer = glvnd_list_first_entry(&retired, X11ColorBuffer, entry);
+        glvnd_list_del(&buffer->entry);
+        FreeColorBuffer(pwin->inst, buffer);
+    }
+}
+
+static void *PresenterThread(void *param)
+{
+    X11Presenter *presenter = param;
+    xcb_connection_t *conn = NULL;
+
+    pthread_mutex_lock(&presenter->mutex);
+    while (!presenter->shutdown)
+    {
+        X11Window *pwin;
+
+        if (!glvnd_list_is_empty(&presenter->jobs))
+        {
+            X11PresenterJob *job = glvnd_list_first_entry(&presenter->jobs, X11PresenterJob, entry);
+            glvnd_list_del(&job->entry);
+            presenter->current_job = job->param;
+            pthread_mutex_unlock(&presenter->mutex);
+
+            eplX11WaitForFD(job->syncfd);
+            close(job->syncfd);
+            job->func(job->param);
+            free(job);
+
+            pthread_mutex_lock(&presenter->mutex);
+            presenter->current_job = NULL;
+            pthread_cond_broadcast(&presenter->idle_cond);
+            continue;
+        }
+
+        if (glvnd_list_is_empty(&presenter->windows))
+        {
+            pthread_cond_wait(&presenter->cond, &presenter->mutex);
+            continue;
+        }
+
+        pwin = glvnd_list_first_entry(&presenter->windows, X11Window, async.entry);
+        glvnd_list_del(&pwin->async.entry);
+        pwin->async.scheduled = EGL_FALSE;
+        presenter->current = pwin;
+        conn = pwin->inst->conn;
+        pthread_mutex_unlock(&presenter->mutex);
+
+        PresentQueuedFrames(pwin->async.surf);
+
+        pthread_mutex_lock(&presenter->mutex);
+        presenter->current = NULL;
+        pthread_cond_broadcast(&presenter->idle_cond);
+
+        if (glvnd_list_is_empty(&presenter->windows))
+        {
+            /*
+             * Every window on a display shares the same connection, so if an
+             * app swaps several windows at once, then we can send all of
+             * their PresentPixmap requests with a single flush.
+             */
+            pthread_mutex_unlock(&presenter->mutex);
+            xcb_flush(conn);
+            pthread_mutex_lock(&presenter->mutex);
+        }
+    }
+    pthread_mutex_unlock(&presenter->mutex);
+
+    return NULL;
+}
+
+X11Presenter *eplX11PresenterCreate(void)
+{
+    X11Presenter *presenter = calloc(1, sizeof(X11Presenter));
+
+    if (presenter == NULL)
     {
-        platformAttribs[5] = (EGLAttrib) pwin->current_prime->buffer;
+        return NULL;
     }
-    else
+
+    presenter->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (presenter->wake_fd < 0)
     {
-        platformAttribs[5] = (EGLAttrib) NULL;
+        free(presenter);
+        return NULL;
     }
 
-    platformAttribs[6] = EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_NVX;
-    platformAttribs[7] = (EGLAttrib) WindowUpdateCallback;
-    platformAttribs[8] = EGL_PLATFORM_SURFACE_UPDATE_CALLBACK_PARAM_NVX;
-    platformAttribs[9] = (EGLAttrib) surf;
-    platformAttribs[10] = EGL_PLATFORM_SURFACE_DAMAGE_CALLBACK_NVX;
-    platformAttribs[11] = (EGLAttrib) WindowDamageCallback;
-    platformAttribs[12] = EGL_PLATFORM_SURFACE_DAMAGE_CALLBACK_PARAM_NVX;
-    platformAttribs[13] = (EGLAttrib) surf;
-    platformAttribs[14] = EGL_NONE;
-    esurf = inst->platform->priv->egl.PlatformCreateSurfaceNVX(inst->internal_display->edpy,
-            config, platformAttribs, internalAttribs);
+    pthread_mutex_init(&presenter->mutex, NULL);
+    pthread_cond_init(&presenter->cond, NULL);
+    pthread_cond_init(&presenter->idle_cond, NULL);
+    glvnd_list_init(&presenter->windows);
+    glvnd_list_init(&presenter->jobs);
 
-done:
-    if (esurf == EGL_NO_SURFACE)
+    if (pthread_create(&presenter->thread, NULL, PresenterThread, presenter) != 0)
     {
-        eplX11FreeWindow(surf);
+        close(presenter->wake_fd);
+        pthread_cond_destroy(&presenter->idle_cond);
+        pthread_cond_destroy(&presenter->cond);
+        pthread_mutex_destroy(&presenter->mutex);
+        free(presenter);
+        return NULL;
     }
-    free(windowAttribReply);
-    free(geomReply);
-    free(presentCapsReply);
-    free(error);
-    free(mods);
-    free(internalAttribs);
-    return esurf;
+
+    return presenter;
 }
 
-void eplX11DestroyWindow(EplSurface *surf)
+void eplX11PresenterDestroy(X11Presenter *presenter)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    EGLSurface internalSurf;
-
-    assert(surf->type == EPL_SURFACE_TYPE_WINDOW);
-
-    /*
-     * Lock the surface and increment skip_update_callback. After that, if
-     * another thread tries to call the update callback after this, then
-     * the update callback won't try to call into the driver.
-     */
-    pthread_mutex_lock(&pwin->mutex);
+    if (presenter == NULL)
+    {
+        return;
+    }
 
-    pwin->skip_update_callback++;
-    internalSurf = surf->internal_surface;
+    pthread_mutex_lock(&presenter->mutex);
+    assert(glvnd_list_is_empty(&presenter->windows));
+    assert(glvnd_list_is_empty(&presenter->jobs));
+    presenter->shutdown = EGL_TRUE;
+    pthread_cond_signal(&presenter->cond);
+    pthread_mutex_unlock(&presenter->mutex);
 
-    pthread_mutex_unlock(&pwin->mutex);
+    pthread_join(presenter->thread, NULL);
 
-    /*
-     * We have to unlock the surface before we call the driver's
-     * eglDestroySurface.
-     *
-     * If another thread tries to call the window update callback for this
-     * surface, then it will be holding a mutex in the driver, and then the
-     * callback will try to lock the surface's mutex.
-     *
-     * If we had the surface locked here, then the driver's eglDestroySurface
-     * implementation would try to take the driver's mutex, which would lead to
-     * a deadlock.
-     */
-    if (internalSurf != EGL_NO_SURFACE)
-    {
-        pwin->inst->platform->egl.DestroySurface(pwin->inst->internal_display->edpy, internalSurf);
-    }
+    close(presenter->wake_fd);
+    pthread_cond_destroy(&presenter->idle_cond);
+    pthread_cond_destroy(&presenter->cond);
+    pthread_mutex_destroy(&presenter->mutex);
+    free(presenter);
 }
 
-/**
- * Waits for at least one Present event to arrive.
- *
- * This function will unlock the surface and the display while waiting, so the
- * caller must check the EplSurface::deleted flag to check whether another
- * thread destroyed the surface in the meantime.
- */
-static EGLBoolean WaitForWindowEvents(EplDisplay *pdpy, EplSurface *surf)
+EGLBoolean eplX11PresenterQueueJob(X11Presenter *presenter, int syncfd,
+        X11PresenterJobFunc func, void *param)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    xcb_generic_event_t *xcbevt;
-
-    /*
-     * We don't want to block other threads while we wait, so we need to
-     * release our locks.
-     *
-     * The use counter in EplDisplay should prevent the display from
-     * getting terminated out from under us, and the refcount in EplSurface
-     * will ensure that the EplSurface struct itself sticks around.
-     *
-     * It's still possible that the surface will get destroyed by another
-     * thread in the meantime, though, so the caller needs to check for that.
-     */
+    X11PresenterJob *job;
+    int fd;
 
-    if (pwin->native_destroyed)
+    fd = dup(syncfd);
+    if (fd < 0)
     {
-        /*
-         * If the X window was destroyed, then xcb_wait_for_special_event would
-         * hang because it would never receive any events for that window.
-         * However, a new enough X server will send a PresentConfigureNotify
-         * event with a special flag set to notify the client when that
-         * happens.
-         *
-         * Note that even though we unlock the window's mutex before calling
-         * xcb_wait_for_special_event, we should still be safe from race
-         * conditions. This function is only called from eglSwapBuffers, which
-         * means that the window must be current. Thus, only one thread will
-         * ever be here for this window.
-         *
-         * There is still a race condition if the X window gets destroyed
-         * before the server receives the PresentPixmap request, but there's
-         * not much that we can do about that.
-         */
-        return EGL_TRUE;
+        return EGL_FALSE;
     }
 
-    pthread_mutex_unlock(&pwin->mutex);
-    eplDisplayUnlock(pdpy);
-
-    xcbevt = xcb_wait_for_special_event(pwin->inst->conn, pwin->present_event);
-
-    eplDisplayLock(pdpy);
-    pthread_mutex_lock(&pwin->mutex);
-
-    // Sanity check: If something called eglTerminate, then that should have
-    // destroyed the surface.
-    assert(pdpy->priv->inst == pwin->inst || surf->deleted);
+    pthread_mutex_lock(&presenter->mutex);
 
-    if (surf->deleted)
+    // If the same job is already waiting, then just give it the new fence.
+    // Both fences come from the same command stream, so the new one won't
+    // signal before the old one.
+    glvnd_list_for_each_entry(job, &presenter->jobs, entry)
     {
-        /*
-         * Some other thread came along and called eglDestroySurface or
-         * eglTerminate.
-         */
-        return EGL_TRUE;
+        if (job->func == func && job->param == param)
+        {
+            close(job->syncfd);
+            job->syncfd = fd;
+            pthread_mutex_unlock(&presenter->mutex);
+            return EGL_TRUE;
+        }
     }
 
-    if (xcbevt == NULL)
+    job = malloc(sizeof(X11PresenterJob));
+    if (job == NULL)
     {
-        // Note that this only happens if the X11 connection gets killed, as
-        // per XKillClient.
-        eplSetError(pwin->inst->platform, EGL_BAD_ALLOC, "Failed to check window-system events.");
-        pwin->native_destroyed = EGL_TRUE;
+        pthread_mutex_unlock(&presenter->mutex);
+        close(fd);
         return EGL_FALSE;
     }
+    job->syncfd = fd;
+    job->func = func;
+    job->param = param;
+    glvnd_list_append(&job->entry, &presenter->jobs);
+    pthread_cond_signal(&presenter->cond);
 
-    HandlePresentEvent(surf, xcbevt);
-    free(xcbevt);
+    pthread_mutex_unlock(&presenter->mutex);
+    return EGL_TRUE;
+}
 
-    // There might be more than one event, so poll, but don't wait for them.
-    PollForWindowEvents(surf);
+void eplX11PresenterWaitJobs(X11Presenter *presenter, void *param)
+{
+    pthread_mutex_lock(&presenter->mutex);
+    while (1)
+    {
+        X11PresenterJob *job;
+        EGLBoolean pending = (presenter->current_job == param);
 
-    return EGL_TRUE;
+        glvnd_list_for_each_entry(job, &presenter->jobs, entry)
+        {
+            if (job->param == param)
+            {
+                pending = EGL_TRUE;
+                break;
+            }
+        }
+
+        if (!pending)
+        {
+            break;
+        }
+        pthread_cond_wait(&presenter->idle_cond, &presenter->mutex);
+    }
+    pthread_mutex_unlock(&presenter->mutex);
 }
 
 /**
@@ -1601,6 +4049,7 @@ static EGLBoolean SyncRendering(EplDisplay *pdpy, EplSurface *surf, X11ColorBuff
     int syncFd = -1;
     EGLSync sync = EGL_NO_SYNC;
     EGLBoolean success = EGL_FALSE;
+    X11_TRACE_SCOPE(0, buffer->xpix, buffer->timeline.point);
 
     if (!pwin->inst->supports_EGL_ANDROID_native_fence_sync)
     {
@@ -1699,17 +4148,28 @@ static EGLBoolean WaitForSyncFDGPU(X11DisplayInstance *inst, int syncfd)
     return success;
 }
 
-static EGLBoolean WaitImplicitFence(EplDisplay *pdpy, X11ColorBuffer *buffer)
+static EGLBoolean WaitImplicitFence(X11DisplayInstance *inst, X11ColorBuffer *buffer)
 {
     EGLBoolean success = EGL_FALSE;
     int fd = -1;
 
-    assert(pdpy->priv->inst->supports_implicit_sync);
+    assert(inst->supports_implicit_sync);
 
-    fd = eplX11ExportDmaBufSyncFile(pdpy->priv->inst, buffer->fd);
+    fd = eplX11ExportDmaBufSyncFile(inst, buffer->fd);
     if (fd >= 0)
     {
-        success = WaitForSyncFDGPU(pdpy->priv->inst, fd);
+        struct pollfd pfd = { fd, POLLIN, 0 };
+
+        // By the time we reuse a buffer, the server has usually finished
+        // with it, so check the fence before going through an EGLSync.
+        if (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+        {
+            success = EGL_TRUE;
+        }
+        else
+        {
+            success = WaitForSyncFDGPU(inst, fd);
+        }
         close(fd);
     }
 
@@ -1721,6 +4181,73 @@ static EGLBoolean WaitImplicitFence(EplDisplay *pdpy, X11ColorBuffer *buffer)
     return success;
 }
 
+/**
+ * Polls a set of file descriptors along with the X connection.
+ *
+ * This will unlock the surface and the display while waiting, and will
+ * handle any Present events that arrived before returning.
+ *
+ * \param pdpy The EplDisplay pointer, or NULL if the caller doesn't hold the
+ *      display lock.
+ * \param surf The EplSurface pointer.
+ * \param fds The file descriptors to wait on. This must have room for
+ *      \p count + 1 elements, since the last one is used for the X
+ *      connection.
+ * \param count The number of file descriptors in \p fds.
+ * \param timeout_ms The number of milliseconds to wait, zero to poll, or
+ *      negative to wait until something happens.
+ * \param[out] ret_err Returns the errno value from poll.
+ * \return The return value from poll.
+ */
+static int PollWithConnection(EplDisplay *pdpy, EplSurface *surf,
+        struct pollfd *fds, int count, int timeout_ms, int *ret_err)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    int ret;
+
+    fds[count].fd = xcb_get_file_descriptor(pwin->inst->conn);
+    fds[count].events = POLLIN;
+    fds[count].revents = 0;
+
+    if (timeout_ms < 0)
+    {
+        timeout_ms = CONNECTION_WAIT_TIMEOUT;
+    }
+
+    // Release the locks while we wait, so that we don't block
+    // other threads.
+    pthread_mutex_unlock(&pwin->mutex);
+    if (pdpy != NULL)
+    {
+        eplDisplayUnlock(pdpy);
+    }
+
+    ret = poll(fds, count + 1, timeout_ms);
+    *ret_err = errno;
+
+    if (pdpy != NULL)
+    {
+        eplDisplayLock(pdpy);
+    }
+    pthread_mutex_lock(&pwin->mutex);
+
+    if (!surf->deleted)
+    {
+        if (xcb_connection_has_error(pwin->inst->conn))
+        {
+            // If the connection is gone, then the socket will stay readable,
+            // so treat it like the window was destroyed instead of spinning.
+            pwin->native_destroyed = EGL_TRUE;
+        }
+        else if (fds[count].revents & POLLIN)
+        {
+            PollForWindowEvents(surf);
+        }
+    }
+
+    return ret;
+}
+
 /**
  * Waits or polls for a buffer to free up, using implicit sync.
  *
@@ -1728,11 +4255,14 @@ static EGLBoolean WaitImplicitFence(EplDisplay *pdpy, X11ColorBuffer *buffer)
  * PresentIdleNotify event. If no buffers were ready, then the caller
  * has to wait for a Present event and try again.
  *
- * \param pdpy The EplDisplay pointer.
+ * \param pdpy The EplDisplay pointer, or NULL if the caller doesn't hold the
+ *      display lock.
  * \param surf The EplSurface pointer.
  * \param buffer_list The list of buffers to check.
  * \param skip If not NULL, then ignore this buffer when checking the rest.
- * \param timeout_ms The number of milliseconds to wait. Zero to poll without blocking.
+ * \param timeout_ms The number of milliseconds to wait. Zero to poll without
+ *      blocking, or negative to wait until a buffer frees up or a Present
+ *      event arrives.
  *
  * \return The number of buffers that were checked, or -1 on error.
  */
@@ -1759,7 +4289,7 @@ static int CheckBufferReleaseImplicit(EplDisplay *pdpy, EplSurface *surf,
              * If possible, extract a syncfd and wait on it using eglWaitSync,
              * instead of doing a CPU wait.
              */
-            if (WaitImplicitFence(pdpy, buffer))
+            if (WaitImplicitFence(pwin->inst, buffer))
             {
                 assert(buffer->status == BUFFER_STATUS_IDLE);
                 return 1;
@@ -1774,7 +4304,7 @@ static int CheckBufferReleaseImplicit(EplDisplay *pdpy, EplSurface *surf,
     }
 
     buffers = alloca(count * sizeof(X11ColorBuffer *));
-    fds = alloca(count * sizeof(struct pollfd));
+    fds = alloca((count + 1) * sizeof(struct pollfd));
 
     count = 0;
     glvnd_list_for_each_entry(buffer, buffer_list, entry)
@@ -1789,16 +4319,8 @@ static int CheckBufferReleaseImplicit(EplDisplay *pdpy, EplSurface *surf,
         }
     }
 
-    // Release the locks while we wait, so that we don't block
-    // other threads.
-    pthread_mutex_unlock(&pwin->mutex);
-    eplDisplayUnlock(pdpy);
-
-    ret = poll(fds, count, timeout_ms);
-    err = errno;
-
-    eplDisplayLock(pdpy);
-    pthread_mutex_lock(&pwin->mutex);
+    // Wait for a buffer or a Present event, whichever comes first.
+    ret = PollWithConnection(pdpy, surf, fds, count, timeout_ms, &err);
 
     if (surf->deleted)
     {
@@ -1840,61 +4362,214 @@ static int CheckBufferReleaseImplicit(EplDisplay *pdpy, EplSurface *surf,
  * wait for a PresentIdleNotify event, and then hope that the buffer really is
  * idle by the time we start rendering to it again.
  */
-static int CheckBufferReleaseNoSync(EplDisplay *pdpy, EplSurface *surf,
-        struct glvnd_list *buffer_list, X11ColorBuffer *skip)
+static int CheckBufferReleaseNoSync(EplDisplay *pdpy, EplSurface *surf,
+        struct glvnd_list *buffer_list, X11ColorBuffer *skip)
+{
+    X11ColorBuffer *buffer;
+    int numPending = 0;
+
+    PollForWindowEvents(surf);
+
+    glvnd_list_for_each_entry(buffer, buffer_list, entry)
+    {
+        if (buffer != skip && buffer->status == BUFFER_STATUS_IDLE_NOTIFIED)
+        {
+            buffer->status = BUFFER_STATUS_IDLE;
+            numPending++;
+        }
+    }
+
+    return numPending;
+}
+
+/**
+ * Waits for a timeline point.
+ *
+ * If the point has already signaled, then this returns immediately.
+ * Otherwise, this will attempt to use eglWaitSync to let the GPU wait on the
+ * sync point, but if that fails, then it'll fall back to a CPU wait.
+ */
+static EGLBoolean WaitTimelinePoint(X11DisplayInstance *inst, X11Timeline *timeline)
+{
+    int syncfd = -1;
+    EGLBoolean success = EGL_FALSE;
+
+    if (eplX11TimelineIsSignaled(inst, timeline))
+    {
+        // If the point has already signaled, then there's nothing to wait
+        // for, so skip the sync FD and the EGLSync.
+        return EGL_TRUE;
+    }
+
+    syncfd = eplX11TimelinePointToSyncFD(inst, timeline);
+    if (syncfd >= 0)
+    {
+        success = WaitForSyncFDGPU(inst, syncfd);
+    }
+
+    if (!success)
+    {
+        // If using eglWaitSync failed, then just do a CPU wait on the timeline
+        // point.
+        uint32_t first;
+        if (inst->platform->priv->drm.SyncobjTimelineWait(
+                    gbm_device_get_fd(inst->gbmdev),
+                    &timeline->handle, &timeline->point, 1, INT64_MAX,
+                    DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+                    &first) == 0)
+        {
+            eplSetError(inst->platform, EGL_BAD_ALLOC,
+                    "Internal error: drmSyncobjTimelineWait(WAIT_FOR_SUBMIT) failed: %s\n",
+                    strerror(errno));
+            success = EGL_TRUE;
+        }
+    }
+
+    return success;
+}
+
+/**
+ * Clears any pending signal from a buffer's release eventfd.
+ */
+static void DrainReleaseEventfd(X11ColorBuffer *buffer)
+{
+    uint64_t value;
+
+    if (read(buffer->release_eventfd, &value, sizeof(value)) < 0)
+    {
+        // The eventfd is non-blocking, so this just means that it wasn't
+        // signaled.
+    }
+}
+
+/**
+ * Makes sure that a buffer's release eventfd is armed for the buffer's
+ * current timeline point.
+ *
+ * \param[out] ret_supported Set to EGL_FALSE if drmSyncobjEventfd failed
+ *      because the kernel doesn't support it.
+ * \return EGL_TRUE on success, or EGL_FALSE if the caller should fall back
+ *      to drmSyncobjTimelineWait.
+ */
+static EGLBoolean ArmReleaseEventfd(X11Window *pwin, X11ColorBuffer *buffer,
+        EGLBoolean *ret_supported)
 {
-    X11ColorBuffer *buffer;
-    int numPending = 0;
+    int drmFd = gbm_device_get_fd(pwin->inst->gbmdev);
 
-    PollForWindowEvents(surf);
+    if (buffer->release_eventfd < 0)
+    {
+        buffer->release_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (buffer->release_eventfd < 0)
+        {
+            // This is most likely a temporary shortage of file descriptors,
+            // so just fall back for this wait.
+            return EGL_FALSE;
+        }
+    }
 
-    glvnd_list_for_each_entry(buffer, buffer_list, entry)
+    if (buffer->release_armed && buffer->release_armed_handle == buffer->timeline.handle
+            && buffer->release_armed_point == buffer->timeline.point)
     {
-        if (buffer != skip && buffer->status == BUFFER_STATUS_IDLE_NOTIFIED)
+        return EGL_TRUE;
+    }
+
+    // Clear any signal that's left over from an earlier point.
+    DrainReleaseEventfd(buffer);
+    buffer->release_armed = EGL_FALSE;
+
+    if (pwin->inst->platform->priv->drm.SyncobjEventfd(drmFd,
+                buffer->timeline.handle, buffer->timeline.point,
+                buffer->release_eventfd, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE) != 0)
+    {
+        if (errno == ENOTTY || errno == EINVAL || errno == ENOSYS)
         {
-            buffer->status = BUFFER_STATUS_IDLE;
-            numPending++;
+            *ret_supported = EGL_FALSE;
         }
+        return EGL_FALSE;
     }
 
-    return numPending;
+    buffer->release_armed = EGL_TRUE;
+    buffer->release_armed_handle = buffer->timeline.handle;
+    buffer->release_armed_point = buffer->timeline.point;
+    return EGL_TRUE;
 }
 
 /**
- * Waits for a timeline point.
+ * Waits for a buffer to free up, using drmSyncobjEventfd so that we can also
+ * wait on the X connection.
  *
- * This will attempt to use eglWaitSync to let the GPU wait on the sync point,
- * but if that fails, then it'll fall back to a CPU wait.
+ * \param[out] ret_supported Returns EGL_FALSE if the eventfd path couldn't be
+ *      used for this wait, in which case the caller should fall back to
+ *      drmSyncobjTimelineWait.
+ * \return The number of buffers that were checked, or -1 on error.
  */
-static EGLBoolean WaitTimelinePoint(X11DisplayInstance *inst, X11Timeline *timeline)
+static int CheckBufferReleaseEventfd(EplDisplay *pdpy, EplSurface *surf,
+        X11ColorBuffer **buffers, uint32_t count, int timeout_ms,
+        EGLBoolean *ret_supported)
 {
-    int syncfd = eplX11TimelinePointToSyncFD(inst, timeline);
-    EGLBoolean success = EGL_FALSE;
+    X11Window *pwin = (X11Window *) surf->priv;
+    struct pollfd *fds = alloca((count + 1) * sizeof(struct pollfd));
+    EGLBoolean kernelSupported = EGL_TRUE;
+    uint32_t i;
+    int ret, err;
 
-    if (syncfd >= 0)
+    *ret_supported = EGL_TRUE;
+
+    for (i=0; i<count; i++)
     {
-        success = WaitForSyncFDGPU(inst, syncfd);
+        if (!ArmReleaseEventfd(pwin, buffers[i], &kernelSupported))
+        {
+            if (!kernelSupported)
+            {
+                // The kernel doesn't support DRM_IOCTL_SYNCOBJ_EVENTFD, so
+                // don't bother trying again.
+                pwin->use_syncobj_eventfd = EGL_FALSE;
+            }
+            *ret_supported = EGL_FALSE;
+            return count;
+        }
+        fds[i].fd = buffers[i]->release_eventfd;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
     }
 
-    if (!success)
+    ret = PollWithConnection(pdpy, surf, fds, count, timeout_ms, &err);
+
+    if (surf->deleted)
     {
-        // If using eglWaitSync failed, then just do a CPU wait on the timeline
-        // point.
-        uint32_t first;
-        if (inst->platform->priv->drm.SyncobjTimelineWait(
-                    gbm_device_get_fd(inst->gbmdev),
-                    &timeline->handle, &timeline->point, 1, INT64_MAX,
-                    DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
-                    &first) == 0)
+        /*
+         * Some other thread came along and called
+         * eglDestroySurface or eglTerminate.
+         */
+        return count;
+    }
+    else if (ret > 0)
+    {
+        for (i=0; i<count; i++)
         {
-            eplSetError(inst->platform, EGL_BAD_ALLOC,
-                    "Internal error: drmSyncobjTimelineWait(WAIT_FOR_SUBMIT) failed: %s\n",
-                    strerror(errno));
-            success = EGL_TRUE;
+            if (fds[i].revents & POLLIN)
+            {
+                DrainReleaseEventfd(buffers[i]);
+                buffers[i]->release_armed = EGL_FALSE;
+
+                // The release point is available, but it might not be
+                // signaled yet.
+                if (!WaitTimelinePoint(pwin->inst, &buffers[i]->timeline))
+                {
+                    return -1;
+                }
+                buffers[i]->status = BUFFER_STATUS_IDLE;
+            }
         }
     }
+    else if (ret < 0 && err != EINTR)
+    {
+        eplSetError(pwin->inst->platform, EGL_BAD_ALLOC, "Internal error: poll() failed: %s\n",
+                strerror(err));
+        return -1;
+    }
 
-    return success;
+    return count;
 }
 
 /**
@@ -1903,11 +4578,14 @@ static EGLBoolean WaitTimelinePoint(X11DisplayInstance *inst, X11Timeline *timel
  * Unlike implicit sync, we don't need to wait for a PresentIdleNotify event
  * before waiting on a buffer.
  *
- * \param pdpy The EplDisplay pointer.
+ * \param pdpy The EplDisplay pointer, or NULL if the caller doesn't hold the
+ *      display lock.
  * \param surf The EplSurface pointer.
  * \param buffer_list The list of buffers to check.
  * \param skip If not NULL, then ignore this buffer when checking the rest.
- * \param timeout_ms The number of milliseconds to wait. Zero to poll without blocking.
+ * \param timeout_ms The number of milliseconds to wait. Zero to poll without
+ *      blocking, or negative to wait until a buffer frees up or a Present
+ *      event arrives.
  *
  * \return The number of buffers that were checked, or -1 on error.
  */
@@ -1928,7 +4606,8 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
     count = 0;
     glvnd_list_for_each_entry(buffer, buffer_list, entry)
     {
-        if (buffer != skip && buffer->status != BUFFER_STATUS_IDLE)
+        if (buffer != skip && buffer->status != BUFFER_STATUS_IDLE
+                && buffer->status != BUFFER_STATUS_QUEUED)
         {
             count++;
         }
@@ -1946,7 +4625,8 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
     count = 0;
     glvnd_list_for_each_entry(buffer, buffer_list, entry)
     {
-        if (buffer != skip && buffer->status != BUFFER_STATUS_IDLE)
+        if (buffer != skip && buffer->status != BUFFER_STATUS_IDLE
+                && buffer->status != BUFFER_STATUS_QUEUED)
         {
             buffers[count] = buffer;
             handles[count] = buffer->timeline.handle;
@@ -1955,6 +4635,26 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
         }
     }
 
+    if (timeout_ms != 0 && pwin->use_syncobj_eventfd)
+    {
+        EGLBoolean supported;
+        int ret = CheckBufferReleaseEventfd(pdpy, surf, buffers, count, timeout_ms, &supported);
+        if (supported)
+        {
+            return ret;
+        }
+    }
+
+    if (timeout_ms < 0)
+    {
+        /*
+         * We can't wait on the X connection at the same time, so wait in
+         * smaller slices, and let the caller check for window events in
+         * between.
+         */
+        timeout_ms = RELEASE_WAIT_TIMEOUT;
+    }
+
     if (timeout_ms > 0)
     {
         struct timespec ts;
@@ -1970,7 +4670,10 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
     // Release the locks while we wait, so that we don't block
     // other threads.
     pthread_mutex_unlock(&pwin->mutex);
-    eplDisplayUnlock(pdpy);
+    if (pdpy != NULL)
+    {
+        eplDisplayUnlock(pdpy);
+    }
 
     ret = pwin->inst->platform->priv->drm.SyncobjTimelineWait(
                 gbm_device_get_fd(pwin->inst->gbmdev),
@@ -1979,7 +4682,10 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
                 &first);
     err = errno;
 
-    eplDisplayLock(pdpy);
+    if (pdpy != NULL)
+    {
+        eplDisplayLock(pdpy);
+    }
     pthread_mutex_lock(&pwin->mutex);
 
     if (surf->deleted)
@@ -2021,7 +4727,8 @@ static int CheckBufferReleaseExplicit(EplDisplay *pdpy, EplSurface *surf,
 /**
  * Returns a free buffer.
  *
- * \param pdpy The EplDisplay pointer
+ * \param pdpy The EplDisplay pointer, or NULL if the caller doesn't hold the
+ *      display lock.
  * \param surf The EplSurface pointer
  * \param skip If non-NULL, then ignore this buffer even if it's free.
  * \param prime If true, then look for a free PRIME buffer. Otherwise, look for
@@ -2035,17 +4742,19 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
     X11Window *pwin = (X11Window *) surf->priv;
     struct glvnd_list *buffers;
     int maxBuffers;
+    EGLBoolean waited = EGL_FALSE;
+    X11_TRACE_SCOPE(0, 0, 0);
 
     if (prime)
     {
         assert(pwin->prime);
         buffers = &pwin->prime_buffers;
-        maxBuffers = MAX_PRIME_BUFFERS;
+        maxBuffers = pwin->max_prime_buffers;
     }
     else
     {
         buffers = &pwin->color_buffers;
-        maxBuffers = MAX_COLOR_BUFFERS;
+        maxBuffers = pwin->queue->max_color_buffers;
     }
 
     /*
@@ -2078,14 +4787,30 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
     {
         X11ColorBuffer *buffer = NULL;
         int numBuffers = 0;
+        int numQueued = 0;
 
         // Look to see if a buffer is already free.
         glvnd_list_for_each_entry(buffer, buffers, entry)
         {
             if (buffer->status == BUFFER_STATUS_IDLE && buffer != skip)
             {
+                if (prime)
+                {
+                    if (waited)
+                    {
+                        pwin->prime_buffer_waits++;
+                    }
+                    else
+                    {
+                        pwin->prime_buffer_waits = 0;
+                    }
+                }
                 return buffer;
             }
+            if (buffer->status == BUFFER_STATUS_QUEUED)
+            {
+                numQueued++;
+            }
             numBuffers++;
         }
 
@@ -2100,88 +4825,387 @@ static X11ColorBuffer *GetFreeBuffer(EplDisplay *pdpy, EplSurface *surf,
             else
             {
                 buffer = AllocOneColorBuffer(pwin->inst, pwin->format->fmt, pwin->width, pwin->height,
-                        &pwin->modifier, 1, !pwin->prime);
+                        pwin->alloc_width, pwin->alloc_height, &pwin->modifier, 1, !pwin->prime);
             }
             if (buffer == NULL)
             {
                 return NULL;
             }
+            pwin->stats.buffers_allocated++;
             glvnd_list_add(&buffer->entry, buffers);
             return buffer;
         }
 
-        // Otherwise, we have to wait for a buffer to free up.
+        if (prime && pwin->prime_buffer_waits >= PRIME_BUFFER_GROW_WAITS
+                && maxBuffers < pwin->max_prime_buffers_cap)
+        {
+            /*
+             * We keep having to wait for the server to release a linear
+             * buffer, which means that the copy is stuck behind the
+             * presentation, so add another buffer instead of waiting.
+             */
+            pwin->max_prime_buffers++;
+            pwin->prime_buffer_waits = 0;
+            maxBuffers = pwin->max_prime_buffers;
+            continue;
+        }
+
+        // Otherwise, we have to wait for a buffer to free up.
+        waited = EGL_TRUE;
+
+        if (numQueued > 0 && numQueued + (skip != NULL ? 1 : 0) >= numBuffers)
+        {
+            /*
+             * Every buffer that we could wait on is still in the presentation
+             * thread's queue, so we have to wait for it to send at least one
+             * of them before the server can release anything.
+             */
+            WaitForAsyncPresent(pdpy, surf);
+            continue;
+        }
+
+        if (pwin->use_explicit_sync)
+        {
+            /*
+             * With explicit sync, we can just wait on every buffer, even if we
+             * haven't gotten a PresentIdleNotify event.
+             *
+             * We do still poll for window events, though, in case the native
+             * window gets destroyed while we're waiting.
+             */
+            if (CheckBufferReleaseExplicit(pdpy, surf, buffers, skip, -1) <= 0)
+            {
+                return NULL;
+            }
+
+            PollForWindowEvents(surf);
+        }
+        else
+        {
+            int numChecked;
+
+            if (pwin->inst->supports_implicit_sync)
+            {
+                numChecked = CheckBufferReleaseImplicit(pdpy, surf, buffers, skip, -1);
+            }
+            else
+            {
+                numChecked = CheckBufferReleaseNoSync(pdpy, surf, buffers, skip);
+            }
+            if (numChecked < 0)
+            {
+                return NULL;
+            }
+            else if (numChecked == 0)
+            {
+                /*
+                 * There weren't any buffers to wait on yet, so wait for a
+                 * present event.
+                 *
+                 * If we receieve a PresentIdleNotify event, then HandlePresentEvent
+                 * will mark the corresponding buffer as ready to wait on, and then
+                 * CheckBufferReleaseImplicit/NoSync will find it on the next pass
+                 * through this loop.
+                 */
+                if (!WaitForWindowEvents(pdpy, surf))
+                {
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static EGLBoolean CheckWindowDeleted(EplSurface *surf, EGLBoolean *ret_success)
+{
+    X11Window *pwin = (X11Window *) surf->priv;
+    if (surf->deleted)
+    {
+        *ret_success = EGL_TRUE;
+        return EGL_TRUE;
+    }
+    else if (pwin->native_destroyed)
+    {
+        *ret_success = EGL_FALSE;
+        eplSetError(pwin->inst->platform, EGL_BAD_NATIVE_WINDOW, "The X11 window has been destroyed");
+        return EGL_TRUE;
+    }
+
+    return EGL_FALSE;
+}
+
+/**
+ * A qsort comparison function for the swap times in X11FrameStats::swap_us.
+ */
+static int CompareSwapTimes(const void *a, const void *b)
+{
+    uint32_t x = *((const uint32_t *) a);
+    uint32_t y = *((const uint32_t *) b);
+    return (x > y) - (x < y);
+}
+
+/**
+ * Returns a name for the sync path that a window uses, for the stats log.
+ */
+static const char *GetSyncModeName(const X11Window *pwin)
+{
+    if (pwin->use_explicit_sync)
+    {
+        return "explicit";
+    }
+    else if (pwin->inst->supports_implicit_sync)
+    {
+        return "implicit";
+    }
+    else
+    {
+        return "none";
+    }
+}
+
+/**
+ * Writes a window's frame statistics to stderr.
+ *
+ * Along with the running totals, this summarizes the recent frames in
+ * X11FrameStats::frames, so that a fallback from flips to copies shows up in
+ * the log.
+ */
+static void LogFrameStats(X11Window *pwin)
+{
+    const X11FrameStats *stats = &pwin->stats;
+    uint32_t swapTimes[FRAME_STATS_RING_SIZE];
+    uint64_t totalLatency = 0;
+    uint64_t maxLatency = 0;
+    uint64_t missed = 0;
+    int recent = 0;
+    int recentFlips = 0;
+    int numSwaps = 0;
+    int i;
+
+    for (i=0; i<FRAME_STATS_RING_SIZE; i++)
+    {
+        const X11FrameRecord *record = &stats->frames[i];
+        if (record->serial != 0 && record->completed)
+        {
+            uint64_t latency = record->complete_ust - record->send_ust;
+            totalLatency += latency;
+            if (latency > maxLatency)
+            {
+                maxLatency = latency;
+            }
+            if (record->complete_msc - record->send_msc > 1)
+            {
+                missed++;
+            }
+            if (record->mode == XCB_PRESENT_COMPLETE_MODE_FLIP)
+            {
+                recentFlips++;
+            }
+            recent++;
+        }
+    }
+
+    fprintf(stderr, "nvidia-egl-x11: window 0x%x: frames %llu, "
+            "buffer wait %llu us, event wait %llu us, sync %llu us, "
+            "buffers %u, trimmed %u, resize reallocs %u, modifier reallocs %u, "
+            "flip %u, copy %u, suboptimal copy %u, skip %u, "
+            "last MSC delta %llu, last UST delta %llu us\n",
+            pwin->xwin, (unsigned long long) pwin->frame_count,
+            (unsigned long long) (stats->buffer_wait_ns / 1000),
+            (unsigned long long) (stats->event_wait_ns / 1000),
+            (unsigned long long) (stats->sync_ns / 1000),
+            stats->buffers_allocated, stats->buffers_trimmed, stats->resize_reallocs, stats->modifier_reallocs,
+            stats->presents_flip, stats->presents_copy,
+            stats->presents_suboptimal_copy, stats->presents_skip,
+            (unsigned long long) stats->last_msc_delta,
+            (unsigned long long) stats->last_ust_delta);
+    if (recent > 0)
+    {
+        fprintf(stderr, "nvidia-egl-x11: window 0x%x: last %d frames: "
+                "%d flips, %llu late, latency avg %llu us, max %llu us\n",
+                pwin->xwin, recent, recentFlips, (unsigned long long) missed,
+                (unsigned long long) (totalLatency / recent),
+                (unsigned long long) maxLatency);
+    }
+
+    /*
+     * The current frame's swap isn't finished yet, so swap_us only has the
+     * previous frames. That's also why there's nothing to report on the
+     * first frame.
+     */
+    numSwaps = (pwin->frame_count - 1 < FRAME_STATS_RING_SIZE)
+        ? (int) (pwin->frame_count - 1) : FRAME_STATS_RING_SIZE;
+    if (numSwaps > 0)
+    {
+        for (i=0; i<numSwaps; i++)
+        {
+            swapTimes[i] = stats->swap_us[(pwin->frame_count - 1 - i) % FRAME_STATS_RING_SIZE];
+        }
+        qsort(swapTimes, numSwaps, sizeof(uint32_t), CompareSwapTimes);
+
+        fprintf(stderr, "nvidia-egl-x11: window 0x%x: sync %s, prime %d: "
+                "last %d swaps: p50 %u us, p90 %u us, p99 %u us, max %u us\n",
+                pwin->xwin, GetSyncModeName(pwin), (int) pwin->prime, numSwaps,
+                swapTimes[numSwaps / 2], swapTimes[(numSwaps * 9) / 10],
+                swapTimes[(numSwaps * 99) / 100], swapTimes[numSwaps - 1]);
+    }
+}
+
+/**
+ * Clamps a 64-bit counter to fit in an EGLint.
+ */
+static EGLint ClampStat(uint64_t value)
+{
+    return (value > INT32_MAX) ? INT32_MAX : (EGLint) value;
+}
+
+EGLBoolean eplX11QueryFrameStats(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value)
+{
+    X11Window *pwin = (X11Window *) psurf->priv;
+    EGLBoolean ret = EGL_TRUE;
+
+    pthread_mutex_lock(&pwin->mutex);
+    switch (attribute)
+    {
+        case EGL_X11_STATS_FRAMES_NVX:
+            *value = ClampStat(pwin->frame_count);
+            break;
+        case EGL_X11_STATS_BUFFER_WAIT_US_NVX:
+            *value = ClampStat(pwin->stats.buffer_wait_ns / 1000);
+            break;
+        case EGL_X11_STATS_EVENT_WAIT_US_NVX:
+            *value = ClampStat(pwin->stats.event_wait_ns / 1000);
+            break;
+        case EGL_X11_STATS_SYNC_US_NVX:
+            *value = ClampStat(pwin->stats.sync_ns / 1000);
+            break;
+        case EGL_X11_STATS_BUFFERS_ALLOCATED_NVX:
+            *value = ClampStat(pwin->stats.buffers_allocated);
+            break;
+        case EGL_X11_STATS_BUFFERS_TRIMMED_NVX:
+            *value = ClampStat(pwin->stats.buffers_trimmed);
+            break;
+        case EGL_X11_STATS_RESIZE_REALLOCS_NVX:
+            *value = ClampStat(pwin->stats.resize_reallocs);
+            break;
+        case EGL_X11_STATS_MODIFIER_REALLOCS_NVX:
+            *value = ClampStat(pwin->stats.modifier_reallocs);
+            break;
+        case EGL_X11_STATS_PRESENTS_FLIP_NVX:
+            *value = ClampStat(pwin->stats.presents_flip);
+            break;
+        case EGL_X11_STATS_PRESENTS_COPY_NVX:
+            *value = ClampStat(pwin->stats.presents_copy);
+            break;
+        case EGL_X11_STATS_PRESENTS_SUBOPTIMAL_COPY_NVX:
+            *value = ClampStat(pwin->stats.presents_suboptimal_copy);
+            break;
+        case EGL_X11_STATS_LAST_MSC_DELTA_NVX:
+            *value = ClampStat(pwin->stats.last_msc_delta);
+            break;
+        case EGL_X11_STATS_LAST_UST_DELTA_US_NVX:
+            *value = ClampStat(pwin->stats.last_ust_delta);
+            break;
+        default:
+            eplSetError(pdpy->platform, EGL_BAD_ATTRIBUTE, "Invalid attribute 0x%04x", attribute);
+            ret = EGL_FALSE;
+            break;
+    }
+    pthread_mutex_unlock(&pwin->mutex);
+
+    return ret;
+}
+
+/**
+ * Finds the oldest completed frame that EGL_X11_FEEDBACK_SERIAL_NVX hasn't
+ * returned yet.
+ *
+ * Frames complete in order, so this stops at the first frame that hasn't
+ * completed. Frames that have already dropped out of the stats ring are
+ * skipped.
+ */
+static const X11FrameRecord *GetNextFeedbackRecord(X11Window *pwin)
+{
+    uint32_t serial = pwin->feedback.serial + 1;
 
-        if (pwin->use_explicit_sync)
-        {
-            /*
-             * With explicit sync, we can just wait on every buffer, even if we
-             * haven't gotten a PresentIdleNotify event.
-             *
-             * We do still poll for window events, though, in case the native
-             * window gets destroyed while we're waiting.
-             */
-            if (CheckBufferReleaseExplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT) <= 0)
-            {
-                return NULL;
-            }
+    if (pwin->last_present_serial - pwin->feedback.serial > FRAME_STATS_RING_SIZE)
+    {
+        serial = pwin->last_present_serial - FRAME_STATS_RING_SIZE + 1;
+    }
 
-            PollForWindowEvents(surf);
+    for (; serial != pwin->last_present_serial + 1; serial++)
+    {
+        const X11FrameRecord *record = &pwin->stats.frames[serial % FRAME_STATS_RING_SIZE];
+        if (serial == 0)
+        {
+            // Serial numbers wrap around, but we never send zero.
+            continue;
         }
-        else
+        if (record->serial != serial || !record->completed)
         {
-            int numChecked;
-
-            if (pwin->inst->supports_implicit_sync)
-            {
-                numChecked = CheckBufferReleaseImplicit(pdpy, surf, buffers, skip, RELEASE_WAIT_TIMEOUT);
-            }
-            else
-            {
-                numChecked = CheckBufferReleaseNoSync(pdpy, surf, buffers, skip);
-            }
-            if (numChecked < 0)
-            {
-                return NULL;
-            }
-            else if (numChecked == 0)
-            {
-                /*
-                 * There weren't any buffers to wait on yet, so wait for a
-                 * present event.
-                 *
-                 * If we receieve a PresentIdleNotify event, then HandlePresentEvent
-                 * will mark the corresponding buffer as ready to wait on, and then
-                 * CheckBufferReleaseImplicit/NoSync will find it on the next pass
-                 * through this loop.
-                 */
-                if (!WaitForWindowEvents(pdpy, surf))
-                {
-                    return NULL;
-                }
-            }
+            break;
         }
+        return record;
     }
-
     return NULL;
 }
 
-static EGLBoolean CheckWindowDeleted(EplSurface *surf, EGLBoolean *ret_success)
+EGLBoolean eplX11QueryPresentFeedback(EplDisplay *pdpy, EplSurface *psurf, EGLint attribute, EGLint *value)
 {
-    X11Window *pwin = (X11Window *) surf->priv;
-    if (surf->deleted)
-    {
-        *ret_success = EGL_TRUE;
-        return EGL_TRUE;
-    }
-    else if (pwin->native_destroyed)
+    X11Window *pwin = (X11Window *) psurf->priv;
+    EGLBoolean ret = EGL_TRUE;
+
+    pthread_mutex_lock(&pwin->mutex);
+    switch (attribute)
     {
-        *ret_success = EGL_FALSE;
-        eplSetError(pwin->inst->platform, EGL_BAD_NATIVE_WINDOW, "The X11 window has been destroyed");
-        return EGL_TRUE;
+        case EGL_X11_PRESENT_SERIAL_NVX:
+            *value = (EGLint) pwin->last_present_serial;
+            break;
+        case EGL_X11_FEEDBACK_SERIAL_NVX:
+            {
+                const X11FrameRecord *record;
+
+                // Pick up any PresentCompleteNotify events that have arrived
+                // since the last time we checked.
+                PollForWindowEvents(psurf);
+
+                record = GetNextFeedbackRecord(pwin);
+                if (record != NULL)
+                {
+                    pwin->feedback = *record;
+                    *value = (EGLint) record->serial;
+                }
+                else
+                {
+                    *value = 0;
+                }
+            }
+            break;
+        case EGL_X11_FEEDBACK_UST_LO_NVX:
+            *value = (EGLint) (uint32_t) pwin->feedback.complete_ust;
+            break;
+        case EGL_X11_FEEDBACK_UST_HI_NVX:
+            *value = (EGLint) (uint32_t) (pwin->feedback.complete_ust >> 32);
+            break;
+        case EGL_X11_FEEDBACK_MSC_LO_NVX:
+            *value = (EGLint) (uint32_t) pwin->feedback.complete_msc;
+            break;
+        case EGL_X11_FEEDBACK_MSC_HI_NVX:
+            *value = (EGLint) (uint32_t) (pwin->feedback.complete_msc >> 32);
+            break;
+        case EGL_X11_FEEDBACK_MODE_NVX:
+            *value = pwin->feedback.mode;
+            break;
+        default:
+            eplSetError(pdpy->platform, EGL_BAD_ATTRIBUTE, "Invalid attribute 0x%04x", attribute);
+            ret = EGL_FALSE;
+            break;
     }
+    pthread_mutex_unlock(&pwin->mutex);
 
-    return EGL_FALSE;
+    return ret;
 }
 
 EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface *surf,
@@ -2190,11 +5214,31 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
     X11Window *pwin = (X11Window *) surf->priv;
     X11ColorBuffer *sharedPixmap = NULL;
     uint32_t options = 0;
+    uint64_t targetUST = 0;
+    uint64_t swapStart = GetTimeNs();
+    uint64_t start;
     EGLBoolean resized = EGL_FALSE;
     EGLBoolean ret = EGL_FALSE;
+    X11_TRACE_SCOPE(pwin->last_present_serial, pwin->xwin, 0);
 
     pthread_mutex_lock(&pwin->mutex);
 
+    /*
+     * Everything below is protected by the window's mutex, so release the
+     * display lock, so that threads swapping other windows on the same
+     * display don't have to wait for us.
+     *
+     * The caller still holds a reference to the surface, and the display's
+     * use count keeps it from being terminated out from under us. If another
+     * thread destroys the surface, then eglDestroySurface will have to wait
+     * for the window mutex, and we'll notice it the next time that we release
+     * that mutex to wait for something.
+     *
+     * Since we're not holding the display lock anymore, we pass NULL instead
+     * of pdpy to the functions below that could wait.
+     */
+    eplDisplayUnlock(pdpy);
+
     // Disable the update callback, so that we don't have to worry about it
     // reallocating the color buffers while we're trying to rearrange them.
     pwin->skip_update_callback++;
@@ -2204,9 +5248,35 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         goto done;
     }
 
+    if (pwin->pixmap_error)
+    {
+        // A PixmapFromBuffers request from an earlier frame failed.
+        pwin->pixmap_error = EGL_FALSE;
+        eplSetError(plat, EGL_BAD_ALLOC, "Can't create shared pixmap");
+        goto done;
+    }
+
+    if (pwin->single_buffered)
+    {
+        /*
+         * eglSwapBuffers has no effect on a single-buffered surface, since
+         * WindowDamageCallback already presents the buffer after each flush.
+         * We still need to handle a resize, though.
+         */
+        if (!CheckReallocWindow(surf, EGL_TRUE, NULL))
+        {
+            eplSetError(plat, EGL_BAD_ALLOC, "Failed to allocate resized buffers.");
+            goto done;
+        }
+        ret = EGL_TRUE;
+        goto done;
+    }
+
     if (pwin->prime)
     {
-        sharedPixmap = GetFreeBuffer(pdpy, surf, NULL, EGL_TRUE);
+        start = GetTimeNs();
+        sharedPixmap = GetFreeBuffer(NULL, surf, NULL, EGL_TRUE);
+        pwin->stats.buffer_wait_ns += GetTimeNs() - start;
         if (CheckWindowDeleted(surf, &ret))
         {
             goto done;
@@ -2244,10 +5314,12 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
     // use in the server.
     assert(sharedPixmap->status == BUFFER_STATUS_IDLE);
 
-    if (!SyncRendering(pdpy, surf, sharedPixmap))
+    start = GetTimeNs();
+    if (!SyncRendering(NULL, surf, sharedPixmap))
     {
         goto done;
     }
+    pwin->stats.sync_ns += GetTimeNs() - start;
 
     if (!pwin->inst->force_prime)
     {
@@ -2257,26 +5329,70 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         options |= XCB_PRESENT_OPTION_SUBOPTIMAL;
     }
 
-    // Wait for pending frames to complete before we continue.
-    while (1)
+    // The presentation time only applies to one frame.
+    targetUST = pwin->next_present_ust;
+    pwin->next_present_ust = 0;
+
+    if (pwin->inst->presenter != NULL)
     {
-        uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
-        if (pending <= MAX_PENDING_FRAMES)
+        /*
+         * Let the presentation thread deal with waiting for pending frames
+         * and sending the PresentPixmap request, so that we can get back to
+         * rendering the next frame.
+         */
+        if (!QueueAsyncPresent(surf, sharedPixmap, options, targetUST, rects, n_rects, -1))
         {
-            break;
+            eplSetError(plat, EGL_BAD_ALLOC, "Out of memory");
+            goto done;
         }
-
-        if (!WaitForWindowEvents(pdpy, surf))
+    }
+    else
+    {
+        // Wait for pending frames to complete before we continue.
+        while (1)
         {
-            goto done;
+            uint32_t pending = pwin->last_present_serial - pwin->last_complete_serial;
+            if (pending <= pwin->queue->max_pending_frames)
+            {
+                break;
+            }
+
+            if (!WaitForWindowEvents(NULL, surf))
+            {
+                goto done;
+            }
+            if (CheckWindowDeleted(surf, &ret))
+            {
+                goto done;
+            }
         }
-        if (CheckWindowDeleted(surf, &ret))
+
+        if (!SendPresentPixmap(surf, sharedPixmap, options, targetUST, rects, n_rects))
         {
+            pwin->pixmap_error = EGL_FALSE;
+            eplSetError(plat, EGL_BAD_ALLOC, "Can't create shared pixmap");
             goto done;
         }
+        xcb_flush(pwin->inst->conn);
     }
 
-    SendPresentPixmap(surf, sharedPixmap, options);
+    /*
+     * Record which frame the back buffer's contents came from, so that we can
+     * report the buffer age if the app uses it again later.
+     *
+     * Note that in the PRIME case, this is the private back buffer, not the
+     * shared linear buffer, since the private buffers are the only ones that
+     * the app ever renders to.
+     */
+    pwin->frame_count++;
+    pwin->current_back->last_frame = pwin->frame_count;
+    pwin->buffer_age_queried = EGL_FALSE;
+    pwin->damage_region_set = EGL_FALSE;
+
+    if (pwin->stats.log_interval > 0 && (pwin->frame_count % pwin->stats.log_interval) == 0)
+    {
+        LogFrameStats(pwin);
+    }
 
     /*
      * Check if we need to reallocate the buffers to deal with a resize or new
@@ -2310,7 +5426,9 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         }
         else
         {
-            newBack = GetFreeBuffer(pdpy, surf, pwin->current_back, EGL_FALSE);
+            start = GetTimeNs();
+            newBack = GetFreeBuffer(NULL, surf, pwin->current_back, EGL_FALSE);
+            pwin->stats.buffer_wait_ns += GetTimeNs() - start;
             if (CheckWindowDeleted(surf, &ret))
             {
                 goto done;
@@ -2340,12 +5458,20 @@ EGLBoolean eplX11SwapBuffers(EplPlatformData *plat, EplDisplay *pdpy, EplSurface
         }
     }
 
+    TrimIdleBuffers(surf);
+
     ret = EGL_TRUE;
     assert(pwin->current_back->status == BUFFER_STATUS_IDLE);
+    pwin->stats.swap_us[pwin->frame_count % FRAME_STATS_RING_SIZE] =
+        (uint32_t) ((GetTimeNs() - swapStart) / 1000);
 
 done:
+    X11_TRACE_ARGS(pwin->last_present_serial, pwin->xwin, 0);
     pwin->skip_update_callback--;
     pthread_mutex_unlock(&pwin->mutex);
+
+    // Re-take the display lock for the caller.
+    eplDisplayLock(pdpy);
     return ret;
 }
 
@@ -2369,11 +5495,13 @@ EGLBoolean eplX11SwapInterval(EGLDisplay edpy, EGLint interval)
             if (psurf->type == EPL_SURFACE_TYPE_WINDOW)
             {
                 X11Window *pwin = (X11Window *) psurf->priv;
+
+                // Lock the window, since eglSwapBuffers and the presentation
+                // thread don't hold the display lock.
+                pthread_mutex_lock(&pwin->mutex);
+                // A negative interval enables adaptive vsync.
                 pwin->swap_interval = interval;
-                if (pwin->swap_interval < 0)
-                {
-                    pwin->swap_interval = 0;
-                }
+                pthread_mutex_unlock(&pwin->mutex);
             }
             eplSurfaceRelease(pdpy, psurf);
             ret = EGL_TRUE;
@@ -2398,15 +5526,189 @@ EGLBoolean eplX11SwapInterval(EGLDisplay edpy, EGLint interval)
 EGLBoolean eplX11WaitGLWindow(EplDisplay *pdpy, EplSurface *psurf)
 {
     X11Window *pwin = (X11Window *) psurf->priv;
+    EGLBoolean ret = EGL_TRUE;
+
+    pthread_mutex_lock(&pwin->mutex);
+
+    // First, wait for the presentation thread to send everything.
+    while (!glvnd_list_is_empty(&pwin->async.frames)
+            && !psurf->deleted && !pwin->native_destroyed)
+    {
+        WaitForAsyncPresent(pdpy, psurf);
+    }
 
     while ((pwin->last_present_serial - pwin->last_complete_serial) > 0
             && !psurf->deleted && !pwin->native_destroyed)
     {
         if (!WaitForWindowEvents(pdpy, psurf))
         {
-            return EGL_FALSE;
+            ret = EGL_FALSE;
+            break;
         }
     }
 
+    pthread_mutex_unlock(&pwin->mutex);
+    return ret;
+}
+
+EGLBoolean eplX11QueryRenderBuffer(EplDisplay *pdpy, EplSurface *psurf, EGLint *value)
+{
+    X11Window *pwin = (X11Window *) psurf->priv;
+
+    // This never changes after the window is created, so we don't need to
+    // lock anything.
+    *value = pwin->single_buffered ? EGL_SINGLE_BUFFER : EGL_BACK_BUFFER;
     return EGL_TRUE;
 }
+
+EGLBoolean eplX11QueryBufferAge(EplDisplay *pdpy, EplSurface *psurf, EGLint *value)
+{
+    X11Window *pwin = (X11Window *) psurf->priv;
+    X11ColorBuffer *back;
+    EGLBoolean ret = EGL_FALSE;
+
+    if (pdpy->platform->egl.GetCurrentSurface(EGL_DRAW) != psurf->external_surface)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_SURFACE, "EGLSurface %p is not current",
+                psurf->external_surface);
+        return EGL_FALSE;
+    }
+
+    pthread_mutex_lock(&pwin->mutex);
+    pwin->skip_update_callback++;
+
+    /*
+     * Handle any pending resize now. If we waited for the update callback to
+     * do it, then we'd end up reallocating the back buffer after reporting its
+     * age.
+     *
+     * Since this surface is current, it's safe to call into the driver here,
+     * for the same reasons as in eglSwapBuffers.
+     */
+    PollForWindowEvents(psurf);
+    if (!CheckReallocWindow(psurf, EGL_FALSE, NULL))
+    {
+        eplSetError(pdpy->platform, EGL_BAD_ALLOC, "Failed to allocate resized buffers.");
+        goto done;
+    }
+
+    back = pwin->current_back;
+    if (back != NULL && back->last_frame != 0)
+    {
+        *value = (EGLint) (pwin->frame_count - back->last_frame + 1);
+    }
+    else
+    {
+        *value = 0;
+    }
+    pwin->buffer_age_queried = EGL_TRUE;
+    ret = EGL_TRUE;
+
+done:
+    pwin->skip_update_callback--;
+    pthread_mutex_unlock(&pwin->mutex);
+    return ret;
+}
+
+EGLBoolean eplX11SetDamageRegion(EGLDisplay edpy, EGLSurface esurf,
+        EGLint *rects, EGLint n_rects)
+{
+    EplDisplay *pdpy = eplDisplayAcquire(edpy);
+    EplSurface *psurf = NULL;
+    EGLBoolean ret = EGL_FALSE;
+
+    if (pdpy == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    if (pdpy->platform->egl.GetCurrentSurface(EGL_DRAW) != esurf)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_MATCH, "EGLSurface %p is not current", esurf);
+        goto done;
+    }
+
+    psurf = eplSurfaceAcquire(pdpy, esurf);
+    if (psurf == NULL || psurf->type != EPL_SURFACE_TYPE_WINDOW)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_MATCH, "EGLSurface %p is not a window", esurf);
+        goto done;
+    }
+
+    if (n_rects < 0 || (n_rects > 0 && rects == NULL))
+    {
+        eplSetError(pdpy->platform, EGL_BAD_PARAMETER, "Invalid damage rectangles");
+        goto done;
+    }
+
+    {
+        X11Window *pwin = (X11Window *) psurf->priv;
+
+        pthread_mutex_lock(&pwin->mutex);
+        if (pwin->damage_region_set)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_ACCESS,
+                    "eglSetDamageRegionKHR was already called for this frame");
+        }
+        else if (!pwin->buffer_age_queried)
+        {
+            eplSetError(pdpy->platform, EGL_BAD_ACCESS,
+                    "EGL_BUFFER_AGE_KHR has not been queried for this frame");
+        }
+        else
+        {
+            /*
+             * The damage region is only a hint. The driver always renders to
+             * the whole back buffer, and we never discard the contents of a
+             * buffer outside of a resize, so we don't need to do anything
+             * with the region itself.
+             */
+            pwin->damage_region_set = EGL_TRUE;
+            ret = EGL_TRUE;
+        }
+        pthread_mutex_unlock(&pwin->mutex);
+    }
+
+done:
+    eplSurfaceRelease(pdpy, psurf);
+    eplDisplayRelease(pdpy);
+    return ret;
+}
+
+EGLBoolean eplX11PresentationTime(EGLDisplay edpy, EGLSurface esurf, EGLnsecsANDROID time)
+{
+    EplDisplay *pdpy = eplDisplayAcquire(edpy);
+    EplSurface *psurf = NULL;
+    EGLBoolean ret = EGL_FALSE;
+
+    if (pdpy == NULL)
+    {
+        return EGL_FALSE;
+    }
+
+    psurf = eplSurfaceAcquire(pdpy, esurf);
+    if (psurf == NULL || psurf->type != EPL_SURFACE_TYPE_WINDOW)
+    {
+        eplSetError(pdpy->platform, EGL_BAD_SURFACE, "EGLSurface %p is not a window", esurf);
+        goto done;
+    }
+
+    {
+        X11Window *pwin = (X11Window *) psurf->priv;
+
+        /*
+         * The X server reports UST values in microseconds, using the same
+         * CLOCK_MONOTONIC timebase that EGL_ANDROID_presentation_time
+         * expects, so we only need to change the units.
+         */
+        pthread_mutex_lock(&pwin->mutex);
+        pwin->next_present_ust = (time > 0) ? ((uint64_t) time) / 1000 : 0;
+        pthread_mutex_unlock(&pwin->mutex);
+        ret = EGL_TRUE;
+    }
+
+done:
+    eplSurfaceRelease(pdpy, psurf);
+    eplDisplayRelease(pdpy);
+    return ret;
+}